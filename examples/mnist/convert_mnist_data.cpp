@@ -1,5 +1,6 @@
-// This script converts the MNIST dataset to a lmdb (default) or
-// leveldb (--backend=leveldb) format used by caffe to load data.
+// This script converts the MNIST dataset to a lmdb (default), leveldb
+// (--backend=leveldb) or memory-mapped (--backend=mmap) format used by caffe
+// to load data.
 // Usage:
 //    convert_mnist_data [FLAGS] input_image_file input_label_file
 //                        output_db_file
@@ -19,6 +20,7 @@
 #include <string>
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/mmap_dataset.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::string;
@@ -72,6 +74,8 @@ void convert_dataset(const char* image_filename, const char* label_filename,
   options.create_if_missing = true;
   options.write_buffer_size = 268435456;
   leveldb::WriteBatch* batch = NULL;
+  // mmap
+  MMapDatasetWriter* mmap_writer = NULL;
 
   // Open db
   if (db_backend == "leveldb") {  // leveldb
@@ -94,6 +98,9 @@ void convert_dataset(const char* image_filename, const char* label_filename,
         << "mdb_txn_begin failed";
     CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
         << "mdb_open failed. Does the lmdb already exist? ";
+  } else if (db_backend == "mmap") {  // mmap
+    LOG(INFO) << "Opening memory-mapped dataset " << db_path;
+    mmap_writer = new MMapDatasetWriter(db_path);
   } else {
     LOG(FATAL) << "Unknown db backend " << db_backend;
   }
@@ -131,6 +138,8 @@ void convert_dataset(const char* image_filename, const char* label_filename,
       mdb_key.mv_data = reinterpret_cast<void*>(&keystr[0]);
       CHECK_EQ(mdb_put(mdb_txn, mdb_dbi, &mdb_key, &mdb_data, 0), MDB_SUCCESS)
           << "mdb_put failed";
+    } else if (db_backend == "mmap") {  // mmap
+      mmap_writer->Write(datum);
     } else {
       LOG(FATAL) << "Unknown db backend " << db_backend;
     }
@@ -146,6 +155,8 @@ void convert_dataset(const char* image_filename, const char* label_filename,
             << "mdb_txn_commit failed";
         CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
             << "mdb_txn_begin failed";
+      } else if (db_backend == "mmap") {  // mmap
+        // Records are written as they come.
       } else {
         LOG(FATAL) << "Unknown db backend " << db_backend;
       }
@@ -161,11 +172,17 @@ void convert_dataset(const char* image_filename, const char* label_filename,
       CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
       mdb_close(mdb_env, mdb_dbi);
       mdb_env_close(mdb_env);
+    } else if (db_backend == "mmap") {  // mmap
+      // Closed below.
     } else {
       LOG(FATAL) << "Unknown db backend " << db_backend;
     }
     LOG(ERROR) << "Processed " << count << " files.";
   }
+  if (mmap_writer) {
+    // Writes the labels and the header.
+    delete mmap_writer;
+  }
   delete pixels;
 }
 
@@ -175,7 +192,7 @@ int main(int argc, char** argv) {
 #endif
 
   gflags::SetUsageMessage("This script converts the MNIST dataset to\n"
-        "the lmdb/leveldb format used by Caffe to load data.\n"
+        "the lmdb/leveldb/mmap format used by Caffe to load data.\n"
         "Usage:\n"
         "    convert_mnist_data [FLAGS] input_image_file input_label_file "
         "output_db_file\n"
@@ -125,6 +125,14 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Exchange the SyncedMemory holding this Blob's data_ with the one
+   *        holding the data_ of Blob other, without copying -- useful to hand
+   *        a filled buffer (e.g. a prefetched batch) to a top blob in O(1).
+   *
+   * Both Blob%s must have the same count and equally sized data buffers.
+   */
+  void SwapData(Blob* other);
 
  protected:
   shared_ptr<SyncedMemory> data_;
@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <list>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -17,6 +19,14 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/mmap_dataset.hpp"
+
+/**
+ Forward declare cv::Mat instead of including OpenCV, which only the
+ WindowDataLayer implementation needs.
+ */
+namespace cv { class Mat; }
 
 namespace caffe {
 
@@ -67,12 +77,67 @@ class BaseDataLayer : public Layer<Dtype> {
   bool output_labels_;
 };
 
+/**
+ * @brief The work of loading batches, for benchmarking the input pipeline
+ *        (see `caffe datatime`). Times are in milliseconds, summed over the
+ *        batches; the split between reading and transforming, and the bytes
+ *        read, are only measured by the DataLayer.
+ */
+struct PrefetchStats {
+  PrefetchStats()
+      : batches(0), bytes_read(0), load_time(0), read_time(0),
+        transform_time(0), wait_time(0) {}
+  void Add(const PrefetchStats& other) {
+    batches += other.batches;
+    bytes_read += other.bytes_read;
+    load_time += other.load_time;
+    read_time += other.read_time;
+    transform_time += other.transform_time;
+    wait_time += other.wait_time;
+  }
+
+  int64_t batches;
+  // The size of the records read, before they are decoded.
+  int64_t bytes_read;
+  // The time spent in LoadBatch by the prefetch thread,
+  double load_time;
+  // of which reading the records,
+  double read_time;
+  // and decoding and transforming them.
+  double transform_time;
+  // The time Forward waited for the prefetch thread.
+  double wait_time;
+};
+
+/**
+ * @brief A prefetched batch: the data and (optional) label blobs filled by a
+ *        BasePrefetchingDataLayer's internal thread.
+ */
+template <typename Dtype>
+class Batch {
+ public:
+  Blob<Dtype> data_, label_;
+  // How this batch was loaded.
+  PrefetchStats stats_;
+};
+
+/**
+ * @brief Provides base for data layers that load their batches on a
+ *        background thread.
+ *
+ * A single long-lived thread keeps up to prefetch_depth batches ready ahead
+ * of Forward; each layer passes the prefetch_depth of its own parameters, e.g.
+ * DataParameter.prefetch_depth. Batches circulate between two queues: the
+ * thread pops an empty batch from prefetch_free_, fills it with LoadBatch and
+ * pushes it to prefetch_full_; Forward pops a full batch, delivers it to the
+ * top blobs and hands it back to prefetch_free_.
+ */
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
  public:
-  explicit BasePrefetchingDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param) {}
+  BasePrefetchingDataLayer(const LayerParameter& param,
+      const int prefetch_depth);
   virtual ~BasePrefetchingDataLayer() {}
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
@@ -86,20 +151,35 @@ class BasePrefetchingDataLayer :
       vector<Blob<Dtype>*>* top);
 
   virtual void CreatePrefetchThread();
+  // Stops the prefetch thread. Subclasses must call this first thing in their
+  // destructor, before the state used by LoadBatch is torn down.
   virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+
+  /// @brief The work of the batches delivered by Forward so far.
+  const PrefetchStats& prefetch_stats() const { return prefetch_stats_; }
+  void ResetPrefetchStats() { prefetch_stats_ = PrefetchStats(); }
 
  protected:
-  Blob<Dtype> prefetch_data_;
-  Blob<Dtype> prefetch_label_;
+  // The thread's function: keeps refilling free batches until stopped.
+  virtual void InternalThreadEntry();
+  // Fills one batch; implemented by the concrete data layers. They may fill
+  // in the read and transform times, and bytes read, of batch->stats_.
+  virtual void LoadBatch(Batch<Dtype>* batch) = 0;
+  // Waits for the next full batch for Forward, and accounts for it.
+  Batch<Dtype>* PopFullBatch();
+
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
+  BlockingQueue<Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  PrefetchStats prefetch_stats_;
 };
 
 template <typename Dtype>
 class DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit DataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param,
+          param.data_param().prefetch_depth()) {}
   virtual ~DataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -112,17 +192,66 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MaxTopBlobs() const { return 2; }
 
  protected:
-  virtual void InternalThreadEntry();
-
-  // LEVELDB
-  shared_ptr<leveldb::DB> db_;
-  shared_ptr<leveldb::Iterator> iter_;
-  // LMDB
-  MDB_env* mdb_env_;
-  MDB_dbi mdb_dbi_;
-  MDB_txn* mdb_txn_;
-  MDB_cursor* mdb_cursor_;
-  MDB_val mdb_key_, mdb_value_;
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  // Parses and transforms one record of the batch; runs on the ThreadPool.
+  void LoadItem(const int item_id, Dtype* top_data, Dtype* top_label);
+
+  // One of the databases the layer reads from, with its own cursor.
+  struct Shard {
+    // LEVELDB
+    shared_ptr<leveldb::DB> db_;
+    shared_ptr<leveldb::Iterator> iter_;
+    // LMDB
+    MDB_env* mdb_env_;
+    MDB_dbi mdb_dbi_;
+    MDB_txn* mdb_txn_;
+    MDB_cursor* mdb_cursor_;
+    MDB_val mdb_key_, mdb_value_;
+    // MMAP
+    shared_ptr<MMapDataset> dataset_;
+    int record_id_;
+    // The number of times the cursor went through the partition, and the
+    // index of the current record in it.
+    int epoch_;
+    int key_index_;
+    // With shuffle: the number of records in this layer's partition (and
+    // their keys, except for MMAP), their order in the current epoch, and the
+    // position of the cursor in that order.
+    int num_keys_;
+    vector<string> keys_;
+    vector<int> order_;
+    int position_;
+    shared_ptr<Caffe::RNG> rng_;
+  };
+  void OpenShard(const string& source, Shard* shard);
+  void CloseShard(Shard* shard);
+  // Moves the cursor to the first record of this layer's partition.
+  void SeekToPartitionStart(Shard* shard);
+  // Moves the cursor one record ahead; returns false at the end of the shard.
+  bool StepShard(Shard* shard);
+  // Moves the cursor to the next record of this layer's partition, restarting
+  // from the start of the shard at its end.
+  void NextRecord(Shard* shard);
+  // Indexes the keys of this layer's partition of the shard.
+  void IndexShardKeys(Shard* shard);
+  // Draws the order of the next epoch and moves to its first record.
+  void ShuffleShard(Shard* shard);
+  // Moves the cursor to the key_index-th record of this layer's partition.
+  void SeekShard(Shard* shard, const int key_index);
+  // Collects the records of the batch that come from one shard.
+  void LoadShardRecords(const int shard_id, const int batch_size);
+
+  vector<shared_ptr<Shard> > shards_;
+  // The shard the next batch starts with.
+  int first_shard_;
+
+  // The serialized records of the batch being loaded, and the epoch and
+  // record index their random choices are keyed on.
+  vector<std::pair<const char*, size_t> > records_;
+  vector<string> record_buffers_;
+  vector<std::pair<int, int64_t> > item_streams_;
+  // MMAP: the dataset and index of the record of each item.
+  vector<std::pair<const MMapDataset*, int> > mmap_records_;
 };
 
 /**
@@ -162,19 +291,23 @@ class DummyDataLayer : public Layer<Dtype> {
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
+ * The files listed in HDF5DataParameter.source hold a "data" and a "label"
+ * dataset with the same number of rows. The prefetch thread reads each batch
+ * straight from the open file as hyperslabs of rows, so only batches are
+ * held in memory and moving to the next file does not stall Forward.
+ *
  * TODO(dox): thorough documentation for Forward and proto params.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param,
+          param.hdf5_data_param().prefetch_depth()),
+        file_id_(-1), data_dataset_(-1), label_dataset_(-1) {}
   virtual ~HDF5DataLayer();
-  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
-  // Data layers have no bottoms, so reshaping is trivial.
-  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {}
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_HDF5_DATA;
@@ -183,22 +316,31 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
  protected:
-  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top);
-  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top);
-  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
-  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
+  virtual void LoadBatch(Batch<Dtype>* batch);
   virtual void LoadHDF5FileData(const char* filename);
+  virtual void CloseHDF5File();
+  // Moves to the first row of the next file, in the order of the epoch.
+  virtual void NextHDF5File();
+  virtual void ShuffleRows();
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
   unsigned int current_file_;
+  // The order in which the files are read; shuffled every epoch.
+  vector<unsigned int> file_permutation_;
+  // The open file and its datasets.
+  hid_t file_id_;
+  hid_t data_dataset_;
+  hid_t label_dataset_;
+  vector<hsize_t> data_dims_;
+  vector<hsize_t> label_dims_;
+  hsize_t num_rows_;
   hsize_t current_row_;
-  Blob<Dtype> data_blob_;
-  Blob<Dtype> label_blob_;
+  // With shuffle: the order in which the rows of the open file are read.
+  vector<hsize_t> row_permutation_;
+  // The rows read for the batch being loaded.
+  vector<hsize_t> batch_rows_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
 };
 
 /**
@@ -252,7 +394,8 @@ template <typename Dtype>
 class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit ImageDataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param,
+          param.image_data_param().prefetch_depth()) {}
   virtual ~ImageDataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -264,24 +407,43 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
  protected:
-  shared_ptr<Caffe::RNG> prefetch_rng_;
+  // Shuffles lines_ for the current epoch.
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  // Reads and transforms one image of the batch; runs on the ThreadPool.
+  void LoadItem(const int item_id, Dtype* top_data, Dtype* top_label);
+  // Reads an image through the ImageCache if enabled; returns NULL on failure.
+  shared_ptr<const Datum> ReadImage(const std::pair<std::string, int>& line);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // The number of passes through lines_ so far, and the seed of the orders
+  // of the passes.
+  int epoch_;
+  uint64_t shuffle_seed_;
+  // The images of the batch being loaded, and the epoch and position their
+  // random choices are keyed on.
+  vector<std::pair<std::string, int> > batch_lines_;
+  vector<std::pair<int, int> > item_streams_;
 };
 
 /**
  * @brief Provides data to the Net from memory.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * The data is given in one of two ways. Reset points the layer at arrays
+ * holding several batches, which Forward cycles through in place; the caller
+ * keeps them alive and must not modify them while the net runs.
+ * Alternatively, producers push batches from any thread with PushBatch or
+ * PushDatumVector: each is copied or transformed into one of
+ * MemoryDataParameter.queue_depth buffers, and Forward pops the next ready
+ * buffer and hands it to the top blobs without copying. Once all the buffers
+ * are in use, pushing blocks until Forward frees one, or fails if it was asked
+ * not to block.
  */
 template <typename Dtype>
 class MemoryDataLayer : public BaseDataLayer<Dtype> {
  public:
-  explicit MemoryDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param), has_new_data_(false) {}
+  explicit MemoryDataLayer(const LayerParameter& param);
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
@@ -297,12 +459,31 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
   //  will be given to Blob, which is mutable
   void Reset(Dtype* data, Dtype* label, int n);
 
+  /**
+   * @brief Queues a copy of one batch of batch_size items. May be called from
+   *        any thread. Returns false, without queueing it, if blocking is
+   *        false and queue_depth batches are already waiting.
+   */
+  bool PushBatch(const Dtype* data, const Dtype* labels,
+      const bool blocking = true);
+  /**
+   * @brief Same as PushBatch for batch_size Datums, which are transformed
+   *        (mean subtraction, scaling, cropping...) on the calling thread.
+   */
+  bool PushDatumVector(const vector<Datum>& datum_vector,
+      const bool blocking = true);
+  /// @brief The number of pushed batches that Forward has not consumed yet.
+  int queued_batches() const { return queue_full_.size(); }
+
   int batch_size() { return batch_size_; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
+  // Pops a free buffer for a producer; NULL if none and not blocking.
+  Batch<Dtype>* PopFreeBatch(const bool blocking);
+
   int batch_size_;
   Dtype* data_;
   Dtype* labels_;
@@ -311,6 +492,16 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
   Blob<Dtype> added_data_;
   Blob<Dtype> added_label_;
   bool has_new_data_;
+
+  // The buffers of the pushed batches, which circulate between the producers
+  // (queue_free_) and Forward (queue_full_).
+  vector<shared_ptr<Batch<Dtype> > > queue_;
+  BlockingQueue<Batch<Dtype>*> queue_free_;
+  BlockingQueue<Batch<Dtype>*> queue_full_;
+  // The number of items pushed with PushDatumVector, counted under sync_.
+  uint64_t num_pushed_items_;
+  class sync;
+  shared_ptr<sync> sync_;
 };
 
 /**
@@ -323,7 +514,9 @@ template <typename Dtype>
 class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit WindowDataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param,
+          param.window_data_param().prefetch_depth()),
+        image_cache_size_(0) {}
   virtual ~WindowDataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -335,14 +528,36 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
  protected:
-  virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
-
-  shared_ptr<Caffe::RNG> prefetch_rng_;
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  // Decodes one of the images of the batch; runs on the ThreadPool.
+  void LoadImage(const int image_id);
+  // Crops and warps one sampled window; runs on the ThreadPool.
+  void LoadItem(const int item_id, Dtype* top_data, Dtype* top_label);
+  // Keeps a decoded image in the cache, evicting the least recently used.
+  void CacheImage(const int image_index, const shared_ptr<cv::Mat>& image);
+
+  // The seed of the window sampling, and the number of batches sampled,
+  // which with the item keys the random choices of each window.
+  uint64_t sample_seed_;
+  uint32_t num_batches_;
   vector<std::pair<std::string, vector<int> > > image_database_;
   enum WindowField { IMAGE_INDEX, LABEL, OVERLAP, X1, Y1, X2, Y2, NUM };
   vector<vector<float> > fg_windows_;
   vector<vector<float> > bg_windows_;
+  // The windows sampled for the batch being loaded.
+  vector<vector<float> > batch_windows_;
+  vector<bool> batch_mirror_;
+  // The distinct images of the batch (as indices into image_database_), once
+  // decoded, and which of them each window of the batch is cut from.
+  vector<int> batch_image_indices_;
+  vector<shared_ptr<cv::Mat> > batch_images_;
+  vector<int> batch_item_images_;
+  // The decoded images kept across batches, most recently used first, their
+  // index by image index and their total size in bytes.
+  typedef std::list<std::pair<int, shared_ptr<cv::Mat> > > ImageCacheList;
+  ImageCacheList image_cache_;
+  std::map<int, typename ImageCacheList::iterator> image_cache_index_;
+  size_t image_cache_size_;
 };
 
 }  // namespace caffe
@@ -3,6 +3,8 @@
 
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/philox.hpp"
 
 namespace caffe {
 
@@ -14,11 +16,12 @@ template <typename Dtype>
 class DataTransformer {
  public:
   explicit DataTransformer(const TransformationParameter& param)
-    : param_(param) {
+    : param_(param), seed_(0), num_transformed_(0) {
     phase_ = Caffe::phase();
   }
   virtual ~DataTransformer() {}
 
+  /// @brief Draws the seed of the random choices from the Caffe RNG.
   void InitRand();
 
   /**
@@ -31,21 +34,72 @@ class DataTransformer {
    * @param datum
    *    Datum containing the data to be transformed.
    * @param mean
+   *    The mean image; only read if the transform_param has a mean_file,
+   *    otherwise its mean_value (by default 0) is subtracted.
    * @param transformed_data
    *    This is meant to be the top blob's data. The transformed data will be
    *    written at the appropriate place within the blob's data.
+   *
+   * The random choices of the n-th call are those of ItemRand(0, n).
    */
   void Transform(const int batch_item_id, const Datum& datum,
                  const Dtype* mean, Dtype* transformed_data);
 
+  /**
+   * @brief Same as above, but draws the random crop and mirror choices from
+   * rng, typically the ItemRand of the item, so that items can be
+   * transformed concurrently. rng may be NULL if no randomness is needed.
+   */
+  void Transform(const int batch_item_id, const Datum& datum,
+                 const Dtype* mean, Dtype* transformed_data,
+                 Philox* rng);
+
+  /**
+   * @brief Same as above for a raw record viewed in place, so that the data
+   * is read straight from the database without building a Datum.
+   */
+  void Transform(const int batch_item_id, const DatumView& datum,
+                 const Dtype* mean, Dtype* transformed_data,
+                 Philox* rng);
+
+  /**
+   * @brief The generator of the random choices for item index of epoch.
+   *
+   * The choices are a function of the seed, epoch and index alone: layers
+   * that transform a batch in parallel key each item on its record, and
+   * get the same results whatever the number of threads or the order in
+   * which the items are transformed.
+   */
+  Philox ItemRand(const uint32_t epoch, const uint64_t index) const {
+    return Philox(seed_, epoch, index);
+  }
+
  protected:
-  virtual unsigned int Rand();
+  unsigned int Rand(Philox* rng);
+
+  // The mean_value of a channel, or 0 if none is given.
+  Dtype MeanValue(const int channel) const;
+
+  // Transforms the channels x height x width float values of one item; data
+  // may be the item's place in transformed_data.
+  template <typename T>
+  void TransformFloats(const int batch_item_id, const T* data,
+                       const int channels, const int height, const int width,
+                       const Dtype* mean, Dtype* transformed_data);
+
+  // Transforms the channels x height x width uint8 pixels of one item.
+  void TransformBytes(const int batch_item_id, const uint8_t* data,
+                      const int channels, const int height, const int width,
+                      const Dtype* mean, Dtype* transformed_data,
+                      Philox* rng);
 
   // Tranformation parameters
   TransformationParameter param_;
 
-
-  shared_ptr<Caffe::RNG> rng_;
+  // The seed of the random choices, and the number of items transformed by
+  // the Transform that takes no generator.
+  uint64_t seed_;
+  uint64_t num_transformed_;
   Caffe::Phase phase_;
 };
 
@@ -154,6 +154,16 @@ class Net {
    */
   static void FilterNet(const NetParameter& param,
       NetParameter* param_filtered);
+  /**
+   * @brief Keep only the layers that the blobs blob_names depend on, so that
+   *        a net built from param_pruned computes them without running (or
+   *        loading the weights of) the other layers. param should already be
+   *        filtered (see FilterNet), since the dependencies are followed
+   *        through the layers in order; in-place layers are kept along with
+   *        the layer whose top they modify.
+   */
+  static void PruneNet(const NetParameter& param,
+      const vector<string>& blob_names, NetParameter* param_pruned);
   /// @brief return whether NetState state meets NetStateRule rule
   static bool StateMeetsRule(const NetState& state, const NetStateRule& rule,
       const string& layer_name);
@@ -35,6 +35,22 @@ class Timer {
   float elapsed_milliseconds_;
 };
 
+/**
+ * @brief Measures wall-clock time on the CPU, with microsecond resolution,
+ *        whatever the Caffe mode. Unlike Timer it does not use CUDA events,
+ *        so it can time work on other threads, e.g. the prefetch threads.
+ */
+class CPUTimer {
+ public:
+  CPUTimer() { Start(); }
+  void Start();
+  /// @brief The milliseconds elapsed since Start; the timer keeps running.
+  double MilliSeconds() const;
+
+ protected:
+  boost::posix_time::ptime start_;
+};
+
 }  // namespace caffe
 
 #endif   // CAFFE_UTIL_BENCHMARK_H_
@@ -0,0 +1,55 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+#define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+
+#include <queue>
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe FIFO used to hand objects between a producer and a
+ *        consumer thread, e.g. prefetched batches between a data layer's
+ *        internal thread and its Forward.
+ *
+ * The boost synchronization primitives are hidden behind sync_ so that this
+ * header can be included from code compiled by NVCC (see internal_thread.hpp).
+ */
+template <typename T>
+class BlockingQueue {
+ public:
+  BlockingQueue();
+
+  void push(const T& t);
+
+  /** Returns false instead of blocking if the queue is empty. */
+  bool try_pop(T* t);
+
+  /**
+   * Blocks until an element is available. If log_on_wait is non-empty, it is
+   * logged the first time the caller has to wait, which is a hint that the
+   * producer is not keeping up.
+   */
+  T pop(const string& log_on_wait = "");
+
+  /** Returns false instead of blocking if the queue is empty. */
+  bool try_peek(T* t);
+
+  /** Blocks until an element is available, but does not remove it. */
+  T peek();
+
+  size_t size() const;
+
+ protected:
+  class sync;
+
+  std::queue<T> queue_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_HPP_
@@ -0,0 +1,82 @@
+#ifndef CAFFE_UTIL_FFT_HPP_
+#define CAFFE_UTIL_FFT_HPP_
+
+#include <complex>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The discrete Fourier transform of real height x width images, whose
+ *        sizes are powers of 2, by radix-2 fast Fourier transforms.
+ *
+ * An image transforms into the height x (width / 2 + 1) half of its spectrum,
+ * the other half being its complex conjugate: out[k][l] is the sum over y, x
+ * of in[y][x] exp(-2 pi i (k y / height + l x / width)). Each row is
+ * transformed as a complex sequence of half its length.
+ *
+ * The plan keeps its work space, so one plan must not be used by several
+ * threads at once.
+ */
+template <typename Dtype>
+class RealFFT2D {
+ public:
+  RealFFT2D(const int height, const int width);
+
+  int height() const { return height_; }
+  int width() const { return width_; }
+  /// @brief The number of complex values of a spectrum.
+  int spectrum_size() const { return height_ * (width_ / 2 + 1); }
+
+  /**
+   * @brief Transforms the height x width image in into its spectrum out.
+   *
+   * Only the first rows of in are read, the others being taken as zero.
+   */
+  void Forward(const Dtype* in, std::complex<Dtype>* out, const int rows);
+  void Forward(const Dtype* in, std::complex<Dtype>* out) {
+    Forward(in, out, height_);
+  }
+  /**
+   * @brief Transforms the spectrum in back into the image out, divided by
+   *        height x width so that Inverse undoes Forward.
+   */
+  void Inverse(const std::complex<Dtype>* in, Dtype* out);
+
+ private:
+  // Transforms the size values of data, a power of 2, in place, with the
+  // twiddles exp(-+2 pi i k / size), k < size / 2, of the forward or inverse
+  // transform and the bit reversal permutation of size. The inverse is not
+  // divided by size.
+  static void Transform(const int size, const vector<int>& reversal,
+      const vector<std::complex<Dtype> >& twiddles, std::complex<Dtype>* data);
+  // Transforms the columns of the height_ x (width_ / 2 + 1) data in place,
+  // a whole row of butterflies at a time.
+  void TransformColumns(const vector<std::complex<Dtype> >& twiddles,
+      std::complex<Dtype>* data);
+
+  int height_;
+  int width_;
+  // The bit reversal permutations and the twiddles of the columns and of the
+  // complex rows of width / 2 values, forward and inverse.
+  vector<int> column_reversal_;
+  vector<int> row_reversal_;
+  vector<std::complex<Dtype> > column_twiddles_;
+  vector<std::complex<Dtype> > inverse_column_twiddles_;
+  vector<std::complex<Dtype> > row_twiddles_;
+  vector<std::complex<Dtype> > inverse_row_twiddles_;
+  // The exp(-2 pi i k / width) for k <= width / 2, that split the transform of
+  // a complex row into that of the real row.
+  vector<std::complex<Dtype> > split_twiddles_;
+  // The spectrum being inverted, and a row being transformed.
+  vector<std::complex<Dtype> > spectrum_;
+  vector<std::complex<Dtype> > buffer_;
+
+  DISABLE_COPY_AND_ASSIGN(RealFFT2D);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FFT_HPP_
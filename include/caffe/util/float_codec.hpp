@@ -0,0 +1,52 @@
+#ifndef CAFFE_UTIL_FLOAT_CODEC_HPP_
+#define CAFFE_UTIL_FLOAT_CODEC_HPP_
+
+#include <stdint.h>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Converts a float to IEEE 754 half precision, rounding to nearest
+ *        even; values beyond the half range become infinities.
+ */
+uint16_t FloatToHalf(const float value);
+/// @brief Converts an IEEE 754 half precision value to float, exactly.
+float HalfToFloat(const uint16_t value);
+
+/// @brief Stores count values as half floats of 2 little-endian bytes each.
+void EncodeHalf(const float* data, const int count, uint8_t* out);
+/// @brief Expands count half floats stored by EncodeHalf.
+template <typename Dtype>
+void DecodeHalf(const uint8_t* data, const int count, Dtype* out);
+
+/**
+ * @brief Quantizes count values to the 8-bit codes q of
+ *        value = offset + scale * q, where offset and scale map the codes
+ *        0 to 255 onto the range of the values.
+ *
+ * The error of each value is at most scale / 2.
+ */
+void EncodeQuantized(const float* data, const int count, uint8_t* out,
+    float* scale, float* offset);
+/// @brief Expands count codes stored by EncodeQuantized.
+template <typename Dtype>
+void DecodeQuantized(const uint8_t* data, const int count, const float scale,
+    const float offset, Dtype* out);
+
+/**
+ * @brief Stores count values in the half_data of datum rather than in
+ *        float_data, halving their size.
+ */
+void SetHalfData(const float* data, const int count, Datum* datum);
+/**
+ * @brief Stores count values in the quantized_data of datum, with its
+ *        quantized_scale and quantized_offset, rather than in float_data.
+ */
+void SetQuantizedData(const float* data, const int count, Datum* datum);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FLOAT_CODEC_HPP_
@@ -15,6 +15,25 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, Dtype* data_im);
 
+// As above, for the output rows row_begin to row_end - 1 only, and with the
+// rows of data_col col_width apart instead of packed: the columns of a strip
+// of an image, or of several images side by side, make up one matrix. This
+// col2im_cpu adds into data_im without clearing it first, so that the strips
+// of an image can be folded back one after the other.
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int row_begin, const int row_end,
+    Dtype* data_col, const int col_width);
+
+template <typename Dtype>
+void col2im_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int row_begin, const int row_end,
+    Dtype* data_im, const int col_width);
+
 template <typename Dtype>
 void im2col_gpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
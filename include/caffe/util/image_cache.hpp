@@ -0,0 +1,68 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief A byte-bounded cache of decoded images, evicting the least recently
+ *        used image when full.
+ *
+ * The ImageDataLayer caches the Datums it decodes and resizes from image
+ * files, so that later epochs, and the other nets of the process reading the
+ * same files, skip the decoding. Lookup and Insert may be called concurrently;
+ * the cached Datums are immutable and stay valid while a caller holds them,
+ * even once evicted.
+ */
+class ImageCache {
+ public:
+  /// @brief The process-wide cache shared by all ImageDataLayers.
+  static ImageCache& Get();
+
+  explicit ImageCache(size_t capacity = 0);
+
+  /**
+   * @brief Raises the capacity to at least the given number of bytes; the
+   *        layers sharing the cache each reserve their budget.
+   */
+  void Reserve(size_t capacity);
+
+  /// @brief Returns the cached image for key, or NULL if there is none.
+  shared_ptr<const Datum> Lookup(const string& key);
+  /// @brief Caches an image, evicting the least recently used ones to fit.
+  void Insert(const string& key, const shared_ptr<const Datum>& datum);
+
+  size_t capacity() const { return capacity_; }
+  /// @brief The bytes taken by the cached images.
+  size_t size() const { return size_; }
+  int num_images() const { return entries_.size(); }
+
+ protected:
+  class sync;
+  typedef std::list<std::pair<string, shared_ptr<const Datum> > > EntryList;
+
+  static size_t EntrySize(const string& key, const Datum& datum);
+  void EvictTo(size_t size);
+
+  size_t capacity_;
+  size_t size_;
+  // The cached images, most recently used first, and their index by key.
+  EntryList entries_;
+  std::map<string, EntryList::iterator> index_;
+  shared_ptr<sync> sync_;
+
+  static shared_ptr<ImageCache> singleton_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
@@ -1,8 +1,10 @@
 #ifndef CAFFE_UTIL_IO_H_
 #define CAFFE_UTIL_IO_H_
 
+#include <stdint.h>
 #include <unistd.h>
 #include <string>
+#include <vector>
 
 #include "google/protobuf/message.h"
 #include "hdf5.h"
@@ -102,8 +104,89 @@ inline bool ReadImageToDatum(const string& filename, const int label,
   return ReadImageToDatum(filename, label, 0, 0, datum);
 }
 
+/**
+ * @brief Stores an image file in the datum without decoding it, or re-encoded
+ *        in the same format if it has to be resized; see DecodeDatum.
+ *
+ * The image is still decoded once to validate it and to record the shape it
+ * decodes to (with is_color false, as a single channel).
+ */
+bool ReadImageToEncodedDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color, Datum* datum);
+
+/**
+ * @brief Replaces the compressed image of an encoded datum by its pixels.
+ *
+ * Does nothing for datums that are not encoded. Returns false if the image
+ * cannot be decoded to the shape recorded in the datum.
+ */
+bool DecodeDatum(Datum* datum);
+
+/**
+ * @brief The fields of a Datum holding raw uint8, float or compact float
+ *        data, with data, float_data, half_data or quantized_data pointing
+ *        into the buffer it was read from instead of a copy of it.
+ *
+ * The view is only valid as long as that buffer, e.g. the current LevelDB
+ * iterator value, the LMDB page of a read transaction or a memory-mapped
+ * dataset. Exactly one of data, float_data, half_data and quantized_data is
+ * set; data_size is the size in bytes of data, half_data or quantized_data.
+ */
+struct DatumView {
+  int channels;
+  int height;
+  int width;
+  int label;
+  const uint8_t* data;
+  int data_size;
+  const float* float_data;
+  const uint8_t* half_data;
+  const uint8_t* quantized_data;
+  float quantized_scale;
+  float quantized_offset;
+};
+
+/**
+ * @brief Parses a serialized Datum without copying its pixel bytes or its
+ *        compact float data.
+ *
+ * Returns false if the record cannot be viewed in place, e.g. because it
+ * holds float_data; such records must be parsed into a Datum instead.
+ */
+bool ParseDatumView(const void* buffer, size_t size, DatumView* view);
+
 leveldb::Options GetLevelDBOptions();
 
+/**
+ * @brief Serializes the HDF5 calls of the whole process while in scope.
+ *
+ * The HDF5 library is usually built without thread safety, and the HDF5 data
+ * layers call it from their prefetch threads, concurrently with each other
+ * and with HDF5OutputLayer. Every HDF5 call must be made holding an HDF5Lock;
+ * the hdf5_* functions below take it themselves. It may be taken recursively.
+ */
+class HDF5Lock {
+ public:
+  HDF5Lock();
+  ~HDF5Lock();
+
+ private:
+  DISABLE_COPY_AND_ASSIGN(HDF5Lock);
+};
+
+// Checks that a dataset holds floating point data of min_dim to max_dim
+// dimensions, and returns its dimensions.
+void hdf5_get_nd_dataset_dims(
+  hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+  vector<hsize_t>* dims);
+
+// Reads the given rows, i.e. indices along the first dimension, of an open
+// dataset into data. The rows must be sorted; runs of consecutive rows are
+// read as one hyperslab.
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(
+  hid_t dataset_id, const vector<hsize_t>& rows, Dtype* data);
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
   hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <cmath>  // for std::fabs and std::signbit
+#include <complex>
 
 #include "glog/logging.h"
 
@@ -20,6 +21,22 @@ void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+// As above, with the leading dimensions given, so that A, B and C may be
+// blocks of larger matrices.
+template <typename Dtype>
+void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int lda, const Dtype* B,
+    const int ldb, const Dtype beta, Dtype* C, const int ldc);
+
+// The gemm of complex matrices; TransA and TransB may also be CblasConjTrans.
+template <typename Dtype>
+void caffe_cpu_cgemm(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const std::complex<Dtype> alpha, const std::complex<Dtype>* A,
+    const std::complex<Dtype>* B, const std::complex<Dtype> beta,
+    std::complex<Dtype>* C);
+
 template <typename Dtype>
 void caffe_cpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -0,0 +1,111 @@
+#ifndef CAFFE_UTIL_MMAP_DATASET_HPP_
+#define CAFFE_UTIL_MMAP_DATASET_HPP_
+
+#include <stdint.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief The header of a memory-mapped dataset file.
+ *
+ * The file holds num records of channels x height x width elements of the
+ * given data type, stored back to back from data_offset, followed by num
+ * int32 labels at label_offset. All fields are in host byte order.
+ */
+struct MMapDatasetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t data_type;
+  uint32_t num;
+  uint32_t channels;
+  uint32_t height;
+  uint32_t width;
+  uint64_t data_offset;
+  uint64_t label_offset;
+};
+
+/**
+ * @brief A read-only, memory-mapped file of fixed-size records, which gives
+ *        the DataLayer random access to records without parsing them (see
+ *        the MMAP backend of DataParameter).
+ */
+class MMapDataset {
+ public:
+  enum DataType {
+    UINT8 = 0,
+    FLOAT = 1
+  };
+
+  MMapDataset();
+  ~MMapDataset();
+
+  void Open(const string& filename);
+  void Close();
+
+  int num() const { return header_.num; }
+  int channels() const { return header_.channels; }
+  int height() const { return header_.height; }
+  int width() const { return header_.width; }
+  DataType data_type() const {
+    return static_cast<DataType>(header_.data_type);
+  }
+  /// @brief The number of elements of a record.
+  int record_size() const { return channels() * height() * width(); }
+
+  const uint8_t* uint8_data(const int index) const;
+  const float* float_data(const int index) const;
+  int label(const int index) const;
+
+  /**
+   * @brief Hints how the records will be read: sequential access makes the
+   *        kernel read ahead aggressively, random access disables it.
+   */
+  void AdviseAccess(const bool random) const;
+  /// @brief Asks the kernel to start reading records [first, first + count).
+  void WillNeed(const int first, const int count) const;
+
+ protected:
+  MMapDatasetHeader header_;
+  int fd_;
+  char* map_;
+  size_t map_size_;
+
+  DISABLE_COPY_AND_ASSIGN(MMapDataset);
+};
+
+/**
+ * @brief Writes Datums to a memory-mapped dataset file. The first Datum sets
+ *        the shape of the records and their type: uint8 if it holds data,
+ *        float if it holds float_data.
+ */
+class MMapDatasetWriter {
+ public:
+  explicit MMapDatasetWriter(const string& filename);
+  ~MMapDatasetWriter();
+
+  void Write(const Datum& datum);
+  /// @brief Writes the labels and the header; called by the destructor.
+  void Close();
+
+  int num() const { return header_.num; }
+
+ protected:
+  void WriteHeader();
+
+  MMapDatasetHeader header_;
+  std::ofstream file_;
+  std::vector<int32_t> labels_;
+
+  DISABLE_COPY_AND_ASSIGN(MMapDatasetWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MMAP_DATASET_HPP_
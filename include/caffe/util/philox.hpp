@@ -0,0 +1,91 @@
+#ifndef CAFFE_UTIL_PHILOX_HPP_
+#define CAFFE_UTIL_PHILOX_HPP_
+
+#include <stdint.h>
+
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The counter-based random number generator Philox4x32-10 (Salmon et
+ *        al., "Parallel random numbers: as easy as 1, 2, 3", SC 2011).
+ *
+ * The numbers drawn are a pure function of the seed and of the (epoch, index)
+ * stream: each item of a dataset can have its own generator, created on any
+ * thread and in any order, and draw the same numbers. Creating one costs
+ * nothing, unlike seeding a Mersenne twister.
+ *
+ * Models the UniformRandomNumberGenerator concept, so it can be passed to
+ * caffe::shuffle and the boost distributions.
+ */
+class Philox {
+ public:
+  typedef uint32_t result_type;
+
+  Philox(const uint64_t seed, const uint32_t epoch, const uint64_t index)
+      : position_(kBlockSize) {
+    key_[0] = static_cast<uint32_t>(seed);
+    key_[1] = static_cast<uint32_t>(seed >> 32);
+    // The first word counts the blocks drawn; the others are the stream.
+    counter_[0] = 0;
+    counter_[1] = static_cast<uint32_t>(index);
+    counter_[2] = static_cast<uint32_t>(index >> 32);
+    counter_[3] = epoch;
+  }
+
+  result_type operator()() {
+    if (position_ == kBlockSize) {
+      Block(counter_, key_, block_);
+      ++counter_[0];
+      position_ = 0;
+    }
+    return block_[position_++];
+  }
+  static result_type min() { return 0; }
+  static result_type max() { return 0xffffffffu; }
+
+  /// @brief Encrypts counter with key through the 10 rounds of Philox4x32.
+  static void Block(const uint32_t counter[4], const uint32_t key[2],
+                    uint32_t out[4]) {
+    const uint64_t kMultiplier0 = 0xd2511f53u;
+    const uint64_t kMultiplier1 = 0xcd9e8d57u;
+    const uint32_t kWeyl0 = 0x9e3779b9u;
+    const uint32_t kWeyl1 = 0xbb67ae85u;
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+    for (int i = 0; i < 4; ++i) {
+      out[i] = counter[i];
+    }
+    for (int round = 0; round < 10; ++round) {
+      const uint64_t product0 = kMultiplier0 * out[0];
+      const uint64_t product1 = kMultiplier1 * out[2];
+      const uint32_t x0 = static_cast<uint32_t>(product1 >> 32) ^ out[1] ^ k0;
+      const uint32_t x2 = static_cast<uint32_t>(product0 >> 32) ^ out[3] ^ k1;
+      out[0] = x0;
+      out[1] = static_cast<uint32_t>(product1);
+      out[2] = x2;
+      out[3] = static_cast<uint32_t>(product0);
+      k0 += kWeyl0;
+      k1 += kWeyl1;
+    }
+  }
+
+ private:
+  static const int kBlockSize = 4;
+
+  uint32_t key_[2];
+  uint32_t counter_[4];
+  uint32_t block_[kBlockSize];
+  int position_;
+};
+
+/// @brief Draws a seed for Philox generators from the global Caffe RNG.
+inline uint64_t caffe_philox_seed() {
+  const uint64_t high = (*caffe_rng())();
+  return high << 32 | (*caffe_rng())();
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PHILOX_HPP_
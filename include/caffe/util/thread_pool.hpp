@@ -0,0 +1,63 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A pool of worker threads that the prefetching data layers use to
+ *        decode and transform the items of a batch in parallel.
+ *
+ * Run(n, body) calls body(i) for every i in [0, n) and returns once all calls
+ * are done. If some calls throw, the first exception is rethrown then. Run is
+ * not an interruption point: an interruption of the caller is delivered at
+ * its next interruption point after Run. Concurrent callers (e.g. the
+ * prefetch threads of the train and test nets) share the workers: an idle
+ * worker claims the next unclaimed item of the oldest pending job, and the
+ * caller works through its own job as well, so every job makes progress even
+ * when all workers are busy.
+ *
+ * Items are claimed in an unspecified order, so body(i) must only depend on i
+ * and write item-specific state, e.g. its slice of the batch. Random choices
+ * must not depend on that order to stay deterministic: draw them up front in
+ * item order, or from a Philox generator keyed on the item.
+ */
+class ThreadPool {
+ public:
+  /// @brief The process-wide pool shared by all data layers.
+  static ThreadPool& Get();
+  /**
+   * @brief Sets the number of workers of the pool returned by Get(); only
+   *        effective before its first use. 0 runs every job on the calling
+   *        thread; negative (the default) uses one worker per hardware thread.
+   */
+  static void set_default_num_threads(int num_threads);
+
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  void Run(int n, const boost::function<void(int)>& body);
+
+  int num_threads() const { return num_threads_; }
+
+ protected:
+  class Job;
+  class sync;
+
+  void WorkerEntry();
+
+  int num_threads_;
+  shared_ptr<sync> sync_;
+
+  static shared_ptr<ThreadPool> singleton_;
+  static int default_num_threads_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
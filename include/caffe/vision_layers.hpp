@@ -1,6 +1,7 @@
 #ifndef CAFFE_VISION_LAYERS_HPP_
 #define CAFFE_VISION_LAYERS_HPP_
 
+#include <complex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -13,6 +14,7 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fft.hpp"
 
 namespace caffe {
 
@@ -60,8 +62,16 @@ class ConvolutionLayer : public Layer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - col_buffer_mb (\b optional, default 0). The memory for unrolling
+   *  several images into one column buffer on the CPU, so that a chunk of the
+   *  batch is convolved in one GEMM per group instead of one per image.
+   *  - col_tile_kb (\b optional, default 0). The memory for the columns of a
+   *  strip of output rows on the CPU, so that im2col and the GEMMs run strip
+   *  by strip while the columns are still in cache.
+   *  - engine: convolution has CAFFE (matrix multiplication), CUDNN (library
+   *    kernels + stream parallelism), WINOGRAD (minimal filtering of 3x3
+   *    kernels on the CPU) and FFT (frequency-domain products of large
+   *    kernels on the CPU) engines.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
@@ -107,7 +117,20 @@ class ConvolutionLayer : public Layer<Dtype> {
   /// N_ is the spatial dimension of the output, the H x W, which are the last
   /// dimensions of the data and filter matrices.
   int N_;
+  /// is_1x1_ is whether the kernel is 1x1 with no padding and unit stride, in
+  /// which case the GEMMs read the bottom as its own columns and col_buffer_
+  /// is never allocated.
+  bool is_1x1_;
+  /// num_unrolled_ is the number of images whose columns sit side by side in
+  /// col_buffer_ on the CPU, within col_buffer_mb.
+  int num_unrolled_;
+  /// tile_rows_ is the number of output rows whose columns col_buffer_ holds
+  /// on the CPU: height_out_, unless col_tile_kb cuts images into strips.
+  int tile_rows_;
   Blob<Dtype> col_buffer_;
+  /// The outputs, or top diffs, of the unrolled images, laid out as the
+  /// GEMMs produce them; used when num_unrolled_ > 1.
+  Blob<Dtype> top_buffer_;
   Blob<Dtype> bias_multiplier_;
 };
 
@@ -153,6 +176,146 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Dtype> {
 };
 #endif
 
+/**
+ * @brief Winograd implementation of ConvolutionLayer for 3x3 filters with
+ *        stride 1, on the CPU.
+ *
+ * Computes each m x m tile of the output from an (m + 2) x (m + 2) tile of the
+ * input with the minimal filtering algorithm F(m x m, 3 x 3) (Lavin and Gray,
+ * "Fast Algorithms for Convolutional Neural Networks", 2015): the input tiles
+ * and the filters are transformed, multiplied element by element -- one GEMM
+ * per element of the tiles, over the channels -- and the products transformed
+ * back. F(4x4, 3x3) takes 2.25 times fewer multiplications than direct
+ * convolution, and F(2x2, 3x3), used for outputs of at most 2 rows or
+ * columns, 4 times fewer with less waste on the borders. The transformed
+ * input takes (m + 2)^2 / m^2 times the size of the input, rather than the 9
+ * times of the im2col buffer.
+ *
+ * The gradient with respect to the bottom is the convolution of the top diff
+ * with the rotated filters, computed the same way; the gradients with respect
+ * to the filters and biases are computed as by ConvolutionLayer. Other
+ * shapes, and GPU mode, fall back to ConvolutionLayer.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  // Transforms the filters of each group into (m + 2)^2 matrices of output x
+  // input channels. For backward, those of the convolution of the top diff
+  // giving the bottom diff: rotated by 180 degrees, with the channels of the
+  // bottom as outputs.
+  void TransformWeights(const bool backward);
+  // Convolves the in_channels x in_height x in_width input, zero-padded by
+  // pad_h and pad_w, with the transformed filters of one group.
+  void Convolve(const Dtype* input, const int in_channels,
+      const int in_height, const int in_width, const int pad_h,
+      const int pad_w, const Dtype* weight, const int out_channels,
+      const int out_height, const int out_width, Dtype* output);
+
+  // Whether the filters are 3x3 with stride 1; otherwise the layer runs as
+  // ConvolutionLayer.
+  bool winograd_;
+  // The sizes m of the output tiles and m + 2 of the input tiles.
+  int tile_size_;
+  int input_tile_size_;
+  // The transformed filters, and the transformed input tiles of one image and
+  // group with their products with the filters.
+  Blob<Dtype> transformed_weight_;
+  Blob<Dtype> transformed_input_;
+  Blob<Dtype> transformed_output_;
+};
+
+/**
+ * @brief FFT implementation of ConvolutionLayer for large filters, on the CPU.
+ *
+ * The input is cut into tiles of the FFT size, overlapping by the filter size
+ * less one, whose spectra are multiplied by those of the filters and summed
+ * over the channels -- one complex GEMM per frequency -- before the inverse
+ * transforms give the output tiles. The cost of a product no longer grows
+ * with the filter area, which makes it pay off from 5x5 filters up. A stride
+ * s splits the padded input and the filters into their s x s phases, the
+ * pixels at the same offset modulo s, which turns the convolution into a
+ * stride 1 convolution over s^2 times as many channels with filters s times
+ * smaller in each dimension; these must be 5x5 or more to pay off.
+ *
+ * The gradients with respect to the bottom and to the filters are computed the
+ * same way, as a convolution of the top diff with the filters and a
+ * correlation of the top diff with the input; the latter is summed over the
+ * tiles and images in the frequency domain and transformed back once per
+ * pass. Backward uses the filter spectra computed by the last Forward. GPU
+ * mode falls back to ConvolutionLayer.
+ */
+template <typename Dtype>
+class FFTConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit FFTConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  // Computes the spectra of the filter phases of each group, as frequency x
+  // output x (input channel, phase) matrices.
+  void TransformWeights();
+  // Computes the spectra of the tiles of the channels x height x width image
+  // into the rows of frequency x tile x (channel, phase) matrices of
+  // num_tiles rows. The tile at row th and column tw covers the pixels of the
+  // padded image at (stride_h * (th * tile_h_ + i) + phase, ...), for
+  // i < patch_h, and similarly for the columns; the rest of the FFT size is
+  // zero.
+  void ForwardTransform(const Dtype* image, const int channels,
+      const int height, const int width, const int pad_h, const int pad_w,
+      const int stride_h, const int stride_w, const int patch_h,
+      const int patch_w, const int tiles_h, const int tiles_w,
+      const int num_tiles, std::complex<Dtype>* spectra);
+  // Transforms the spectra back, writing the tile_h_ x tile_w_ values from
+  // (offset_h, offset_w) of each tile to the pixels they cover in the image,
+  // the inverse of the mapping of ForwardTransform.
+  void InverseTransform(const std::complex<Dtype>* spectra,
+      const int channels, const int height, const int width, const int pad_h,
+      const int pad_w, const int stride_h, const int stride_w,
+      const int offset_h, const int offset_w, const int tiles_h,
+      const int tiles_w, const int num_tiles, Dtype* image);
+
+  // The size of the filter phases.
+  int phase_kernel_h_, phase_kernel_w_;
+  // The output pixels computed from one tile.
+  int tile_h_, tile_w_;
+  // The tiles of the top, and of the phases of the padded bottom.
+  int tiles_h_, tiles_w_;
+  int bottom_tiles_h_, bottom_tiles_w_;
+  // The images whose tiles are multiplied by the filter spectra together.
+  int num_batched_;
+  shared_ptr<RealFFT2D<Dtype> > fft_;
+  // The complex spectra of the filters, with those of their gradients, and
+  // of the tiles of a batch of images of one group with their products with
+  // the filters.
+  Blob<Dtype> weight_spectrum_;
+  Blob<Dtype> weight_diff_spectrum_;
+  Blob<Dtype> input_spectrum_;
+  Blob<Dtype> output_spectrum_;
+  // A tile and its spectrum.
+  vector<Dtype> patch_;
+  vector<std::complex<Dtype> > spectrum_;
+};
+
 /**
  * @brief A helper for image operations that rearranges image regions into
  *        column vectors.  Used by ConvolutionLayer to perform convolution
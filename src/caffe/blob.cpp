@@ -103,6 +103,16 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::SwapData(Blob* other) {
+  CHECK_EQ(count_, other->count());
+  CHECK(data_);
+  CHECK(other->data_);
+  // Swapping buffers of different sizes would break the capacity_ invariant.
+  CHECK_EQ(data_->size(), other->data_->size());
+  data_.swap(other->data_);
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
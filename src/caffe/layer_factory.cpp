@@ -16,12 +16,33 @@ ConvolutionLayer<Dtype>* GetConvolutionLayer(const string& name,
   ConvolutionParameter_Engine engine = param.convolution_param().engine();
   if (engine == ConvolutionParameter_Engine_DEFAULT) {
     engine = ConvolutionParameter_Engine_CAFFE;
+    // The cost of the FFT products does not grow with the kernel area: they
+    // beat im2col and GEMM from 5x5 kernels up. A stride s splits the kernel
+    // into s x s phases s times smaller, which FFT convolves separately.
+    const ConvolutionParameter& conv_param = param.convolution_param();
+    const int kernel_h = conv_param.has_kernel_size() ?
+        conv_param.kernel_size() : conv_param.kernel_h();
+    const int kernel_w = conv_param.has_kernel_size() ?
+        conv_param.kernel_size() : conv_param.kernel_w();
+    const int stride_h = conv_param.has_stride_h() ?
+        conv_param.stride_h() : conv_param.stride();
+    const int stride_w = conv_param.has_stride_w() ?
+        conv_param.stride_w() : conv_param.stride();
+    const int phase_area = ((kernel_h + stride_h - 1) / stride_h) *
+        ((kernel_w + stride_w - 1) / stride_w);
+    if (phase_area >= 25) {
+      engine = ConvolutionParameter_Engine_FFT;
+    }
 #ifdef USE_CUDNN
     engine = ConvolutionParameter_Engine_CUDNN;
 #endif
   }
   if (engine == ConvolutionParameter_Engine_CAFFE) {
     return new ConvolutionLayer<Dtype>(param);
+  } else if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return new WinogradConvolutionLayer<Dtype>(param);
+  } else if (engine == ConvolutionParameter_Engine_FFT) {
+    return new FFTConvolutionLayer<Dtype>(param);
 #ifdef USE_CUDNN
   } else if (engine == ConvolutionParameter_Engine_CUDNN) {
     return new CuDNNConvolutionLayer<Dtype>(param);
@@ -1,7 +1,9 @@
+#include <boost/thread.hpp>
 #include <string>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 
 namespace caffe {
@@ -31,6 +33,13 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GE(datum_width_, transform_param_.crop_size());
   }
   // check if we want to have mean
+  CHECK(!(transform_param_.has_mean_file() &&
+          transform_param_.mean_value_size() > 0))
+      << "Cannot specify mean_file and mean_value at the same time";
+  if (transform_param_.mean_value_size() > 1) {
+    CHECK_EQ(transform_param_.mean_value_size(), datum_channels_)
+        << "Specify either one mean_value or as many as channels";
+  }
   if (transform_param_.has_mean_file()) {
     const string& mean_file = transform_param_.mean_file();
     LOG(INFO) << "Loading mean file from" << mean_file;
@@ -49,17 +58,45 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   data_transformer_.InitRand();
 }
 
+template <typename Dtype>
+BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
+    const LayerParameter& param, const int prefetch_depth)
+    : BaseDataLayer<Dtype>(param) {
+  CHECK_GT(prefetch_depth, 0) << "prefetch_depth must be positive";
+  for (int i = 0; i < prefetch_depth; ++i) {
+    prefetch_.push_back(shared_ptr<Batch<Dtype> >(new Batch<Dtype>()));
+    prefetch_free_.push(prefetch_[i].get());
+  }
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  // On a repeated SetUp, stop the running thread and drop what it prefetched
+  // before DataLayerSetUp resets the state it reads from.
+  if (is_started()) {
+    JoinPrefetchThread();
+    Batch<Dtype>* batch;
+    while (prefetch_full_.try_pop(&batch)) {
+      prefetch_free_.push(batch);
+    }
+  }
+  ResetPrefetchStats();
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
-  // Now, start the prefetch thread. Before calling prefetch, we make two
-  // cpu_data calls so that the prefetch thread does not accidentally make
-  // simultaneous cudaMalloc calls when the main thread is running. In some
-  // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
+  // Before starting the prefetch thread, we make cpu_data calls on every
+  // batch, and on the top blobs whose buffers are swapped into the batches,
+  // so that the prefetch thread does not accidentally make simultaneous
+  // cudaMalloc calls when the main thread is running. In some GPUs this seems
+  // to cause failures if we do not so.
+  (*top)[0]->mutable_cpu_data();
   if (this->output_labels_) {
-    this->prefetch_label_.mutable_cpu_data();
+    (*top)[1]->mutable_cpu_data();
+  }
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i]->data_.mutable_cpu_data();
+    if (this->output_labels_) {
+      prefetch_[i]->label_.mutable_cpu_data();
+    }
   }
   DLOG(INFO) << "Initializing prefetch";
   this->CreatePrefetchThread();
@@ -75,23 +112,49 @@ void BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread() {
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread() {
-  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  CHECK(StopInternalThread()) << "Thread joining failed";
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      Batch<Dtype>* batch = prefetch_free_.pop();
+      batch->stats_ = PrefetchStats();
+      CPUTimer timer;
+      LoadBatch(batch);
+      batch->stats_.batches = 1;
+      batch->stats_.load_time = timer.MilliSeconds();
+      prefetch_full_.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template <typename Dtype>
+Batch<Dtype>* BasePrefetchingDataLayer<Dtype>::PopFullBatch() {
+  CPUTimer timer;
+  Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
+  prefetch_stats_.wait_time += timer.MilliSeconds();
+  prefetch_stats_.Add(batch->stats_);
+  return batch;
 }
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             (*top)[0]->mutable_cpu_data());
+  Batch<Dtype>* batch = PopFullBatch();
+  // Swap the buffers instead of copying: the batch takes over the memory the
+  // top blobs delivered last iteration, which nothing reads any more (layers
+  // sharing the top data, like SplitLayer, share it anew in their Forward,
+  // which runs after this one).
+  (*top)[0]->SwapData(&batch->data_);
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-               (*top)[1]->mutable_cpu_data());
+    (*top)[1]->SwapData(&batch->label_);
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  // Hand the batch back to the prefetch thread
+  prefetch_free_.push(batch);
 }
 
 #ifdef CPU_ONLY
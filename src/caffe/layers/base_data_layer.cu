@@ -7,17 +7,18 @@ namespace caffe {
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
+  Batch<Dtype>* batch = PopFullBatch();
+  // Unlike Forward_cpu, the batch is not swapped into the top blobs: the
+  // host-to-device transfer is needed anyway, and a swapped-back buffer whose
+  // head is on the GPU would make the prefetch thread copy it back to host.
+  caffe_copy(batch->data_.count(), batch->data_.cpu_data(),
       (*top)[0]->mutable_gpu_data());
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
+    caffe_copy(batch->label_.count(), batch->label_.cpu_data(),
         (*top)[1]->mutable_gpu_data());
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  // Hand the batch back to the prefetch thread
+  prefetch_free_.push(batch);
 }
 
 INSTANTIATE_CLASS(BasePrefetchingDataLayer);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -47,6 +48,10 @@ void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     stride_h_ = conv_param.stride_h();
     stride_w_ = conv_param.stride_w();
   }
+  // A 1x1 kernel with no padding and unit stride convolves the input as it
+  // is: its columns are the image itself.
+  is_1x1_ = kernel_h_ == 1 && kernel_w_ == 1 && pad_h_ == 0 && pad_w_ == 0
+      && stride_h_ == 1 && stride_w_ == 1;
   // Configure output channels and groups.
   channels_ = bottom[0]->channels();
   num_output_ = this->layer_param_.convolution_param().num_output();
@@ -117,17 +122,46 @@ void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   M_ = num_output_ / group_;
   K_ = channels_ * kernel_h_ * kernel_w_ / group_;
   N_ = height_out_ * width_out_;
-  // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage.
-  col_buffer_.Reshape(
-      1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  // The im2col result buffer holds one image at a time to avoid overly large
+  // memory usage. In CPU mode, col_tile_kb may cut it down to a strip of
+  // output rows, or else col_buffer_mb let it hold several images; the GPU
+  // path always works image by image, and would not use the extra memory.
+  // 1x1 convolutions need no buffer: the GEMMs read the bottom directly.
+  num_unrolled_ = 1;
+  tile_rows_ = height_out_;
+  if (!is_1x1_) {
+    if (Caffe::mode() == Caffe::CPU) {
+      const ConvolutionParameter& conv_param =
+          this->layer_param_.convolution_param();
+      const size_t row_col_bytes = sizeof(Dtype) * K_ * group_ * width_out_;
+      const size_t tile_bytes =
+          static_cast<size_t>(conv_param.col_tile_kb()) << 10;
+      if (tile_bytes > 0) {
+        tile_rows_ = std::max(1, static_cast<int>(std::min<size_t>(
+            height_out_, tile_bytes / row_col_bytes)));
+      }
+      if (tile_rows_ == height_out_) {
+        const size_t col_buffer_bytes =
+            static_cast<size_t>(conv_param.col_buffer_mb()) << 20;
+        num_unrolled_ = std::max(1, static_cast<int>(std::min<size_t>(
+            num_, col_buffer_bytes / (row_col_bytes * height_out_))));
+      }
+    }
+    col_buffer_.Reshape(
+        1, channels_ * kernel_h_ * kernel_w_, tile_rows_,
+        width_out_ * num_unrolled_);
+  }
+  if (num_unrolled_ > 1) {
+    top_buffer_.Reshape(1, num_output_, 1, N_ * num_unrolled_);
+  }
   for (int top_id = 0; top_id < top->size(); ++top_id) {
     (*top)[top_id]->Reshape(num_, num_output_, height_out_, width_out_);
   }
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   if (bias_term_) {
-    bias_multiplier_.Reshape(1, 1, 1, N_);
-    caffe_set(N_, Dtype(1), bias_multiplier_.mutable_cpu_data());
+    bias_multiplier_.Reshape(1, 1, 1, N_ * num_unrolled_);
+    caffe_set(N_ * num_unrolled_, Dtype(1),
+        bias_multiplier_.mutable_cpu_data());
   }
 }
 
@@ -137,29 +171,57 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = (*top)[i]->mutable_cpu_data();
-    Dtype* col_data = col_buffer_.mutable_cpu_data();
+    Dtype* col_buffer = is_1x1_ ? NULL : col_buffer_.mutable_cpu_data();
     const Dtype* weight = this->blobs_[0]->cpu_data();
     int weight_offset = M_ * K_;  // number of filter parameters in a group
-    int col_offset = K_ * N_;  // number of values in an input region / column
-    int top_offset = M_ * N_;  // number of values in an output region / column
-    for (int n = 0; n < num_; ++n) {
-      // im2col transformation: unroll input regions for filtering
-      // into column matrix for multplication.
-      im2col_cpu(bottom_data + bottom[i]->offset(n), channels_, height_,
-          width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
-          col_data);
-      // Take inner products for groups.
-      for (int g = 0; g < group_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-          (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
-          (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
+    for (int n = 0; n < num_; n += num_unrolled_) {
+      // The images n to n + unrolled - 1 are convolved together: their
+      // columns sit side by side, and so do their outputs, whose rows are
+      // output_width long. A single image is output in place; several go
+      // through top_buffer_.
+      const int unrolled = std::min(num_unrolled_, num_ - n);
+      const int output_width = N_ * unrolled;
+      Dtype* output = unrolled == 1 ? top_data + (*top)[i]->offset(n) :
+          top_buffer_.mutable_cpu_data();
+      // The output rows h to h + rows - 1 are computed from their columns
+      // alone, so that the strip's columns are still in cache for the GEMMs.
+      for (int h = 0; h < height_out_; h += tile_rows_) {
+        const int rows = std::min(tile_rows_, height_out_ - h);
+        const int col_width = rows * width_out_ * unrolled;
+        // im2col transformation: unroll input regions for filtering
+        // into column matrix for multplication.
+        const Dtype* col_data = col_buffer;
+        if (is_1x1_) {
+          col_data = bottom_data + bottom[i]->offset(n);
+        } else {
+          for (int u = 0; u < unrolled; ++u) {
+            im2col_cpu(bottom_data + bottom[i]->offset(n + u), channels_,
+                height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+                stride_h_, stride_w_, h, h + rows,
+                col_buffer + rows * width_out_ * u, col_width);
+          }
+        }
+        // Take inner products for groups.
+        for (int g = 0; g < group_; ++g) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, col_width, K_,
+              (Dtype)1., weight + weight_offset * g, K_,
+              col_data + K_ * col_width * g, col_width, (Dtype)0.,
+              output + M_ * output_width * g + h * width_out_, output_width);
+        }
       }
       // Add bias.
       if (bias_term_) {
         caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-            N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-            bias_multiplier_.cpu_data(),
-            (Dtype)1., top_data + (*top)[i]->offset(n));
+            output_width, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            bias_multiplier_.cpu_data(), (Dtype)1., output);
+      }
+      if (unrolled > 1) {
+        for (int u = 0; u < unrolled; ++u) {
+          for (int c = 0; c < num_output_; ++c) {
+            caffe_copy(N_, output + c * output_width + N_ * u,
+                top_data + (*top)[i]->offset(n + u, c));
+          }
+        }
       }
     }
   }
@@ -181,8 +243,6 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
   }
   const int weight_offset = M_ * K_;
-  const int col_offset = K_ * N_;
-  const int top_offset = M_ * N_;
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = NULL;
     // Bias gradient, if necessary.
@@ -199,40 +259,86 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       if (!top_diff) {
         top_diff = top[i]->cpu_diff();
       }
-      Dtype* col_data = col_buffer_.mutable_cpu_data();
-      Dtype* col_diff = col_buffer_.mutable_cpu_diff();
+      Dtype* col_buffer = is_1x1_ ? NULL : col_buffer_.mutable_cpu_data();
+      Dtype* col_diff = is_1x1_ ? NULL : col_buffer_.mutable_cpu_diff();
       const Dtype* bottom_data = (*bottom)[i]->cpu_data();
       Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
-      for (int n = 0; n < num_; ++n) {
-        // Since we saved memory in the forward pass by not storing all col
-        // data, we will need to recompute them.
-        im2col_cpu(bottom_data + (*bottom)[i]->offset(n), channels_, height_,
-                   width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
-                   stride_h_, stride_w_, col_data);
+      for (int n = 0; n < num_; n += num_unrolled_) {
+        // As in Forward_cpu, the images n to n + unrolled - 1 go together.
+        const int unrolled = std::min(num_unrolled_, num_ - n);
+        const int output_width = N_ * unrolled;
+        // Gather the top diffs of several images side by side.
+        const Dtype* output_diff = top_diff + top[i]->offset(n);
+        if (unrolled > 1) {
+          Dtype* gathered = top_buffer_.mutable_cpu_data();
+          for (int u = 0; u < unrolled; ++u) {
+            for (int c = 0; c < num_output_; ++c) {
+              caffe_copy(N_, top_diff + top[i]->offset(n + u, c),
+                  gathered + c * output_width + N_ * u);
+            }
+          }
+          output_diff = gathered;
+        }
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                (Dtype)1., top_diff + top[i]->offset(n) + top_offset * g,
-                col_data + col_offset * g, (Dtype)1.,
-                weight_diff + weight_offset * g);
+          for (int h = 0; h < height_out_; h += tile_rows_) {
+            const int rows = std::min(tile_rows_, height_out_ - h);
+            const int col_width = rows * width_out_ * unrolled;
+            // Since we saved memory in the forward pass by not storing all
+            // col data, we will need to recompute them.
+            const Dtype* col_data = col_buffer;
+            if (is_1x1_) {
+              col_data = bottom_data + (*bottom)[i]->offset(n);
+            } else {
+              for (int u = 0; u < unrolled; ++u) {
+                im2col_cpu(bottom_data + (*bottom)[i]->offset(n + u),
+                    channels_, height_, width_, kernel_h_, kernel_w_,
+                    pad_h_, pad_w_, stride_h_, stride_w_, h, h + rows,
+                    col_buffer + rows * width_out_ * u, col_width);
+              }
+            }
+            for (int g = 0; g < group_; ++g) {
+              caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_,
+                  col_width, (Dtype)1.,
+                  output_diff + M_ * output_width * g + h * width_out_,
+                  output_width, col_data + K_ * col_width * g, col_width,
+                  (Dtype)1., weight_diff + weight_offset * g, K_);
+            }
           }
         }
-        // gradient w.r.t. bottom data, if necessary.
+        // gradient w.r.t. bottom data, if necessary. This stays one image at
+        // a time: the column diffs of a whole chunk fall out of cache before
+        // col2im reads them back, which costs more than the larger GEMMs win.
         if (propagate_down[i]) {
           if (weight == NULL) {
             weight = this->blobs_[0]->cpu_data();
           }
-          for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                (Dtype)1., weight + weight_offset * g,
-                top_diff + top[i]->offset(n) + top_offset * g,
-                (Dtype)0., col_diff + col_offset * g);
+          for (int u = 0; u < unrolled; ++u) {
+            Dtype* image_diff = bottom_diff + (*bottom)[i]->offset(n + u);
+            const Dtype* image_top_diff = top_diff + top[i]->offset(n + u);
+            if (!is_1x1_) {
+              caffe_set(channels_ * height_ * width_, Dtype(0), image_diff);
+            }
+            for (int h = 0; h < height_out_; h += tile_rows_) {
+              const int rows = std::min(tile_rows_, height_out_ - h);
+              const int col_width = rows * width_out_;
+              // The column diff of a 1x1 convolution is the bottom diff.
+              Dtype* strip_col_diff = is_1x1_ ? image_diff : col_diff;
+              for (int g = 0; g < group_; ++g) {
+                caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_,
+                    col_width, M_, (Dtype)1., weight + weight_offset * g, K_,
+                    image_top_diff + M_ * N_ * g + h * width_out_, N_,
+                    (Dtype)0., strip_col_diff + K_ * col_width * g,
+                    col_width);
+              }
+              // col2im back to the data
+              if (!is_1x1_) {
+                col2im_cpu(col_diff, channels_, height_, width_,
+                    kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+                    stride_w_, h, h + rows, image_diff, col_width);
+              }
+            }
           }
-          // col2im back to the data
-          col2im_cpu(col_diff, channels_, height_, width_,
-              kernel_h_, kernel_w_, pad_h_, pad_w_,
-              stride_h_, stride_w_, bottom_diff + (*bottom)[i]->offset(n));
         }
       }
     }
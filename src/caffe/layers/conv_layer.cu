@@ -12,10 +12,15 @@ namespace caffe {
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  if (tile_rows_ < height_out_) {
+    // Reshaped in CPU mode: the GPU needs the columns of a whole image.
+    col_buffer_.Reshape(
+        1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  }
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->gpu_data();
     Dtype* top_data = (*top)[i]->mutable_gpu_data();
-    Dtype* col_data = col_buffer_.mutable_gpu_data();
+    Dtype* col_buffer = is_1x1_ ? NULL : col_buffer_.mutable_gpu_data();
     const Dtype* weight = this->blobs_[0]->gpu_data();
     int weight_offset = M_ * K_;
     int col_offset = K_ * N_;
@@ -23,9 +28,14 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     for (int n = 0; n < num_; ++n) {
       // im2col transformation: unroll input regions for filtering
       // into column matrix for multplication.
-      im2col_gpu(bottom_data + bottom[i]->offset(n), channels_, height_,
-          width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
-          col_data);
+      const Dtype* col_data = col_buffer;
+      if (is_1x1_) {
+        col_data = bottom_data + bottom[i]->offset(n);
+      } else {
+        im2col_gpu(bottom_data + bottom[i]->offset(n), channels_, height_,
+            width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+            col_buffer);
+      }
       // Take inner products for groups.
       for (int g = 0; g < group_; ++g) {
         caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
@@ -47,6 +57,10 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  if (tile_rows_ < height_out_) {
+    col_buffer_.Reshape(
+        1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  }
   const Dtype* weight = NULL;
   Dtype* weight_diff = NULL;
   if (this->param_propagate_down_[0]) {
@@ -78,16 +92,21 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       if (!top_diff) {
         top_diff = top[i]->gpu_diff();
       }
-      Dtype* col_data = col_buffer_.mutable_gpu_data();
-      Dtype* col_diff = col_buffer_.mutable_gpu_diff();
+      Dtype* col_buffer = is_1x1_ ? NULL : col_buffer_.mutable_gpu_data();
+      Dtype* col_diff = is_1x1_ ? NULL : col_buffer_.mutable_gpu_diff();
       const Dtype* bottom_data = (*bottom)[i]->gpu_data();
       Dtype* bottom_diff = (*bottom)[i]->mutable_gpu_diff();
       for (int n = 0; n < num_; ++n) {
         // Since we saved memory in the forward pass by not storing all col
         // data, we will need to recompute them.
-        im2col_gpu(bottom_data + (*bottom)[i]->offset(n), channels_, height_,
-                   width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
-                   stride_h_, stride_w_, col_data);
+        const Dtype* col_data = col_buffer;
+        if (is_1x1_) {
+          col_data = bottom_data + (*bottom)[i]->offset(n);
+        } else {
+          im2col_gpu(bottom_data + (*bottom)[i]->offset(n), channels_,
+                     height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+                     stride_h_, stride_w_, col_buffer);
+        }
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
           for (int g = 0; g < group_; ++g) {
@@ -102,16 +121,21 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
           if (weight == NULL) {
             weight = this->blobs_[0]->gpu_data();
           }
+          // The column diff of a 1x1 convolution is the bottom diff.
+          Dtype* image_col_diff = is_1x1_ ?
+              bottom_diff + (*bottom)[i]->offset(n) : col_diff;
           for (int g = 0; g < group_; ++g) {
             caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
                 (Dtype)1., weight + weight_offset * g,
                 top_diff + top[i]->offset(n) + top_offset * g,
-                (Dtype)0., col_diff + col_offset * g);
+                (Dtype)0., image_col_diff + col_offset * g);
           }
           // col2im back to the data
-          col2im_gpu(col_diff, channels_, height_, width_,
-              kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
-              bottom_diff + (*bottom)[i]->offset(n));
+          if (!is_1x1_) {
+            col2im_gpu(col_diff, channels_, height_, width_,
+                kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+                bottom_diff + (*bottom)[i]->offset(n));
+          }
         }
       }
     }
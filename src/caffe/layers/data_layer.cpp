@@ -1,16 +1,21 @@
 #include <leveldb/db.h>
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <algorithm>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -18,94 +23,288 @@ template <typename Dtype>
 DataLayer<Dtype>::~DataLayer<Dtype>() {
   this->JoinPrefetchThread();
   // clean up the database resources
-  switch (this->layer_param_.data_param().backend()) {
-  case DataParameter_DB_LEVELDB:
-    break;  // do nothing
-  case DataParameter_DB_LMDB:
-    mdb_cursor_close(mdb_cursor_);
-    mdb_close(mdb_env_, mdb_dbi_);
-    mdb_txn_abort(mdb_txn_);
-    mdb_env_close(mdb_env_);
-    break;
-  default:
-    LOG(FATAL) << "Unknown database backend";
+  for (int i = 0; i < shards_.size(); ++i) {
+    CloseShard(shards_[i].get());
   }
 }
 
 template <typename Dtype>
-void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {
-  // Initialize DB
+void DataLayer<Dtype>::OpenShard(const string& source, Shard* shard) {
   switch (this->layer_param_.data_param().backend()) {
   case DataParameter_DB_LEVELDB:
     {
     leveldb::DB* db_temp;
     leveldb::Options options = GetLevelDBOptions();
     options.create_if_missing = false;
-    LOG(INFO) << "Opening leveldb " << this->layer_param_.data_param().source();
-    leveldb::Status status = leveldb::DB::Open(
-        options, this->layer_param_.data_param().source(), &db_temp);
-    CHECK(status.ok()) << "Failed to open leveldb "
-                       << this->layer_param_.data_param().source() << std::endl
+    LOG(INFO) << "Opening leveldb " << source;
+    leveldb::Status status = leveldb::DB::Open(options, source, &db_temp);
+    CHECK(status.ok()) << "Failed to open leveldb " << source << std::endl
                        << status.ToString();
-    db_.reset(db_temp);
-    iter_.reset(db_->NewIterator(leveldb::ReadOptions()));
-    iter_->SeekToFirst();
+    shard->db_.reset(db_temp);
+    shard->iter_.reset(shard->db_->NewIterator(leveldb::ReadOptions()));
     }
     break;
   case DataParameter_DB_LMDB:
-    CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776), MDB_SUCCESS);  // 1TB
-    CHECK_EQ(mdb_env_open(mdb_env_,
-             this->layer_param_.data_param().source().c_str(),
+    CHECK_EQ(mdb_env_create(&shard->mdb_env_), MDB_SUCCESS)
+        << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(shard->mdb_env_, 1099511627776),
+             MDB_SUCCESS);  // 1TB
+    CHECK_EQ(mdb_env_open(shard->mdb_env_, source.c_str(),
              MDB_RDONLY|MDB_NOTLS, 0664), MDB_SUCCESS) << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn_), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn_, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
+    CHECK_EQ(mdb_txn_begin(shard->mdb_env_, NULL, MDB_RDONLY,
+             &shard->mdb_txn_), MDB_SUCCESS) << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(shard->mdb_txn_, NULL, 0, &shard->mdb_dbi_), MDB_SUCCESS)
         << "mdb_open failed";
-    CHECK_EQ(mdb_cursor_open(mdb_txn_, mdb_dbi_, &mdb_cursor_), MDB_SUCCESS)
-        << "mdb_cursor_open failed";
-    LOG(INFO) << "Opening lmdb " << this->layer_param_.data_param().source();
-    CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_FIRST),
-        MDB_SUCCESS) << "mdb_cursor_get failed";
+    CHECK_EQ(mdb_cursor_open(shard->mdb_txn_, shard->mdb_dbi_,
+             &shard->mdb_cursor_), MDB_SUCCESS) << "mdb_cursor_open failed";
+    LOG(INFO) << "Opening lmdb " << source;
+    break;
+  case DataParameter_DB_MMAP:
+    LOG(INFO) << "Opening memory-mapped dataset " << source;
+    shard->dataset_.reset(new MMapDataset());
+    shard->dataset_->Open(source);
+    shard->dataset_->AdviseAccess(this->layer_param_.data_param().shuffle());
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  shard->epoch_ = 0;
+  SeekToPartitionStart(shard);
+  if (this->layer_param_.data_param().shuffle()) {
+    IndexShardKeys(shard);
+    const unsigned int shuffle_rng_seed = caffe_rng_rand();
+    shard->rng_.reset(new Caffe::RNG(shuffle_rng_seed));
+    ShuffleShard(shard);
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::IndexShardKeys(Shard* shard) {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  const int num_partitions = data_param.num_partitions();
+  shard->keys_.clear();
+  if (data_param.backend() == DataParameter_DB_MMAP) {
+    // Records are addressed by their index, no keys needed.
+    shard->num_keys_ = (shard->dataset_->num() - data_param.partition_id()
+                        + num_partitions - 1) / num_partitions;
+    return;
+  }
+  bool valid = true;
+  while (valid) {
+    switch (this->layer_param_.data_param().backend()) {
+    case DataParameter_DB_LEVELDB:
+      shard->keys_.push_back(shard->iter_->key().ToString());
+      break;
+    case DataParameter_DB_LMDB:
+      shard->keys_.push_back(string(
+          static_cast<const char*>(shard->mdb_key_.mv_data),
+          shard->mdb_key_.mv_size));
+      break;
+    default:
+      LOG(FATAL) << "Unknown database backend";
+    }
+    for (int i = 0; i < num_partitions && valid; ++i) {
+      valid = StepShard(shard);
+    }
+  }
+  shard->num_keys_ = shard->keys_.size();
+  LOG(INFO) << "Indexed " << shard->num_keys_ << " keys for shuffling";
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::ShuffleShard(Shard* shard) {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  const int num_keys = shard->num_keys_;
+  const int block_size = data_param.shuffle_block_size();
+  const int window = data_param.shuffle_window();
+  CHECK_GT(block_size, 0);
+  CHECK_GT(window, 0);
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(shard->rng_->generator());
+  // Permute the blocks of consecutive keys...
+  vector<int> blocks((num_keys + block_size - 1) / block_size);
+  for (int i = 0; i < blocks.size(); ++i) {
+    blocks[i] = i;
+  }
+  shuffle(blocks.begin(), blocks.end(), rng);
+  shard->order_.clear();
+  for (int i = 0; i < blocks.size(); ++i) {
+    const int end = std::min(num_keys, (blocks[i] + 1) * block_size);
+    for (int key = blocks[i] * block_size; key < end; ++key) {
+      shard->order_.push_back(key);
+    }
+  }
+  // ...then the keys within each window of the new order.
+  for (int start = 0; start < num_keys; start += window) {
+    shuffle(shard->order_.begin() + start,
+            shard->order_.begin() + std::min(num_keys, start + window), rng);
+  }
+  shard->position_ = 0;
+  SeekShard(shard, shard->order_[0]);
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::SeekShard(Shard* shard, const int key_index) {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  shard->key_index_ = key_index;
+  if (data_param.backend() == DataParameter_DB_MMAP) {
+    shard->record_id_ =
+        data_param.partition_id() + key_index * data_param.num_partitions();
+    shard->dataset_->WillNeed(shard->record_id_, 1);
+    return;
+  }
+  const string& key = shard->keys_[key_index];
+  switch (data_param.backend()) {
+  case DataParameter_DB_LEVELDB:
+    shard->iter_->Seek(key);
+    CHECK(shard->iter_->Valid() && shard->iter_->key() == key)
+        << "Key " << key << " not found";
+    break;
+  case DataParameter_DB_LMDB:
+    shard->mdb_key_.mv_size = key.size();
+    shard->mdb_key_.mv_data = const_cast<char*>(key.data());
+    CHECK_EQ(mdb_cursor_get(shard->mdb_cursor_, &shard->mdb_key_,
+             &shard->mdb_value_, MDB_SET), MDB_SUCCESS)
+        << "Key " << key << " not found";
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::CloseShard(Shard* shard) {
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    break;  // do nothing
+  case DataParameter_DB_LMDB:
+    mdb_cursor_close(shard->mdb_cursor_);
+    mdb_close(shard->mdb_env_, shard->mdb_dbi_);
+    mdb_txn_abort(shard->mdb_txn_);
+    mdb_env_close(shard->mdb_env_);
+    break;
+  case DataParameter_DB_MMAP:
+    shard->dataset_->Close();
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::SeekToPartitionStart(Shard* shard) {
+  shard->key_index_ = 0;
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    shard->iter_->SeekToFirst();
+    CHECK(shard->iter_->Valid()) << "Empty leveldb";
     break;
+  case DataParameter_DB_LMDB:
+    CHECK_EQ(mdb_cursor_get(shard->mdb_cursor_, &shard->mdb_key_,
+             &shard->mdb_value_, MDB_FIRST), MDB_SUCCESS)
+        << "mdb_cursor_get failed";
+    break;
+  case DataParameter_DB_MMAP:
+    CHECK_GT(shard->dataset_->num(), 0) << "Empty memory-mapped dataset";
+    shard->record_id_ = 0;
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  const int partition_id = this->layer_param_.data_param().partition_id();
+  for (int i = 0; i < partition_id; ++i) {
+    CHECK(StepShard(shard)) << "Fewer records than partitions";
+  }
+}
+
+template <typename Dtype>
+bool DataLayer<Dtype>::StepShard(Shard* shard) {
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    shard->iter_->Next();
+    return shard->iter_->Valid();
+  case DataParameter_DB_LMDB:
+    return mdb_cursor_get(shard->mdb_cursor_, &shard->mdb_key_,
+                          &shard->mdb_value_, MDB_NEXT) == MDB_SUCCESS;
+  case DataParameter_DB_MMAP:
+    return ++shard->record_id_ < shard->dataset_->num();
   default:
     LOG(FATAL) << "Unknown database backend";
   }
+  return false;
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::NextRecord(Shard* shard) {
+  if (this->layer_param_.data_param().shuffle()) {
+    if (++shard->position_ == static_cast<int>(shard->order_.size())) {
+      DLOG(INFO) << "Restarting data prefetching in a new order.";
+      ++shard->epoch_;
+      ShuffleShard(shard);
+    } else {
+      SeekShard(shard, shard->order_[shard->position_]);
+    }
+    return;
+  }
+  const int num_partitions = this->layer_param_.data_param().num_partitions();
+  for (int i = 0; i < num_partitions; ++i) {
+    if (!StepShard(shard)) {
+      // We have reached the end. Restart from the first.
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      ++shard->epoch_;
+      SeekToPartitionStart(shard);
+      return;
+    }
+  }
+  ++shard->key_index_;
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  CHECK_GT(data_param.num_partitions(), 0);
+  CHECK_LT(data_param.partition_id(), data_param.num_partitions())
+      << "partition_id must be less than num_partitions";
+  // Initialize DB, after closing the shards of an earlier SetUp.
+  for (int i = 0; i < shards_.size(); ++i) {
+    CloseShard(shards_[i].get());
+  }
+  shards_.clear();
+  shards_.push_back(shared_ptr<Shard>(new Shard()));
+  OpenShard(data_param.source(), shards_.back().get());
+  for (int i = 0; i < data_param.shard_source_size(); ++i) {
+    shards_.push_back(shared_ptr<Shard>(new Shard()));
+    OpenShard(data_param.shard_source(i), shards_.back().get());
+  }
+  first_shard_ = 0;
 
   // Check if we would need to randomly skip a few data points
-  if (this->layer_param_.data_param().rand_skip()) {
-    unsigned int skip = caffe_rng_rand() %
-                        this->layer_param_.data_param().rand_skip();
+  if (data_param.rand_skip()) {
+    unsigned int skip = caffe_rng_rand() % data_param.rand_skip();
     LOG(INFO) << "Skipping first " << skip << " data points.";
-    while (skip-- > 0) {
-      switch (this->layer_param_.data_param().backend()) {
-      case DataParameter_DB_LEVELDB:
-        iter_->Next();
-        if (!iter_->Valid()) {
-          iter_->SeekToFirst();
-        }
-        break;
-      case DataParameter_DB_LMDB:
-        if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
-            != MDB_SUCCESS) {
-          CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
-                   MDB_FIRST), MDB_SUCCESS);
-        }
-        break;
-      default:
-        LOG(FATAL) << "Unknown database backend";
+    for (int i = 0; i < shards_.size(); ++i) {
+      for (unsigned int j = 0; j < skip; ++j) {
+        NextRecord(shards_[i].get());
       }
     }
   }
   // Read a data point, and use it to initialize the top blob.
   Datum datum;
-  switch (this->layer_param_.data_param().backend()) {
+  Shard* shard = shards_[0].get();
+  switch (data_param.backend()) {
   case DataParameter_DB_LEVELDB:
-    datum.ParseFromString(iter_->value().ToString());
+    datum.ParseFromArray(shard->iter_->value().data(),
+                         shard->iter_->value().size());
     break;
   case DataParameter_DB_LMDB:
-    datum.ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
+    datum.ParseFromArray(shard->mdb_value_.mv_data,
+                         shard->mdb_value_.mv_size);
+    break;
+  case DataParameter_DB_MMAP:
+    // All records have the shape of the dataset.
+    datum.set_channels(shard->dataset_->channels());
+    datum.set_height(shard->dataset_->height());
+    datum.set_width(shard->dataset_->width());
     break;
   default:
     LOG(FATAL) << "Unknown database backend";
@@ -114,25 +313,25 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // image
   int crop_size = this->layer_param_.transform_param().crop_size();
   if (crop_size > 0) {
-    (*top)[0]->Reshape(this->layer_param_.data_param().batch_size(),
+    (*top)[0]->Reshape(data_param.batch_size(),
                        datum.channels(), crop_size, crop_size);
-    this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), crop_size, crop_size);
   } else {
     (*top)[0]->Reshape(
-        this->layer_param_.data_param().batch_size(), datum.channels(),
+        data_param.batch_size(), datum.channels(),
         datum.height(), datum.width());
-    this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), datum.height(), datum.width());
+  }
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*(*top)[0]);
   }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
   // label
   if (this->output_labels_) {
-    (*top)[1]->Reshape(this->layer_param_.data_param().batch_size(), 1, 1, 1);
-    this->prefetch_label_.Reshape(this->layer_param_.data_param().batch_size(),
-        1, 1, 1);
+    (*top)[1]->Reshape(data_param.batch_size(), 1, 1, 1);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.ReshapeLike(*(*top)[1]);
+    }
   }
   // datum size
   this->datum_channels_ = datum.channels();
@@ -141,65 +340,156 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread to fill a batch.
 template <typename Dtype>
-void DataLayer<Dtype>::InternalThreadEntry() {
-  Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
+void DataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
+  Dtype* top_data = batch->data_.mutable_cpu_data();
   Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
   if (this->output_labels_) {
-    top_label = this->prefetch_label_.mutable_cpu_data();
+    top_label = batch->label_.mutable_cpu_data();
   }
   const int batch_size = this->layer_param_.data_param().batch_size();
+  records_.resize(batch_size);
+  record_buffers_.resize(batch_size);
+  mmap_records_.resize(batch_size);
+  item_streams_.resize(batch_size);
 
+  // Walk the shards concurrently, collecting the serialized records.
+  CPUTimer timer;
+  ThreadPool::Get().Run(shards_.size(), boost::bind(
+      &DataLayer<Dtype>::LoadShardRecords, this, _1, batch_size));
+  first_shard_ = (first_shard_ + batch_size) % shards_.size();
+  batch->stats_.read_time = timer.MilliSeconds();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
+    if (this->layer_param_.data_param().backend() == DataParameter_DB_MMAP) {
+      const MMapDataset* dataset = mmap_records_[item_id].first;
+      batch->stats_.bytes_read += dataset->record_size() *
+          (dataset->data_type() == MMapDataset::FLOAT ? sizeof(float) : 1);
+    } else {
+      batch->stats_.bytes_read += records_[item_id].second;
+    }
+  }
+
+  // Parse and transform the items in parallel.
+  timer.Start();
+  ThreadPool::Get().Run(batch_size, boost::bind(&DataLayer<Dtype>::LoadItem,
+      this, _1, top_data, top_label));
+  batch->stats_.transform_time = timer.MilliSeconds();
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::LoadShardRecords(const int shard_id,
+    const int batch_size) {
+  Shard* shard = shards_[shard_id].get();
+  const int num_shards = shards_.size();
+  const DataParameter& data_param = this->layer_param_.data_param();
+  // Items first_shard_, first_shard_ + 1, ... come from the shards in turn.
+  const int first_item = (shard_id - first_shard_ + num_shards) % num_shards;
+  for (int item_id = first_item; item_id < batch_size;
+       item_id += num_shards) {
     // get a blob
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
-      CHECK(iter_);
-      CHECK(iter_->Valid());
-      datum.ParseFromString(iter_->value().ToString());
+      {
+      CHECK(shard->iter_);
+      CHECK(shard->iter_->Valid());
+      // The iterator's slice is invalidated by Next(), so keep a copy; the
+      // buffers are reused from batch to batch.
+      const leveldb::Slice value = shard->iter_->value();
+      record_buffers_[item_id].assign(value.data(), value.size());
+      records_[item_id] = std::make_pair(record_buffers_[item_id].data(),
+                                         record_buffers_[item_id].size());
+      }
       break;
     case DataParameter_DB_LMDB:
-      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-              &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(mdb_value_.mv_data,
-          mdb_value_.mv_size);
+      CHECK_EQ(mdb_cursor_get(shard->mdb_cursor_, &shard->mdb_key_,
+              &shard->mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
+      // Values stay valid for the lifetime of the read-only transaction.
+      records_[item_id] = std::make_pair(
+          static_cast<const char*>(shard->mdb_value_.mv_data),
+          shard->mdb_value_.mv_size);
+      break;
+    case DataParameter_DB_MMAP:
+      mmap_records_[item_id] = std::make_pair(shard->dataset_.get(),
+                                              shard->record_id_);
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
+    // The random choices of the item are keyed on the index of its record
+    // among those of all the shards, and on the epoch.
+    const int64_t record_index = data_param.partition_id() +
+        static_cast<int64_t>(shard->key_index_) * data_param.num_partitions();
+    item_streams_[item_id] =
+        std::make_pair(shard->epoch_, record_index * num_shards + shard_id);
 
-    // Apply data transformations (mirror, scale, crop...)
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
+    // go to the next iter
+    NextRecord(shard);
+  }
+  if (data_param.backend() == DataParameter_DB_MMAP && !data_param.shuffle()) {
+    // Start reading the records of the next batch.
+    const int num_items = (batch_size + num_shards - 1) / num_shards;
+    shard->dataset_->WillNeed(shard->record_id_,
+                              num_items * data_param.num_partitions());
+  }
+}
 
+template <typename Dtype>
+void DataLayer<Dtype>::LoadItem(const int item_id, Dtype* top_data,
+    Dtype* top_label) {
+  Philox rng = this->data_transformer_.ItemRand(item_streams_[item_id].first,
+                                                item_streams_[item_id].second);
+  DatumView view;
+  if (this->layer_param_.data_param().backend() == DataParameter_DB_MMAP) {
+    // Transform the record straight from the mapping.
+    const MMapDataset* dataset = mmap_records_[item_id].first;
+    const int record_id = mmap_records_[item_id].second;
+    view.channels = dataset->channels();
+    view.height = dataset->height();
+    view.width = dataset->width();
+    view.label = dataset->label(record_id);
+    view.half_data = NULL;
+    view.quantized_data = NULL;
+    if (dataset->data_type() == MMapDataset::UINT8) {
+      view.data = dataset->uint8_data(record_id);
+      view.data_size = dataset->record_size();
+      view.float_data = NULL;
+    } else {
+      view.data = NULL;
+      view.data_size = 0;
+      view.float_data = dataset->float_data(record_id);
+    }
+    this->data_transformer_.Transform(item_id, view, this->mean_, top_data,
+                                      &rng);
     if (this->output_labels_) {
-      top_label[item_id] = datum.label();
+      top_label[item_id] = view.label;
     }
-
-    // go to the next iter
-    switch (this->layer_param_.data_param().backend()) {
-    case DataParameter_DB_LEVELDB:
-      iter_->Next();
-      if (!iter_->Valid()) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        iter_->SeekToFirst();
-      }
-      break;
-    case DataParameter_DB_LMDB:
-      if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
-              &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-                &mdb_value_, MDB_FIRST), MDB_SUCCESS);
-      }
-      break;
-    default:
-      LOG(FATAL) << "Unknown database backend";
+    return;
+  }
+  // Raw uint8 records are transformed straight from the record bytes.
+  if (ParseDatumView(records_[item_id].first, records_[item_id].second,
+                     &view)) {
+    this->data_transformer_.Transform(item_id, view, this->mean_, top_data,
+                                      &rng);
+    if (this->output_labels_) {
+      top_label[item_id] = view.label;
     }
+    return;
+  }
+  Datum datum;
+  CHECK(datum.ParseFromArray(records_[item_id].first,
+                             records_[item_id].second))
+      << "Failed to parse Datum";
+  // Compressed images are decoded here, on the prefetch side.
+  CHECK(DecodeDatum(&datum)) << "Failed to decode Datum";
+
+  // Apply data transformations (mirror, scale, crop...)
+  this->data_transformer_.Transform(item_id, datum, this->mean_, top_data,
+                                    &rng);
+
+  if (this->output_labels_) {
+    top_label[item_id] = datum.label();
   }
 }
 
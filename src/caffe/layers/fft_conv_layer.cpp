@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// The smallest power of 2 not below n.
+static int NextPowerOfTwo(const int n) {
+  int power = 1;
+  while (power < n) {
+    power *= 2;
+  }
+  return power;
+}
+
+// The FFT size of a dimension whose filter phases have kernel taps, for tiles
+// giving up to extent outputs. The products take time in proportion to the
+// number of tiles times their size, which the overlap of the tiles and their
+// cut at the border inflate; ties go to the smaller size.
+static int FFTSize(const int kernel, const int extent) {
+  const int largest = NextPowerOfTwo(extent + kernel - 1);
+  int best = largest;
+  for (int size = largest / 2; size >= std::max(2, kernel); size /= 2) {
+    const int tile = size - kernel + 1;
+    const int largest_tile = best - kernel + 1;
+    if ((extent + tile - 1) / tile * size <=
+        (extent + largest_tile - 1) / largest_tile * best) {
+      best = size;
+    }
+  }
+  return best;
+}
+
+// The tiles multiplied by the filter spectra at once: with fewer, streaming
+// the filter spectra through the cache takes longer than the products.
+static const int kMinBatchTiles = 64;
+
+template <typename Dtype>
+static inline std::complex<Dtype>* Spectra(Blob<Dtype>* blob) {
+  return reinterpret_cast<std::complex<Dtype>*>(blob->mutable_cpu_data());
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  phase_kernel_h_ = (this->kernel_h_ + this->stride_h_ - 1) / this->stride_h_;
+  phase_kernel_w_ = (this->kernel_w_ + this->stride_w_ - 1) / this->stride_w_;
+  // The bottom diff is computed for the pixels of each phase of the padded
+  // bottom that fall in the bottom.
+  const int phase_height =
+      (this->height_ + this->pad_h_ + this->stride_h_ - 1) / this->stride_h_;
+  const int phase_width =
+      (this->width_ + this->pad_w_ + this->stride_w_ - 1) / this->stride_w_;
+  const int fft_h = FFTSize(phase_kernel_h_,
+                            std::max(this->height_out_, phase_height));
+  // The rows of the real transform have at least 2 values.
+  const int fft_w = std::max(2, FFTSize(phase_kernel_w_,
+                             std::max(this->width_out_, phase_width)));
+  if (!fft_ || fft_->height() != fft_h || fft_->width() != fft_w) {
+    fft_.reset(new RealFFT2D<Dtype>(fft_h, fft_w));
+    patch_.resize(fft_h * fft_w);
+    spectrum_.resize(fft_->spectrum_size());
+  }
+  tile_h_ = fft_h - phase_kernel_h_ + 1;
+  tile_w_ = fft_w - phase_kernel_w_ + 1;
+  tiles_h_ = (this->height_out_ + tile_h_ - 1) / tile_h_;
+  tiles_w_ = (this->width_out_ + tile_w_ - 1) / tile_w_;
+  bottom_tiles_h_ = (phase_height + tile_h_ - 1) / tile_h_;
+  bottom_tiles_w_ = (phase_width + tile_w_ - 1) / tile_w_;
+  num_batched_ = std::min(this->num_, (kMinBatchTiles - 1) /
+      std::min(tiles_h_ * tiles_w_, bottom_tiles_h_ * bottom_tiles_w_) + 1);
+  const int frequencies = fft_->spectrum_size();
+  const int num_phases = this->stride_h_ * this->stride_w_;
+  const int group_channels = num_phases * this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  // Complex values take 2 Dtypes.
+  weight_spectrum_.Reshape(this->group_, frequencies, group_outputs,
+                           2 * group_channels);
+  weight_diff_spectrum_.ReshapeLike(weight_spectrum_);
+  const int spectra = frequencies * num_batched_ *
+      std::max(tiles_h_ * tiles_w_, bottom_tiles_h_ * bottom_tiles_w_) *
+      std::max(group_channels, group_outputs);
+  input_spectrum_.Reshape(1, 1, 1, 2 * spectra);
+  output_spectrum_.Reshape(1, 1, 1, 2 * spectra);
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::TransformWeights() {
+  const int fft_w = fft_->width();
+  const int frequencies = fft_->spectrum_size();
+  const int group_channels = this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  const int phase_channels = group_channels * this->stride_h_ *
+      this->stride_w_;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  std::complex<Dtype>* spectra = Spectra(&weight_spectrum_);
+  for (int g = 0; g < this->group_; ++g) {
+    for (int o = 0; o < group_outputs; ++o) {
+      for (int c = 0; c < group_channels; ++c) {
+        const Dtype* filter = weight +
+            ((g * group_outputs + o) * group_channels + c) *
+            this->kernel_h_ * this->kernel_w_;
+        for (int r_h = 0; r_h < this->stride_h_; ++r_h) {
+          for (int r_w = 0; r_w < this->stride_w_; ++r_w) {
+            std::fill(patch_.begin(), patch_.begin() + phase_kernel_h_ * fft_w,
+                      Dtype(0));
+            for (int h = r_h; h < this->kernel_h_; h += this->stride_h_) {
+              for (int w = r_w; w < this->kernel_w_; w += this->stride_w_) {
+                patch_[(h / this->stride_h_) * fft_w + w / this->stride_w_] =
+                    filter[h * this->kernel_w_ + w];
+              }
+            }
+            fft_->Forward(&patch_[0], &spectrum_[0], phase_kernel_h_);
+            const int e = (c * this->stride_h_ + r_h) * this->stride_w_ + r_w;
+            std::complex<Dtype>* out = spectra +
+                (g * frequencies * group_outputs + o) * phase_channels + e;
+            for (int f = 0; f < frequencies; ++f) {
+              out[f * group_outputs * phase_channels] = spectrum_[f];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::ForwardTransform(const Dtype* image,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const int stride_h, const int stride_w,
+    const int patch_h, const int patch_w, const int tiles_h,
+    const int tiles_w, const int num_tiles, std::complex<Dtype>* spectra) {
+  const int fft_w = fft_->width();
+  const int frequencies = fft_->spectrum_size();
+  const int phase_channels = channels * stride_h * stride_w;
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* channel = image + c * height * width;
+    for (int r_h = 0; r_h < stride_h; ++r_h) {
+      for (int r_w = 0; r_w < stride_w; ++r_w) {
+        const int e = (c * stride_h + r_h) * stride_w + r_w;
+        for (int t_h = 0; t_h < tiles_h; ++t_h) {
+          for (int t_w = 0; t_w < tiles_w; ++t_w) {
+            std::fill(patch_.begin(), patch_.begin() + patch_h * fft_w,
+                      Dtype(0));
+            for (int i = 0; i < patch_h; ++i) {
+              const int h = stride_h * (t_h * tile_h_ + i) + r_h - pad_h;
+              if (h < 0 || h >= height) {
+                continue;
+              }
+              for (int j = 0; j < patch_w; ++j) {
+                const int w = stride_w * (t_w * tile_w_ + j) + r_w - pad_w;
+                if (w >= 0 && w < width) {
+                  patch_[i * fft_w + j] = channel[h * width + w];
+                }
+              }
+            }
+            fft_->Forward(&patch_[0], &spectrum_[0], patch_h);
+            std::complex<Dtype>* out = spectra +
+                (t_h * tiles_w + t_w) * phase_channels + e;
+            for (int f = 0; f < frequencies; ++f) {
+              out[f * num_tiles * phase_channels] = spectrum_[f];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::InverseTransform(
+    const std::complex<Dtype>* spectra, const int channels, const int height,
+    const int width, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int offset_h, const int offset_w,
+    const int tiles_h, const int tiles_w, const int num_tiles,
+    Dtype* image) {
+  const int fft_w = fft_->width();
+  const int frequencies = fft_->spectrum_size();
+  const int phase_channels = channels * stride_h * stride_w;
+  for (int c = 0; c < channels; ++c) {
+    Dtype* channel = image + c * height * width;
+    for (int r_h = 0; r_h < stride_h; ++r_h) {
+      for (int r_w = 0; r_w < stride_w; ++r_w) {
+        const int e = (c * stride_h + r_h) * stride_w + r_w;
+        for (int t_h = 0; t_h < tiles_h; ++t_h) {
+          for (int t_w = 0; t_w < tiles_w; ++t_w) {
+            const std::complex<Dtype>* in = spectra +
+                (t_h * tiles_w + t_w) * phase_channels + e;
+            for (int f = 0; f < frequencies; ++f) {
+              spectrum_[f] = in[f * num_tiles * phase_channels];
+            }
+            fft_->Inverse(&spectrum_[0], &patch_[0]);
+            for (int i = 0; i < tile_h_; ++i) {
+              const int h = stride_h * (t_h * tile_h_ + i) + r_h - pad_h;
+              if (h < 0 || h >= height) {
+                continue;
+              }
+              for (int j = 0; j < tile_w_; ++j) {
+                const int w = stride_w * (t_w * tile_w_ + j) + r_w - pad_w;
+                if (w >= 0 && w < width) {
+                  channel[h * width + w] =
+                      patch_[(offset_h + i) * fft_w + offset_w + j];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  TransformWeights();
+  const int fft_h = fft_->height();
+  const int fft_w = fft_->width();
+  const int frequencies = fft_->spectrum_size();
+  const int image_tiles = tiles_h_ * tiles_w_;
+  const int group_channels = this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  const int phase_channels = group_channels * this->stride_h_ *
+      this->stride_w_;
+  const std::complex<Dtype> one(1), zero(0);
+  const std::complex<Dtype>* weight = Spectra(&weight_spectrum_);
+  std::complex<Dtype>* input = Spectra(&input_spectrum_);
+  std::complex<Dtype>* output = Spectra(&output_spectrum_);
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    for (int n_start = 0; n_start < this->num_; n_start += num_batched_) {
+      const int batch = std::min(num_batched_, this->num_ - n_start);
+      const int num_tiles = batch * image_tiles;
+      for (int g = 0; g < this->group_; ++g) {
+        for (int n = 0; n < batch; ++n) {
+          ForwardTransform(
+              bottom_data + bottom[i]->offset(n_start + n, g * group_channels),
+              group_channels, this->height_, this->width_, this->pad_h_,
+              this->pad_w_, this->stride_h_, this->stride_w_, fft_h, fft_w,
+              tiles_h_, tiles_w_, num_tiles,
+              input + n * image_tiles * phase_channels);
+        }
+        // Correlate each tile with the filters, summing over the channels
+        // and phases: conjugate the filter spectra.
+        const std::complex<Dtype>* group_weight =
+            weight + g * frequencies * group_outputs * phase_channels;
+        for (int f = 0; f < frequencies; ++f) {
+          caffe_cpu_cgemm<Dtype>(CblasNoTrans, CblasConjTrans, num_tiles,
+              group_outputs, phase_channels, one,
+              input + f * num_tiles * phase_channels,
+              group_weight + f * group_outputs * phase_channels, zero,
+              output + f * num_tiles * group_outputs);
+        }
+        for (int n = 0; n < batch; ++n) {
+          InverseTransform(output + n * image_tiles * group_outputs,
+              group_outputs, this->height_out_, this->width_out_, 0, 0, 1, 1,
+              0, 0, tiles_h_, tiles_w_, num_tiles,
+              top_data + (*top)[i]->offset(n_start + n, g * group_outputs));
+        }
+      }
+    }
+    // Add bias.
+    if (this->bias_term_) {
+      for (int n = 0; n < this->num_; ++n) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->num_output_,
+            this->N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            this->bias_multiplier_.cpu_data(),
+            (Dtype)1., top_data + (*top)[i]->offset(n));
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void FFTConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const int fft_h = fft_->height();
+  const int fft_w = fft_->width();
+  const int frequencies = fft_->spectrum_size();
+  const int image_tiles = tiles_h_ * tiles_w_;
+  const int image_bottom_tiles = bottom_tiles_h_ * bottom_tiles_w_;
+  const int group_channels = this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  const int phase_channels = group_channels * this->stride_h_ *
+      this->stride_w_;
+  const int group_spectra = frequencies * group_outputs * phase_channels;
+  const std::complex<Dtype> one(1), zero(0);
+  const std::complex<Dtype>* weight = Spectra(&weight_spectrum_);
+  std::complex<Dtype>* weight_diff = NULL;
+  if (this->param_propagate_down_[0]) {
+    weight_diff = Spectra(&weight_diff_spectrum_);
+    caffe_set(weight_diff_spectrum_.count(), Dtype(0),
+              weight_diff_spectrum_.mutable_cpu_data());
+  }
+  Dtype* bias_diff = NULL;
+  if (this->bias_term_ && this->param_propagate_down_[1]) {
+    bias_diff = this->blobs_[1]->mutable_cpu_diff();
+    caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
+  }
+  std::complex<Dtype>* input = Spectra(&input_spectrum_);
+  std::complex<Dtype>* output = Spectra(&output_spectrum_);
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = (*bottom)[i]->cpu_data();
+    Dtype* bottom_diff = propagate_down[i] ?
+        (*bottom)[i]->mutable_cpu_diff() : NULL;
+    // Bias gradient, if necessary.
+    if (bias_diff) {
+      for (int n = 0; n < this->num_; ++n) {
+        caffe_cpu_gemv<Dtype>(CblasNoTrans, this->num_output_, this->N_,
+            1., top_diff + top[i]->offset(n),
+            this->bias_multiplier_.cpu_data(), 1., bias_diff);
+      }
+    }
+    for (int n_start = 0; n_start < this->num_; n_start += num_batched_) {
+      const int batch = std::min(num_batched_, this->num_ - n_start);
+      for (int g = 0; g < this->group_; ++g) {
+        if (weight_diff) {
+          // Correlate the top diff of each tile with the input tile it was
+          // computed from: the top diff covers only the outputs of the tile.
+          const int num_tiles = batch * image_tiles;
+          for (int n = 0; n < batch; ++n) {
+            ForwardTransform(bottom_data +
+                (*bottom)[i]->offset(n_start + n, g * group_channels),
+                group_channels, this->height_, this->width_, this->pad_h_,
+                this->pad_w_, this->stride_h_, this->stride_w_, fft_h, fft_w,
+                tiles_h_, tiles_w_, num_tiles,
+                input + n * image_tiles * phase_channels);
+            ForwardTransform(
+                top_diff + top[i]->offset(n_start + n, g * group_outputs),
+                group_outputs, this->height_out_, this->width_out_, 0, 0, 1,
+                1, tile_h_, tile_w_, tiles_h_, tiles_w_, num_tiles,
+                output + n * image_tiles * group_outputs);
+          }
+          for (int f = 0; f < frequencies; ++f) {
+            caffe_cpu_cgemm<Dtype>(CblasConjTrans, CblasNoTrans,
+                group_outputs, phase_channels, num_tiles, one,
+                output + f * num_tiles * group_outputs,
+                input + f * num_tiles * phase_channels, one,
+                weight_diff + g * group_spectra +
+                f * group_outputs * phase_channels);
+          }
+        }
+        if (bottom_diff) {
+          // Convolve the top diff, padded by the filter phase size less one,
+          // with the filters.
+          const int num_tiles = batch * image_bottom_tiles;
+          for (int n = 0; n < batch; ++n) {
+            ForwardTransform(
+                top_diff + top[i]->offset(n_start + n, g * group_outputs),
+                group_outputs, this->height_out_, this->width_out_,
+                phase_kernel_h_ - 1, phase_kernel_w_ - 1, 1, 1, fft_h, fft_w,
+                bottom_tiles_h_, bottom_tiles_w_, num_tiles,
+                input + n * image_bottom_tiles * group_outputs);
+          }
+          for (int f = 0; f < frequencies; ++f) {
+            caffe_cpu_cgemm<Dtype>(CblasNoTrans, CblasNoTrans, num_tiles,
+                phase_channels, group_outputs, one,
+                input + f * num_tiles * group_outputs,
+                weight + g * group_spectra +
+                f * group_outputs * phase_channels, zero,
+                output + f * num_tiles * phase_channels);
+          }
+          for (int n = 0; n < batch; ++n) {
+            InverseTransform(output + n * image_bottom_tiles * phase_channels,
+                group_channels, this->height_, this->width_, this->pad_h_,
+                this->pad_w_, this->stride_h_, this->stride_w_,
+                phase_kernel_h_ - 1, phase_kernel_w_ - 1, bottom_tiles_h_,
+                bottom_tiles_w_, num_tiles, bottom_diff +
+                (*bottom)[i]->offset(n_start + n, g * group_channels));
+          }
+        }
+      }
+    }
+  }
+  if (!weight_diff) {
+    return;
+  }
+  // Transform the filter gradients back, once for all the tiles and images,
+  // and gather their phases.
+  Dtype* weight_diff_data = this->blobs_[0]->mutable_cpu_diff();
+  for (int g = 0; g < this->group_; ++g) {
+    for (int o = 0; o < group_outputs; ++o) {
+      for (int c = 0; c < group_channels; ++c) {
+        Dtype* filter_diff = weight_diff_data +
+            ((g * group_outputs + o) * group_channels + c) *
+            this->kernel_h_ * this->kernel_w_;
+        for (int r_h = 0; r_h < this->stride_h_; ++r_h) {
+          for (int r_w = 0; r_w < this->stride_w_; ++r_w) {
+            const int e = (c * this->stride_h_ + r_h) * this->stride_w_ + r_w;
+            const std::complex<Dtype>* in = weight_diff + g * group_spectra +
+                o * phase_channels + e;
+            for (int f = 0; f < frequencies; ++f) {
+              spectrum_[f] = in[f * group_outputs * phase_channels];
+            }
+            fft_->Inverse(&spectrum_[0], &patch_[0]);
+            for (int h = r_h; h < this->kernel_h_; h += this->stride_h_) {
+              for (int w = r_w; w < this->kernel_w_; w += this->stride_w_) {
+                filter_diff[h * this->kernel_w_ + w] =
+                    patch_[(h / this->stride_h_) * fft_w + w / this->stride_w_];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(FFTConvolutionLayer);
+
+}  // namespace caffe
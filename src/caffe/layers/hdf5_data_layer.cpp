@@ -1,11 +1,4 @@
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -14,46 +7,126 @@ TODO:
 #include "hdf5_hl.h"
 #include "stdint.h"
 
+#include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
-#include "caffe/vision_layers.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  this->JoinPrefetchThread();
+  CloseHDF5File();
+}
 
-// Load data and label from HDF5 filename into the class property blobs.
+// Open an HDF5 file and its data and label datasets for reading by rows.
 template <typename Dtype>
 void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  LOG(INFO) << "Loading HDF5 file" << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
-    LOG(ERROR) << "Failed opening HDF5 file" << filename;
-    return;
-  }
+  DLOG(INFO) << "Loading HDF5 file " << filename;
+  HDF5Lock lock;
+  CloseHDF5File();
+  file_id_ = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+  CHECK_GE(file_id_, 0) << "Failed opening HDF5 file " << filename;
 
   const int MIN_DATA_DIM = 2;
   const int MAX_DATA_DIM = 4;
-  hdf5_load_nd_dataset(
-    file_id, "data",  MIN_DATA_DIM, MAX_DATA_DIM, &data_blob_);
+  vector<hsize_t> data_dims;
+  hdf5_get_nd_dataset_dims(file_id_, HDF5_DATA_DATASET_NAME, MIN_DATA_DIM,
+                           MAX_DATA_DIM, &data_dims);
 
   const int MIN_LABEL_DIM = 1;
   const int MAX_LABEL_DIM = 2;
-  hdf5_load_nd_dataset(
-    file_id, "label", MIN_LABEL_DIM, MAX_LABEL_DIM, &label_blob_);
+  vector<hsize_t> label_dims;
+  hdf5_get_nd_dataset_dims(file_id_, HDF5_DATA_LABEL_NAME, MIN_LABEL_DIM,
+                           MAX_LABEL_DIM, &label_dims);
+  CHECK_EQ(data_dims[0], label_dims[0]);
+  CHECK_GT(data_dims[0], 0) << filename << " has no rows";
+
+  // The first file sets the shape of the rows; the others must match it.
+  if (data_dims_.empty()) {
+    data_dims_ = data_dims;
+    label_dims_ = label_dims;
+  } else {
+    CHECK(data_dims.size() == data_dims_.size() &&
+          std::equal(data_dims.begin() + 1, data_dims.end(),
+                     data_dims_.begin() + 1))
+        << "The data of " << filename << " differs in shape";
+    CHECK(label_dims.size() == label_dims_.size() &&
+          std::equal(label_dims.begin() + 1, label_dims.end(),
+                     label_dims_.begin() + 1))
+        << "The labels of " << filename << " differ in shape";
+  }
 
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file " << filename;
-  CHECK_EQ(data_blob_.num(), label_blob_.num());
-  LOG(INFO) << "Successully loaded " << data_blob_.num() << " rows";
+  data_dataset_ = H5Dopen2(file_id_, HDF5_DATA_DATASET_NAME, H5P_DEFAULT);
+  CHECK_GE(data_dataset_, 0) << "Failed to open the data of " << filename;
+  label_dataset_ = H5Dopen2(file_id_, HDF5_DATA_LABEL_NAME, H5P_DEFAULT);
+  CHECK_GE(label_dataset_, 0) << "Failed to open the labels of " << filename;
+  num_rows_ = data_dims[0];
+  current_row_ = 0;
+  if (this->layer_param_.hdf5_data_param().shuffle()) {
+    ShuffleRows();
+  }
+  DLOG(INFO) << "Successully opened " << num_rows_ << " rows";
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+void HDF5DataLayer<Dtype>::CloseHDF5File() {
+  HDF5Lock lock;
+  if (data_dataset_ >= 0) {
+    H5Dclose(data_dataset_);
+    data_dataset_ = -1;
+  }
+  if (label_dataset_ >= 0) {
+    H5Dclose(label_dataset_);
+    label_dataset_ = -1;
+  }
+  if (file_id_ >= 0) {
+    herr_t status = H5Fclose(file_id_);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file";
+    file_id_ = -1;
+  }
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::NextHDF5File() {
+  if (num_files_ > 1) {
+    current_file_ += 1;
+    if (current_file_ == num_files_) {
+      current_file_ = 0;
+      DLOG(INFO) << "looping around to first file";
+      if (this->layer_param_.hdf5_data_param().shuffle()) {
+        shuffle(file_permutation_.begin(), file_permutation_.end(),
+                static_cast<caffe::rng_t*>(prefetch_rng_->generator()));
+      }
+    }
+    LoadHDF5FileData(
+        hdf_filenames_[file_permutation_[current_file_]].c_str());
+  } else {
+    current_row_ = 0;
+    if (this->layer_param_.hdf5_data_param().shuffle()) {
+      ShuffleRows();
+    }
+  }
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::ShuffleRows() {
+  row_permutation_.resize(num_rows_);
+  for (hsize_t i = 0; i < num_rows_; ++i) {
+    row_permutation_[i] = i;
+  }
+  shuffle(row_permutation_.begin(), row_permutation_.end(),
+          static_cast<caffe::rng_t*>(prefetch_rng_->generator()));
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  const HDF5DataParameter& hdf5_data_param =
+      this->layer_param_.hdf5_data_param();
   // Read the source to parse the filenames.
-  const string& source = this->layer_param_.hdf5_data_param().source();
+  const string& source = hdf5_data_param.source();
   LOG(INFO) << "Loading filename from " << source;
   hdf_filenames_.clear();
   std::ifstream source_file(source.c_str());
@@ -65,55 +138,84 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   source_file.close();
   num_files_ = hdf_filenames_.size();
+  CHECK_GE(num_files_, 1) << "Must have at least 1 HDF5 filename listed in "
+      << source;
   current_file_ = 0;
   LOG(INFO) << "Number of files: " << num_files_;
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
-  current_row_ = 0;
+  file_permutation_.resize(num_files_);
+  for (int i = 0; i < num_files_; ++i) {
+    file_permutation_[i] = i;
+  }
+  if (hdf5_data_param.shuffle()) {
+    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+    shuffle(file_permutation_.begin(), file_permutation_.end(),
+            static_cast<caffe::rng_t*>(prefetch_rng_->generator()));
+  }
+
+  // Open the first HDF5 file; its rows are read as the batches are loaded.
+  data_dims_.clear();
+  label_dims_.clear();
+  LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
 
   // Reshape blobs.
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  (*top)[0]->Reshape(batch_size, data_blob_.channels(),
-                     data_blob_.height(), data_blob_.width());
-  (*top)[1]->Reshape(batch_size, label_blob_.channels(),
-                     label_blob_.height(), label_blob_.width());
+  const int batch_size = hdf5_data_param.batch_size();
+  const int data_channels = data_dims_.size() > 1 ? data_dims_[1] : 1;
+  const int data_height = data_dims_.size() > 2 ? data_dims_[2] : 1;
+  const int data_width = data_dims_.size() > 3 ? data_dims_[3] : 1;
+  const int label_channels = label_dims_.size() > 1 ? label_dims_[1] : 1;
+  (*top)[0]->Reshape(batch_size, data_channels, data_height, data_width);
+  (*top)[1]->Reshape(batch_size, label_channels, 1, 1);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*(*top)[0]);
+    this->prefetch_[i]->label_.ReshapeLike(*(*top)[1]);
+  }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
+  this->datum_channels_ = data_channels;
+  this->datum_height_ = data_height;
+  this->datum_width_ = data_width;
+  this->datum_size_ = data_channels * data_height * data_width;
 }
 
+// This function is called on the prefetch thread to fill a batch.
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {
+void HDF5DataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  const int data_count = (*top)[0]->count() / (*top)[0]->num();
-  const int label_data_count = (*top)[1]->count() / (*top)[1]->num();
-
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == data_blob_.num()) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          LOG(INFO) << "looping around to first file";
-        }
-        LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
-      }
-      current_row_ = 0;
+  const bool shuffle = this->layer_param_.hdf5_data_param().shuffle();
+  const int data_count = batch->data_.count() / batch->data_.num();
+  const int label_data_count = batch->label_.count() / batch->label_.num();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
+
+  // Read the rows of the batch file by file, each file in one call.
+  for (int item_id = 0; item_id < batch_size; ) {
+    if (current_row_ == num_rows_) {
+      NextHDF5File();
+    }
+    const int count = std::min<hsize_t>(batch_size - item_id,
+                                        num_rows_ - current_row_);
+    batch_rows_.resize(count);
+    for (int i = 0; i < count; ++i) {
+      batch_rows_[i] = shuffle ? row_permutation_[current_row_ + i]
+                               : current_row_ + i;
     }
-    caffe_copy(data_count, &data_blob_.cpu_data()[current_row_ * data_count],
-               &(*top)[0]->mutable_cpu_data()[i * data_count]);
-    caffe_copy(label_data_count,
-               &label_blob_.cpu_data()[current_row_ * label_data_count],
-               &(*top)[1]->mutable_cpu_data()[i * label_data_count]);
+    if (shuffle) {
+      // HDF5 reads a selection in file order; the rows drawn for the batch
+      // are random either way.
+      std::sort(batch_rows_.begin(), batch_rows_.end());
+    }
+    hdf5_load_nd_dataset_rows(data_dataset_, batch_rows_,
+                              top_data + item_id * data_count);
+    hdf5_load_nd_dataset_rows(label_dataset_, batch_rows_,
+                              top_label + item_id * label_data_count);
+    item_id += count;
+    current_row_ += count;
   }
 }
 
-#ifdef CPU_ONLY
-STUB_GPU_FORWARD(HDF5DataLayer, Forward);
-#endif
-
 INSTANTIATE_CLASS(HDF5DataLayer);
 
 }  // namespace caffe
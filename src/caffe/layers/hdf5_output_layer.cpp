@@ -16,6 +16,7 @@ HDF5OutputLayer<Dtype>::HDF5OutputLayer(const LayerParameter& param)
     : Layer<Dtype>(param),
       file_name_(param.hdf5_output_param().file_name()) {
   /* create a HDF5 file */
+  HDF5Lock lock;
   file_id_ = H5Fcreate(file_name_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
                        H5P_DEFAULT);
   CHECK_GE(file_id_, 0) << "Failed to open HDF5 file" << file_name_;
@@ -23,6 +24,7 @@ HDF5OutputLayer<Dtype>::HDF5OutputLayer(const LayerParameter& param)
 
 template <typename Dtype>
 HDF5OutputLayer<Dtype>::~HDF5OutputLayer<Dtype>() {
+  HDF5Lock lock;
   herr_t status = H5Fclose(file_id_);
   CHECK_GE(status, 0) << "Failed to close HDF5 file " << file_name_;
 }
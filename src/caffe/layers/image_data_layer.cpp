@@ -1,14 +1,19 @@
+#include <boost/bind.hpp>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/philox.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -38,11 +43,11 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     lines_.push_back(std::make_pair(filename, label));
   }
 
+  epoch_ = 0;
   if (this->layer_param_.image_data_param().shuffle()) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
-    const unsigned int prefetch_rng_seed = caffe_rng_rand();
-    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+    shuffle_seed_ = caffe_philox_seed();
     ShuffleImages();
   }
   LOG(INFO) << "A total of " << lines_.size() << " images.";
@@ -58,29 +63,34 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   CHECK(!lines_.empty())
       << "Image list is empty (filename: \"" + source + "\")";
+  const int cache_size = this->layer_param_.image_data_param().cache_size();
+  if (cache_size > 0) {
+    ImageCache::Get().Reserve(static_cast<size_t>(cache_size) << 20);
+  }
   // Read a data point, and use it to initialize the top blob.
-  Datum datum;
-  CHECK(ReadImageToDatum(lines_[lines_id_].first, lines_[lines_id_].second,
-                         new_height, new_width, &datum));
+  shared_ptr<const Datum> first_datum = ReadImage(lines_[lines_id_]);
+  CHECK(first_datum);
+  const Datum& datum = *first_datum;
   // image
   const int crop_size = this->layer_param_.transform_param().crop_size();
   const int batch_size = this->layer_param_.image_data_param().batch_size();
   if (crop_size > 0) {
     (*top)[0]->Reshape(batch_size, datum.channels(), crop_size, crop_size);
-    this->prefetch_data_.Reshape(batch_size, datum.channels(), crop_size,
-                                 crop_size);
   } else {
     (*top)[0]->Reshape(batch_size, datum.channels(), datum.height(),
                        datum.width());
-    this->prefetch_data_.Reshape(batch_size, datum.channels(), datum.height(),
-        datum.width());
+  }
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*(*top)[0]);
   }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
   // label
   (*top)[1]->Reshape(batch_size, 1, 1, 1);
-  this->prefetch_label_.Reshape(batch_size, 1, 1, 1);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.ReshapeLike(*(*top)[1]);
+  }
   // datum size
   this->datum_channels_ = datum.channels();
   this->datum_height_ = datum.height();
@@ -88,51 +98,95 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
 }
 
+template <typename Dtype>
+shared_ptr<const Datum> ImageDataLayer<Dtype>::ReadImage(
+    const std::pair<std::string, int>& line) {
+  const int new_height = this->layer_param_.image_data_param().new_height();
+  const int new_width = this->layer_param_.image_data_param().new_width();
+  const bool use_cache = this->layer_param_.image_data_param().cache_size() > 0;
+  string key;
+  if (use_cache) {
+    // The label is not part of the key: it is taken from the line.
+    std::ostringstream key_stream;
+    key_stream << new_height << "x" << new_width << ":" << line.first;
+    key = key_stream.str();
+    shared_ptr<const Datum> cached = ImageCache::Get().Lookup(key);
+    if (cached) {
+      return cached;
+    }
+  }
+  shared_ptr<Datum> datum(new Datum());
+  if (!ReadImageToDatum(line.first, line.second, new_height, new_width,
+                        datum.get())) {
+    return shared_ptr<const Datum>();
+  }
+  if (use_cache) {
+    ImageCache::Get().Insert(key, datum);
+  }
+  return datum;
+}
+
 template <typename Dtype>
 void ImageDataLayer<Dtype>::ShuffleImages() {
-  caffe::rng_t* prefetch_rng =
-      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
-  shuffle(lines_.begin(), lines_.end(), prefetch_rng);
+  Philox rng(shuffle_seed_, epoch_, 0);
+  shuffle(lines_.begin(), lines_.end(), &rng);
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread to fill a batch.
 template <typename Dtype>
-void ImageDataLayer<Dtype>::InternalThreadEntry() {
-  Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
-  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
-  const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
+void ImageDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
+  const int batch_size = this->layer_param_.image_data_param().batch_size();
+  batch_lines_.resize(batch_size);
+  item_streams_.resize(batch_size);
 
-  // datum scales
+  // Pick the images of the batch in order; the random choices of each are
+  // keyed on its position in the epoch.
   const int lines_size = lines_.size();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
     CHECK_GT(lines_size, lines_id_);
-    if (!ReadImageToDatum(lines_[lines_id_].first,
-          lines_[lines_id_].second,
-          new_height, new_width, &datum)) {
-      continue;
-    }
-
-    // Apply transformations (mirror, crop...) to the data
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
-
-    top_label[item_id] = datum.label();
+    // Copied, as reshuffling at the end of an epoch reorders lines_.
+    batch_lines_[item_id] = lines_[lines_id_];
+    item_streams_[item_id] = std::make_pair(epoch_, lines_id_);
     // go to the next iter
     lines_id_++;
     if (lines_id_ >= lines_size) {
       // We have reached the end. Restart from the first.
       DLOG(INFO) << "Restarting data prefetching from start.";
       lines_id_ = 0;
+      ++epoch_;
       if (this->layer_param_.image_data_param().shuffle()) {
         ShuffleImages();
       }
     }
   }
+
+  // Decode and transform the images in parallel.
+  ThreadPool::Get().Run(batch_size, boost::bind(
+      &ImageDataLayer<Dtype>::LoadItem, this, _1, top_data, top_label));
+}
+
+template <typename Dtype>
+void ImageDataLayer<Dtype>::LoadItem(const int item_id, Dtype* top_data,
+    Dtype* top_label) {
+  const std::pair<std::string, int>& line = batch_lines_[item_id];
+  top_label[item_id] = line.second;
+  shared_ptr<const Datum> datum = ReadImage(line);
+  if (!datum) {
+    // ReadImageToDatum has logged the error; leave a blank item.
+    const int item_size = this->prefetch_[0]->data_.count()
+        / this->prefetch_[0]->data_.num();
+    caffe_set(item_size, Dtype(0), top_data + item_id * item_size);
+    return;
+  }
+  Philox rng = this->data_transformer_.ItemRand(item_streams_[item_id].first,
+                                                item_streams_[item_id].second);
+
+  // Apply transformations (mirror, crop...) to the data
+  this->data_transformer_.Transform(item_id, *datum, this->mean_, top_data,
+                                    &rng);
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
@@ -1,11 +1,24 @@
+#include <boost/thread.hpp>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+class MemoryDataLayer<Dtype>::sync {
+ public:
+  boost::mutex mutex_;
+};
+
+template <typename Dtype>
+MemoryDataLayer<Dtype>::MemoryDataLayer(const LayerParameter& param)
+    : BaseDataLayer<Dtype>(param), has_new_data_(false),
+      num_pushed_items_(0), sync_(new sync()) {}
+
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
      vector<Blob<Dtype>*>* top) {
@@ -28,6 +41,25 @@ void MemoryDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   labels_ = NULL;
   added_data_.cpu_data();
   added_label_.cpu_data();
+
+  // Drop the batches queued before a new SetUp, and shape the buffers. Their
+  // memory is only allocated once batches are pushed. The old buffers are
+  // freed, so no producer may be filling one meanwhile.
+  CHECK_EQ(queue_free_.size() + queue_full_.size(), queue_.size())
+      << "SetUp while a batch is being pushed to the MemoryDataLayer";
+  Batch<Dtype>* batch;
+  while (queue_free_.try_pop(&batch)) {}
+  while (queue_full_.try_pop(&batch)) {}
+  const int queue_depth = this->layer_param_.memory_data_param().queue_depth();
+  CHECK_GT(queue_depth, 0) << "queue_depth must be positive";
+  queue_.resize(queue_depth);
+  for (int i = 0; i < queue_depth; ++i) {
+    queue_[i].reset(new Batch<Dtype>());
+    queue_[i]->data_.Reshape(batch_size_, this->datum_channels_,
+                             this->datum_height_, this->datum_width_);
+    queue_[i]->label_.Reshape(batch_size_, 1, 1, 1);
+    queue_free_.push(queue_[i].get());
+  }
 }
 
 template <typename Dtype>
@@ -64,10 +96,76 @@ void MemoryDataLayer<Dtype>::Reset(Dtype* data, Dtype* labels, int n) {
   pos_ = 0;
 }
 
+template <typename Dtype>
+Batch<Dtype>* MemoryDataLayer<Dtype>::PopFreeBatch(const bool blocking) {
+  CHECK(!data_) << "Can't push batches to a MemoryDataLayer that was Reset";
+  Batch<Dtype>* batch = NULL;
+  if (blocking) {
+    batch = queue_free_.pop();
+  } else {
+    queue_free_.try_pop(&batch);
+  }
+  return batch;
+}
+
+template <typename Dtype>
+bool MemoryDataLayer<Dtype>::PushBatch(const Dtype* data,
+    const Dtype* labels, const bool blocking) {
+  CHECK(data);
+  CHECK(labels);
+  Batch<Dtype>* batch = PopFreeBatch(blocking);
+  if (!batch) {
+    return false;
+  }
+  caffe_copy(batch->data_.count(), data, batch->data_.mutable_cpu_data());
+  caffe_copy(batch->label_.count(), labels, batch->label_.mutable_cpu_data());
+  queue_full_.push(batch);
+  return true;
+}
+
+template <typename Dtype>
+bool MemoryDataLayer<Dtype>::PushDatumVector(
+    const vector<Datum>& datum_vector, const bool blocking) {
+  CHECK_EQ(datum_vector.size(), batch_size_) <<
+      "The number of pushed Datums must be the batch size";
+  Batch<Dtype>* batch = PopFreeBatch(blocking);
+  if (!batch) {
+    return false;
+  }
+  // The random choices are keyed on the position of the items among the
+  // pushed ones: only that is taken under the lock, so that producers
+  // transform concurrently.
+  uint64_t first_item;
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    first_item = num_pushed_items_;
+    num_pushed_items_ += batch_size_;
+  }
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
+  for (int item_id = 0; item_id < batch_size_; ++item_id) {
+    Philox rng = this->data_transformer_.ItemRand(0, first_item + item_id);
+    this->data_transformer_.Transform(item_id, datum_vector[item_id],
+                                      this->mean_, top_data, &rng);
+    top_label[item_id] = datum_vector[item_id].label();
+  }
+  queue_full_.push(batch);
+  return true;
+}
+
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-  CHECK(data_) << "MemoryDataLayer needs to be initalized by calling Reset";
+  if (!data_) {
+    // Swap the buffers of the next pushed batch into the top blobs, as
+    // BasePrefetchingDataLayer does, and free the ones they delivered before.
+    Batch<Dtype>* batch = queue_full_.pop(
+        "MemoryDataLayer waiting for a batch: call Reset or push batches");
+    (*top)[0]->SwapData(&batch->data_);
+    (*top)[1]->SwapData(&batch->label_);
+    queue_free_.push(batch);
+    return;
+  }
   (*top)[0]->set_cpu_data(data_ + pos_ * this->datum_size_);
   (*top)[1]->set_cpu_data(labels_ + pos_);
   pos_ = (pos_ + batch_size_) % n_;
@@ -1,5 +1,6 @@
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <algorithm>
 #include <map>
 #include <string>
@@ -15,7 +16,8 @@
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
-#include "caffe/util/rng.hpp"
+#include "caffe/util/philox.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 // caffe.proto > LayerParameter > WindowDataParameter
 //   'source' field specifies the window_file
@@ -54,15 +56,9 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       << "  foreground sampling fraction: "
       << this->layer_param_.window_data_param().fg_fraction();
 
-  const bool prefetch_needs_rand =
-      this->transform_param_.mirror() ||
-      this->transform_param_.crop_size();
-  if (prefetch_needs_rand) {
-    const unsigned int prefetch_rng_seed = caffe_rng_rand();
-    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
-  } else {
-    prefetch_rng_.reset();
-  }
+  // The windows are sampled at random even without mirroring or cropping.
+  sample_seed_ = caffe_philox_seed();
+  num_batches_ = 0;
 
   std::ifstream infile(this->layer_param_.window_data_param().source().c_str());
   CHECK(infile.good()) << "Failed to open window file "
@@ -153,7 +149,9 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK_GT(crop_size, 0);
   const int batch_size = this->layer_param_.window_data_param().batch_size();
   (*top)[0]->Reshape(batch_size, channels, crop_size, crop_size);
-  this->prefetch_data_.Reshape(batch_size, channels, crop_size, crop_size);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*(*top)[0]);
+  }
 
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
@@ -166,229 +164,317 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       (*top)[0]->channels() * (*top)[0]->height() * (*top)[0]->width();
   // label
   (*top)[1]->Reshape(batch_size, 1, 1, 1);
-  this->prefetch_label_.Reshape(batch_size, 1, 1, 1);
-}
-
-template <typename Dtype>
-unsigned int WindowDataLayer<Dtype>::PrefetchRand() {
-  CHECK(prefetch_rng_);
-  caffe::rng_t* prefetch_rng =
-      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
-  return (*prefetch_rng)();
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.ReshapeLike(*(*top)[1]);
+  }
 }
 
 // Thread fetching the data
 template <typename Dtype>
-void WindowDataLayer<Dtype>::InternalThreadEntry() {
+void WindowDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
   // At each iteration, sample N windows where N*p are foreground (object)
   // windows and N*(1-p) are background (non-object) windows
 
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
-  const Dtype scale = this->layer_param_.window_data_param().scale();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
   const int batch_size = this->layer_param_.window_data_param().batch_size();
-  const int context_pad = this->layer_param_.window_data_param().context_pad();
-  const int crop_size = this->transform_param_.crop_size();
   const bool mirror = this->transform_param_.mirror();
   const float fg_fraction =
       this->layer_param_.window_data_param().fg_fraction();
-  const Dtype* mean = this->data_mean_.cpu_data();
-  const int mean_off = (this->data_mean_.width() - crop_size) / 2;
-  const int mean_width = this->data_mean_.width();
-  const int mean_height = this->data_mean_.height();
-  cv::Size cv_crop_size(crop_size, crop_size);
-  const string& crop_mode = this->layer_param_.window_data_param().crop_mode();
-
-  bool use_square = (crop_mode == "square") ? true : false;
 
   // zero out batch
-  caffe_set(this->prefetch_data_.count(), Dtype(0), top_data);
+  caffe_set(batch->data_.count(), Dtype(0), top_data);
 
   const int num_fg = static_cast<int>(static_cast<float>(batch_size)
       * fg_fraction);
   const int num_samples[2] = { batch_size - num_fg, num_fg };
 
+  batch_windows_.resize(batch_size);
+  batch_mirror_.resize(batch_size);
   int item_id = 0;
-  // sample from bg set then fg set
+  // sample from bg set then fg set; the random choices are all made here, each
+  // item drawing from its own generator keyed on the batch and the item
   for (int is_fg = 0; is_fg < 2; ++is_fg) {
     for (int dummy = 0; dummy < num_samples[is_fg]; ++dummy) {
+      Philox rng(sample_seed_, num_batches_, item_id);
       // sample a window
-      const unsigned int rand_index = PrefetchRand();
-      vector<float> window = (is_fg) ?
+      const unsigned int rand_index = rng();
+      batch_windows_[item_id] = (is_fg) ?
           fg_windows_[rand_index % fg_windows_.size()] :
           bg_windows_[rand_index % bg_windows_.size()];
 
-      bool do_mirror = false;
-      if (mirror && PrefetchRand() % 2) {
-        do_mirror = true;
+      batch_mirror_[item_id] = false;
+      if (mirror && rng() % 2) {
+        batch_mirror_[item_id] = true;
       }
-
-      // load the image containing the window
-      pair<std::string, vector<int> > image =
-          image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
-
-      cv::Mat cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
-      if (!cv_img.data) {
-        LOG(ERROR) << "Could not open or find file " << image.first;
-        return;
+      item_id++;
+    }
+  }
+  ++num_batches_;
+
+  // Group the windows by image, so that each image is decoded once per
+  // batch, and take the images still in the cache from there.
+  batch_image_indices_.clear();
+  batch_images_.clear();
+  batch_item_images_.resize(batch_size);
+  map<int, int> batch_image_ids;
+  for (item_id = 0; item_id < batch_size; ++item_id) {
+    const int image_index =
+        batch_windows_[item_id][WindowDataLayer<Dtype>::IMAGE_INDEX];
+    map<int, int>::iterator it = batch_image_ids.find(image_index);
+    if (it == batch_image_ids.end()) {
+      it = batch_image_ids.insert(
+          std::make_pair(image_index, batch_image_indices_.size())).first;
+      batch_image_indices_.push_back(image_index);
+      typename std::map<int, typename ImageCacheList::iterator>::iterator
+          cached = image_cache_index_.find(image_index);
+      if (cached != image_cache_index_.end()) {
+        image_cache_.splice(image_cache_.begin(), image_cache_,
+                            cached->second);
+        batch_images_.push_back(cached->second->second);
+      } else {
+        batch_images_.push_back(shared_ptr<cv::Mat>());
       }
-      const int channels = cv_img.channels();
-
-      // crop window out of image and warp it
-      int x1 = window[WindowDataLayer<Dtype>::X1];
-      int y1 = window[WindowDataLayer<Dtype>::Y1];
-      int x2 = window[WindowDataLayer<Dtype>::X2];
-      int y2 = window[WindowDataLayer<Dtype>::Y2];
-
-      int pad_w = 0;
-      int pad_h = 0;
-      if (context_pad > 0 || use_square) {
-        // scale factor by which to expand the original region
-        // such that after warping the expanded region to crop_size x crop_size
-        // there's exactly context_pad amount of padding on each side
-        Dtype context_scale = static_cast<Dtype>(crop_size) /
-            static_cast<Dtype>(crop_size - 2*context_pad);
-
-        // compute the expanded region
-        Dtype half_height = static_cast<Dtype>(y2-y1+1)/2.0;
-        Dtype half_width = static_cast<Dtype>(x2-x1+1)/2.0;
-        Dtype center_x = static_cast<Dtype>(x1) + half_width;
-        Dtype center_y = static_cast<Dtype>(y1) + half_height;
-        if (use_square) {
-          if (half_height > half_width) {
-            half_width = half_height;
-          } else {
-            half_height = half_width;
-          }
-        }
-        x1 = static_cast<int>(round(center_x - half_width*context_scale));
-        x2 = static_cast<int>(round(center_x + half_width*context_scale));
-        y1 = static_cast<int>(round(center_y - half_height*context_scale));
-        y2 = static_cast<int>(round(center_y + half_height*context_scale));
-
-        // the expanded region may go outside of the image
-        // so we compute the clipped (expanded) region and keep track of
-        // the extent beyond the image
-        int unclipped_height = y2-y1+1;
-        int unclipped_width = x2-x1+1;
-        int pad_x1 = std::max(0, -x1);
-        int pad_y1 = std::max(0, -y1);
-        int pad_x2 = std::max(0, x2 - cv_img.cols + 1);
-        int pad_y2 = std::max(0, y2 - cv_img.rows + 1);
-        // clip bounds
-        x1 = x1 + pad_x1;
-        x2 = x2 - pad_x2;
-        y1 = y1 + pad_y1;
-        y2 = y2 - pad_y2;
-        CHECK_GT(x1, -1);
-        CHECK_GT(y1, -1);
-        CHECK_LT(x2, cv_img.cols);
-        CHECK_LT(y2, cv_img.rows);
-
-        int clipped_height = y2-y1+1;
-        int clipped_width = x2-x1+1;
-
-        // scale factors that would be used to warp the unclipped
-        // expanded region
-        Dtype scale_x =
-            static_cast<Dtype>(crop_size)/static_cast<Dtype>(unclipped_width);
-        Dtype scale_y =
-            static_cast<Dtype>(crop_size)/static_cast<Dtype>(unclipped_height);
-
-        // size to warp the clipped expanded region to
-        cv_crop_size.width =
-            static_cast<int>(round(static_cast<Dtype>(clipped_width)*scale_x));
-        cv_crop_size.height =
-            static_cast<int>(round(static_cast<Dtype>(clipped_height)*scale_y));
-        pad_x1 = static_cast<int>(round(static_cast<Dtype>(pad_x1)*scale_x));
-        pad_x2 = static_cast<int>(round(static_cast<Dtype>(pad_x2)*scale_x));
-        pad_y1 = static_cast<int>(round(static_cast<Dtype>(pad_y1)*scale_y));
-        pad_y2 = static_cast<int>(round(static_cast<Dtype>(pad_y2)*scale_y));
-
-        pad_h = pad_y1;
-        // if we're mirroring, we mirror the padding too (to be pedantic)
-        if (do_mirror) {
-          pad_w = pad_x2;
-        } else {
-          pad_w = pad_x1;
-        }
-
-        // ensure that the warped, clipped region plus the padding fits in the
-        // crop_size x crop_size image (it might not due to rounding)
-        if (pad_h + cv_crop_size.height > crop_size) {
-          cv_crop_size.height = crop_size - pad_h;
-        }
-        if (pad_w + cv_crop_size.width > crop_size) {
-          cv_crop_size.width = crop_size - pad_w;
-        }
+    }
+    batch_item_images_[item_id] = it->second;
+  }
+
+  // Decode the missing images, then crop and warp the windows, in parallel.
+  const int num_images = batch_image_indices_.size();
+  vector<bool> decoded(num_images);
+  for (int image_id = 0; image_id < num_images; ++image_id) {
+    decoded[image_id] = !batch_images_[image_id];
+  }
+  ThreadPool::Get().Run(num_images, boost::bind(
+      &WindowDataLayer<Dtype>::LoadImage, this, _1));
+  if (this->layer_param_.window_data_param().cache_size() > 0) {
+    for (int image_id = 0; image_id < num_images; ++image_id) {
+      if (decoded[image_id]) {
+        CacheImage(batch_image_indices_[image_id], batch_images_[image_id]);
       }
+    }
+  }
+  ThreadPool::Get().Run(batch_size, boost::bind(
+      &WindowDataLayer<Dtype>::LoadItem, this, _1, top_data, top_label));
+}
 
-      cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
-      cv::Mat cv_cropped_img = cv_img(roi);
-      cv::resize(cv_cropped_img, cv_cropped_img,
-          cv_crop_size, 0, 0, cv::INTER_LINEAR);
+template <typename Dtype>
+void WindowDataLayer<Dtype>::LoadImage(const int image_id) {
+  if (batch_images_[image_id]) {
+    return;
+  }
+  const string& filename =
+      image_database_[batch_image_indices_[image_id]].first;
+  batch_images_[image_id].reset(
+      new cv::Mat(cv::imread(filename, CV_LOAD_IMAGE_COLOR)));
+  if (!batch_images_[image_id]->data) {
+    LOG(ERROR) << "Could not open or find file " << filename;
+  }
+}
 
-      // horizontal flip at random
-      if (do_mirror) {
-        cv::flip(cv_cropped_img, cv_cropped_img, 1);
-      }
+template <typename Dtype>
+void WindowDataLayer<Dtype>::CacheImage(const int image_index,
+    const shared_ptr<cv::Mat>& image) {
+  const size_t capacity = static_cast<size_t>(
+      this->layer_param_.window_data_param().cache_size()) << 20;
+  const size_t image_size = image->total() * image->elemSize();
+  if (!image->data || image_size > capacity) {
+    return;
+  }
+  while (image_cache_size_ + image_size > capacity) {
+    const shared_ptr<cv::Mat>& evicted = image_cache_.back().second;
+    image_cache_size_ -= evicted->total() * evicted->elemSize();
+    image_cache_index_.erase(image_cache_.back().first);
+    image_cache_.pop_back();
+  }
+  image_cache_.push_front(std::make_pair(image_index, image));
+  image_cache_index_[image_index] = image_cache_.begin();
+  image_cache_size_ += image_size;
+}
+
+template <typename Dtype>
+void WindowDataLayer<Dtype>::LoadItem(const int item_id, Dtype* top_data,
+    Dtype* top_label) {
+  const vector<float>& window = batch_windows_[item_id];
+  const bool do_mirror = batch_mirror_[item_id];
+  const Dtype scale = this->layer_param_.window_data_param().scale();
+  const int context_pad = this->layer_param_.window_data_param().context_pad();
+  const int crop_size = this->transform_param_.crop_size();
+  const Dtype* mean = this->data_mean_.cpu_data();
+  const int mean_off = (this->data_mean_.width() - crop_size) / 2;
+  const int mean_width = this->data_mean_.width();
+  const int mean_height = this->data_mean_.height();
+  cv::Size cv_crop_size(crop_size, crop_size);
+  const string& crop_mode = this->layer_param_.window_data_param().crop_mode();
 
-      // copy the warped window into top_data
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < cv_cropped_img.rows; ++h) {
-          for (int w = 0; w < cv_cropped_img.cols; ++w) {
-            Dtype pixel =
-                static_cast<Dtype>(cv_cropped_img.at<cv::Vec3b>(h, w)[c]);
-
-            top_data[((item_id * channels + c) * crop_size + h + pad_h)
-                     * crop_size + w + pad_w]
-                = (pixel
-                    - mean[(c * mean_height + h + mean_off + pad_h)
-                           * mean_width + w + mean_off + pad_w])
-                  * scale;
-          }
-        }
+  bool use_square = (crop_mode == "square") ? true : false;
+
+  // the decoded image containing the window, shared with the other windows
+  // of the batch cut from it: it must not be modified
+  const cv::Mat& cv_img = *batch_images_[batch_item_images_[item_id]];
+  if (!cv_img.data) {
+    // LoadImage has logged the error; leave the (zeroed) item blank.
+    return;
+  }
+  const int channels = cv_img.channels();
+
+  // crop window out of image and warp it
+  int x1 = window[WindowDataLayer<Dtype>::X1];
+  int y1 = window[WindowDataLayer<Dtype>::Y1];
+  int x2 = window[WindowDataLayer<Dtype>::X2];
+  int y2 = window[WindowDataLayer<Dtype>::Y2];
+
+  int pad_w = 0;
+  int pad_h = 0;
+  if (context_pad > 0 || use_square) {
+    // scale factor by which to expand the original region
+    // such that after warping the expanded region to crop_size x crop_size
+    // there's exactly context_pad amount of padding on each side
+    Dtype context_scale = static_cast<Dtype>(crop_size) /
+        static_cast<Dtype>(crop_size - 2*context_pad);
+
+    // compute the expanded region
+    Dtype half_height = static_cast<Dtype>(y2-y1+1)/2.0;
+    Dtype half_width = static_cast<Dtype>(x2-x1+1)/2.0;
+    Dtype center_x = static_cast<Dtype>(x1) + half_width;
+    Dtype center_y = static_cast<Dtype>(y1) + half_height;
+    if (use_square) {
+      if (half_height > half_width) {
+        half_width = half_height;
+      } else {
+        half_height = half_width;
       }
+    }
+    x1 = static_cast<int>(round(center_x - half_width*context_scale));
+    x2 = static_cast<int>(round(center_x + half_width*context_scale));
+    y1 = static_cast<int>(round(center_y - half_height*context_scale));
+    y2 = static_cast<int>(round(center_y + half_height*context_scale));
+
+    // the expanded region may go outside of the image
+    // so we compute the clipped (expanded) region and keep track of
+    // the extent beyond the image
+    int unclipped_height = y2-y1+1;
+    int unclipped_width = x2-x1+1;
+    int pad_x1 = std::max(0, -x1);
+    int pad_y1 = std::max(0, -y1);
+    int pad_x2 = std::max(0, x2 - cv_img.cols + 1);
+    int pad_y2 = std::max(0, y2 - cv_img.rows + 1);
+    // clip bounds
+    x1 = x1 + pad_x1;
+    x2 = x2 - pad_x2;
+    y1 = y1 + pad_y1;
+    y2 = y2 - pad_y2;
+    CHECK_GT(x1, -1);
+    CHECK_GT(y1, -1);
+    CHECK_LT(x2, cv_img.cols);
+    CHECK_LT(y2, cv_img.rows);
+
+    int clipped_height = y2-y1+1;
+    int clipped_width = x2-x1+1;
+
+    // scale factors that would be used to warp the unclipped
+    // expanded region
+    Dtype scale_x =
+        static_cast<Dtype>(crop_size)/static_cast<Dtype>(unclipped_width);
+    Dtype scale_y =
+        static_cast<Dtype>(crop_size)/static_cast<Dtype>(unclipped_height);
+
+    // size to warp the clipped expanded region to
+    cv_crop_size.width =
+        static_cast<int>(round(static_cast<Dtype>(clipped_width)*scale_x));
+    cv_crop_size.height =
+        static_cast<int>(round(static_cast<Dtype>(clipped_height)*scale_y));
+    pad_x1 = static_cast<int>(round(static_cast<Dtype>(pad_x1)*scale_x));
+    pad_x2 = static_cast<int>(round(static_cast<Dtype>(pad_x2)*scale_x));
+    pad_y1 = static_cast<int>(round(static_cast<Dtype>(pad_y1)*scale_y));
+    pad_y2 = static_cast<int>(round(static_cast<Dtype>(pad_y2)*scale_y));
+
+    pad_h = pad_y1;
+    // if we're mirroring, we mirror the padding too (to be pedantic)
+    if (do_mirror) {
+      pad_w = pad_x2;
+    } else {
+      pad_w = pad_x1;
+    }
+
+    // ensure that the warped, clipped region plus the padding fits in the
+    // crop_size x crop_size image (it might not due to rounding)
+    if (pad_h + cv_crop_size.height > crop_size) {
+      cv_crop_size.height = crop_size - pad_h;
+    }
+    if (pad_w + cv_crop_size.width > crop_size) {
+      cv_crop_size.width = crop_size - pad_w;
+    }
+  }
+
+  cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
+  // warp into a buffer of its own, as the flip below works in place
+  cv::Mat cv_cropped_img;
+  cv::resize(cv_img(roi), cv_cropped_img,
+      cv_crop_size, 0, 0, cv::INTER_LINEAR);
+
+  // horizontal flip at random
+  if (do_mirror) {
+    cv::flip(cv_cropped_img, cv_cropped_img, 1);
+  }
 
-      // get window label
-      top_label[item_id] = window[WindowDataLayer<Dtype>::LABEL];
-
-      #if 0
-      // useful debugging code for dumping transformed windows to disk
-      string file_id;
-      std::stringstream ss;
-      ss << PrefetchRand();
-      ss >> file_id;
-      std::ofstream inf((string("dump/") + file_id +
-          string("_info.txt")).c_str(), std::ofstream::out);
-      inf << image.first << std::endl
-          << window[WindowDataLayer<Dtype>::X1]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::Y1]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::X2]+1 << std::endl
-          << window[WindowDataLayer<Dtype>::Y2]+1 << std::endl
-          << do_mirror << std::endl
-          << top_label[item_id] << std::endl
-          << is_fg << std::endl;
-      inf.close();
-      std::ofstream top_data_file((string("dump/") + file_id +
-          string("_data.txt")).c_str(),
-          std::ofstream::out | std::ofstream::binary);
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            top_data_file.write(reinterpret_cast<char*>(
-                &top_data[((item_id * channels + c) * crop_size + h)
-                          * crop_size + w]),
-                sizeof(Dtype));
-          }
-        }
+  // copy the warped window into top_data
+  const bool has_mean_file = this->transform_param_.has_mean_file();
+  const int mean_value_size = this->transform_param_.mean_value_size();
+  for (int c = 0; c < channels; ++c) {
+    const Dtype mean_value = (mean_value_size == 0) ? 0 :
+        this->transform_param_.mean_value(mean_value_size == 1 ? 0 : c);
+    for (int h = 0; h < cv_cropped_img.rows; ++h) {
+      for (int w = 0; w < cv_cropped_img.cols; ++w) {
+        Dtype pixel =
+            static_cast<Dtype>(cv_cropped_img.at<cv::Vec3b>(h, w)[c]);
+        Dtype pixel_mean = has_mean_file ?
+            mean[(c * mean_height + h + mean_off + pad_h) * mean_width
+                 + w + mean_off + pad_w] : mean_value;
+
+        top_data[((item_id * channels + c) * crop_size + h + pad_h)
+                 * crop_size + w + pad_w]
+            = (pixel - pixel_mean) * scale;
       }
-      top_data_file.close();
-      #endif
+    }
+  }
 
-      item_id++;
+  // get window label
+  top_label[item_id] = window[WindowDataLayer<Dtype>::LABEL];
+
+  #if 0
+  // useful debugging code for dumping transformed windows to disk
+  string file_id;
+  std::stringstream ss;
+  ss << num_batches_ << "_" << item_id;
+  ss >> file_id;
+  std::ofstream inf((string("dump/") + file_id +
+      string("_info.txt")).c_str(), std::ofstream::out);
+  inf << image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]].first
+      << std::endl
+      << window[WindowDataLayer<Dtype>::X1]+1 << std::endl
+      << window[WindowDataLayer<Dtype>::Y1]+1 << std::endl
+      << window[WindowDataLayer<Dtype>::X2]+1 << std::endl
+      << window[WindowDataLayer<Dtype>::Y2]+1 << std::endl
+      << do_mirror << std::endl
+      << top_label[item_id] << std::endl
+      << (top_label[item_id] > 0) << std::endl;
+  inf.close();
+  std::ofstream top_data_file((string("dump/") + file_id +
+      string("_data.txt")).c_str(),
+      std::ofstream::out | std::ofstream::binary);
+  for (int c = 0; c < channels; ++c) {
+    for (int h = 0; h < crop_size; ++h) {
+      for (int w = 0; w < crop_size; ++w) {
+        top_data_file.write(reinterpret_cast<char*>(
+            &top_data[((item_id * channels + c) * crop_size + h)
+                      * crop_size + w]),
+            sizeof(Dtype));
+      }
     }
   }
+  top_data_file.close();
+  #endif
 }
 
 INSTANTIATE_CLASS(WindowDataLayer);
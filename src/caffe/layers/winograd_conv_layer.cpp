@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// The transforms of F(m x m, 3 x 3): with the (m + 2) x (m + 2) input tile d
+// and the 3 x 3 filter g, the m x m output tile is
+// A^T [(G g G^T) .* (B^T d B)] A.
+// The input and output transforms run for every tile, so they are written out
+// below as the 1-D transforms of a column or row, applied to the columns and
+// then to the rows of the tile; the filter transforms G run once per pass.
+static const double kFilterTransform2[4 * 3] = {
+  1,    0,   0,
+  0.5,  0.5, 0.5,
+  0.5, -0.5, 0.5,
+  0,    0,   1
+};
+static const double kFilterTransform4[6 * 3] = {
+  1. / 4,  0,       0,
+  -1. / 6, -1. / 6,  -1. / 6,
+  -1. / 6, 1. / 6,   -1. / 6,
+  1. / 24, 1. / 12,  1. / 6,
+  1. / 24, -1. / 12, 1. / 6,
+  0,       0,        1
+};
+// The largest input tile.
+static const int kMaxTileSize = 6;
+
+// r = B^T d for F(2, 3), with B^T =
+//   1  0 -1  0
+//   0  1  1  0
+//   0 -1  1  0
+//   0  1  0 -1
+template <typename Dtype>
+static inline void InputTransform2(const Dtype* d, const int d_step, Dtype* r,
+    const int r_step) {
+  const Dtype d0 = d[0], d1 = d[d_step], d2 = d[2 * d_step],
+      d3 = d[3 * d_step];
+  r[0] = d0 - d2;
+  r[r_step] = d1 + d2;
+  r[2 * r_step] = d2 - d1;
+  r[3 * r_step] = d1 - d3;
+}
+
+// r = B^T d for F(4, 3), with B^T =
+//   4  0 -5  0  1  0
+//   0 -4 -4  1  1  0
+//   0  4 -4 -1  1  0
+//   0 -2 -1  2  1  0
+//   0  2 -1 -2  1  0
+//   0  4  0 -5  0  1
+template <typename Dtype>
+static inline void InputTransform4(const Dtype* d, const int d_step, Dtype* r,
+    const int r_step) {
+  const Dtype d0 = d[0], d1 = d[d_step], d2 = d[2 * d_step],
+      d3 = d[3 * d_step], d4 = d[4 * d_step], d5 = d[5 * d_step];
+  const Dtype a = d4 - 4 * d2;
+  const Dtype b = d3 - 4 * d1;
+  const Dtype c = d4 - d2;
+  const Dtype e = 2 * (d3 - d1);
+  r[0] = 4 * d0 - 5 * d2 + d4;
+  r[r_step] = a + b;
+  r[2 * r_step] = a - b;
+  r[3 * r_step] = c + e;
+  r[4 * r_step] = c - e;
+  r[5 * r_step] = 4 * d1 - 5 * d3 + d5;
+}
+
+// r = A^T t for F(2, 3), with A^T =
+//   1  1  1  0
+//   0  1 -1 -1
+template <typename Dtype>
+static inline void OutputTransform2(const Dtype* t, const int t_step,
+    Dtype* r, const int r_step) {
+  const Dtype t1 = t[t_step], t2 = t[2 * t_step];
+  r[0] = t[0] + t1 + t2;
+  r[r_step] = t1 - t2 - t[3 * t_step];
+}
+
+// r = A^T t for F(4, 3), with A^T =
+//   1  1  1  1  1  0
+//   0  1 -1  2 -2  0
+//   0  1  1  4  4  0
+//   0  1 -1  8 -8  1
+template <typename Dtype>
+static inline void OutputTransform4(const Dtype* t, const int t_step,
+    Dtype* r, const int r_step) {
+  const Dtype t1 = t[t_step], t2 = t[2 * t_step], t3 = t[3 * t_step],
+      t4 = t[4 * t_step];
+  const Dtype sum12 = t1 + t2;
+  const Dtype diff12 = t1 - t2;
+  const Dtype sum34 = t3 + t4;
+  const Dtype diff34 = t3 - t4;
+  r[0] = t[0] + sum12 + sum34;
+  r[r_step] = diff12 + 2 * diff34;
+  r[2 * r_step] = sum12 + 4 * sum34;
+  r[3 * r_step] = diff12 + 8 * diff34 + t[5 * t_step];
+}
+
+// Computes out = L x L^T for the rows x 3 matrix L and the 3 x 3 filter x.
+template <typename Dtype>
+static void TransformFilter(const double* L, const int rows, const Dtype* x,
+    Dtype* out) {
+  Dtype product[kMaxTileSize * 3];
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      Dtype sum = 0;
+      for (int k = 0; k < 3; ++k) {
+        sum += static_cast<Dtype>(L[i * 3 + k]) * x[k * 3 + j];
+      }
+      product[i * 3 + j] = sum;
+    }
+  }
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < rows; ++j) {
+      Dtype sum = 0;
+      for (int k = 0; k < 3; ++k) {
+        sum += product[i * 3 + k] * static_cast<Dtype>(L[j * 3 + k]);
+      }
+      out[i * rows + j] = sum;
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  winograd_ = this->kernel_h_ == 3 && this->kernel_w_ == 3 &&
+      this->stride_h_ == 1 && this->stride_w_ == 1;
+  if (!winograd_) {
+    LOG(INFO) << "Layer " << this->layer_param_.name() << ": the WINOGRAD "
+        << "engine only handles 3x3 filters with stride 1; using CAFFE.";
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  if (!winograd_) {
+    return;
+  }
+  // Larger tiles save more multiplications, but waste more on the borders of
+  // small outputs.
+  tile_size_ = (this->height_out_ > 2 && this->width_out_ > 2) ? 4 : 2;
+  input_tile_size_ = tile_size_ + 2;
+  // Forward tiles the top, backward the bottom.
+  const int tile_elements = input_tile_size_ * input_tile_size_;
+  const int top_tiles = ((this->height_out_ + tile_size_ - 1) / tile_size_) *
+      ((this->width_out_ + tile_size_ - 1) / tile_size_);
+  const int bottom_tiles = ((this->height_ + tile_size_ - 1) / tile_size_) *
+      ((this->width_ + tile_size_ - 1) / tile_size_);
+  const int group_channels = this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  transformed_input_.Reshape(tile_elements, 1, 1,
+      std::max(group_channels * top_tiles, group_outputs * bottom_tiles));
+  transformed_output_.Reshape(tile_elements, 1, 1,
+      std::max(group_outputs * top_tiles, group_channels * bottom_tiles));
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::TransformWeights(const bool backward) {
+  const int tile_elements = input_tile_size_ * input_tile_size_;
+  const int group_channels = this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  const int out_channels = backward ? group_channels : group_outputs;
+  const int in_channels = backward ? group_outputs : group_channels;
+  transformed_weight_.Reshape(this->group_, tile_elements, out_channels,
+                              in_channels);
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* transformed = transformed_weight_.mutable_cpu_data();
+  Dtype filter[9];
+  Dtype tile[kMaxTileSize * kMaxTileSize];
+  for (int g = 0; g < this->group_; ++g) {
+    for (int o = 0; o < group_outputs; ++o) {
+      for (int c = 0; c < group_channels; ++c) {
+        const Dtype* w = weight + ((g * group_outputs + o) * group_channels
+                                   + c) * 9;
+        for (int i = 0; i < 9; ++i) {
+          filter[i] = backward ? w[8 - i] : w[i];
+        }
+        TransformFilter(tile_size_ == 2 ? kFilterTransform2 :
+            kFilterTransform4, input_tile_size_, filter, tile);
+        const int out = backward ? c : o;
+        const int in = backward ? o : c;
+        for (int e = 0; e < tile_elements; ++e) {
+          transformed[transformed_weight_.offset(g, e, out, in)] = tile[e];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Convolve(const Dtype* input,
+    const int in_channels, const int in_height, const int in_width,
+    const int pad_h, const int pad_w, const Dtype* weight,
+    const int out_channels, const int out_height, const int out_width,
+    Dtype* output) {
+  const int m = tile_size_;
+  const int alpha = input_tile_size_;
+  const int tile_elements = alpha * alpha;
+  const int tiles_h = (out_height + m - 1) / m;
+  const int tiles_w = (out_width + m - 1) / m;
+  const int num_tiles = tiles_h * tiles_w;
+  Dtype patch[kMaxTileSize * kMaxTileSize];
+  Dtype tile[kMaxTileSize * kMaxTileSize];
+  // Transform the input tiles, which overlap by 2 rows and columns, into
+  // tile_elements matrices of in_channels x num_tiles.
+  Dtype* transformed_input = transformed_input_.mutable_cpu_data();
+  for (int c = 0; c < in_channels; ++c) {
+    const Dtype* channel = input + c * in_height * in_width;
+    for (int th = 0; th < tiles_h; ++th) {
+      for (int tw = 0; tw < tiles_w; ++tw) {
+        const int h_start = th * m - pad_h;
+        const int w_start = tw * m - pad_w;
+        if (h_start >= 0 && h_start + alpha <= in_height &&
+            w_start >= 0 && w_start + alpha <= in_width) {
+          for (int i = 0; i < alpha; ++i) {
+            const Dtype* row = channel + (h_start + i) * in_width + w_start;
+            for (int j = 0; j < alpha; ++j) {
+              patch[i * alpha + j] = row[j];
+            }
+          }
+        } else {
+          for (int i = 0; i < alpha; ++i) {
+            const int h = h_start + i;
+            for (int j = 0; j < alpha; ++j) {
+              const int w = w_start + j;
+              patch[i * alpha + j] =
+                  (h >= 0 && h < in_height && w >= 0 && w < in_width) ?
+                  channel[h * in_width + w] : Dtype(0);
+            }
+          }
+        }
+        // B^T d B: transform the columns of the patch, then its rows.
+        Dtype* out = transformed_input + c * num_tiles + th * tiles_w + tw;
+        const int out_step = in_channels * num_tiles;
+        for (int j = 0; j < alpha; ++j) {
+          if (m == 2) {
+            InputTransform2(patch + j, alpha, tile + j, alpha);
+          } else {
+            InputTransform4(patch + j, alpha, tile + j, alpha);
+          }
+        }
+        for (int i = 0; i < alpha; ++i) {
+          if (m == 2) {
+            InputTransform2(tile + i * alpha, 1, out + i * alpha * out_step,
+                            out_step);
+          } else {
+            InputTransform4(tile + i * alpha, 1, out + i * alpha * out_step,
+                            out_step);
+          }
+        }
+      }
+    }
+  }
+  // Multiply by the filters, summing over the input channels.
+  Dtype* transformed_output = transformed_output_.mutable_cpu_data();
+  for (int e = 0; e < tile_elements; ++e) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_channels, num_tiles,
+        in_channels, (Dtype)1., weight + e * out_channels * in_channels,
+        transformed_input + e * in_channels * num_tiles, (Dtype)0.,
+        transformed_output + e * out_channels * num_tiles);
+  }
+  // Transform the products back into output tiles, cut at the borders.
+  for (int o = 0; o < out_channels; ++o) {
+    Dtype* channel = output + o * out_height * out_width;
+    for (int th = 0; th < tiles_h; ++th) {
+      for (int tw = 0; tw < tiles_w; ++tw) {
+        // A^T t A: transform the columns of the product, then its rows.
+        const Dtype* in = transformed_output + o * num_tiles + th * tiles_w
+            + tw;
+        const int in_step = out_channels * num_tiles;
+        for (int j = 0; j < alpha; ++j) {
+          if (m == 2) {
+            OutputTransform2(in + j * in_step, alpha * in_step, tile + j,
+                             alpha);
+          } else {
+            OutputTransform4(in + j * in_step, alpha * in_step, tile + j,
+                             alpha);
+          }
+        }
+        for (int i = 0; i < m; ++i) {
+          if (m == 2) {
+            OutputTransform2(tile + i * alpha, 1, patch + i * m, 1);
+          } else {
+            OutputTransform4(tile + i * alpha, 1, patch + i * m, 1);
+          }
+        }
+        const int rows = std::min(m, out_height - th * m);
+        const int cols = std::min(m, out_width - tw * m);
+        for (int i = 0; i < rows; ++i) {
+          for (int j = 0; j < cols; ++j) {
+            channel[(th * m + i) * out_width + tw * m + j] = patch[i * m + j];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  if (!winograd_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  TransformWeights(false);
+  const Dtype* weight = transformed_weight_.cpu_data();
+  const int group_channels = this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      for (int g = 0; g < this->group_; ++g) {
+        Convolve(bottom_data + bottom[i]->offset(n, g * group_channels),
+            group_channels, this->height_, this->width_, this->pad_h_,
+            this->pad_w_, weight + transformed_weight_.offset(g),
+            group_outputs, this->height_out_, this->width_out_,
+            top_data + (*top)[i]->offset(n, g * group_outputs));
+      }
+      // Add bias.
+      if (this->bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->num_output_,
+            this->N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            this->bias_multiplier_.cpu_data(),
+            (Dtype)1., top_data + (*top)[i]->offset(n));
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  if (!winograd_) {
+    ConvolutionLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+    return;
+  }
+  // The gradients with respect to the filters and biases.
+  ConvolutionLayer<Dtype>::Backward_cpu(top,
+      vector<bool>(propagate_down.size(), false), bottom);
+  if (std::find(propagate_down.begin(), propagate_down.end(), true) ==
+      propagate_down.end()) {
+    return;
+  }
+  // The gradient with respect to the bottom: the top diff, padded by
+  // 2 - pad, convolved with the rotated filters.
+  TransformWeights(true);
+  const Dtype* weight = transformed_weight_.cpu_data();
+  const int group_channels = this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  for (int i = 0; i < top.size(); ++i) {
+    if (!propagate_down[i]) {
+      continue;
+    }
+    const Dtype* top_diff = top[i]->cpu_diff();
+    Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
+    for (int n = 0; n < this->num_; ++n) {
+      for (int g = 0; g < this->group_; ++g) {
+        Convolve(top_diff + top[i]->offset(n, g * group_outputs),
+            group_outputs, this->height_out_, this->width_out_,
+            this->kernel_h_ - 1 - this->pad_h_,
+            this->kernel_w_ - 1 - this->pad_w_,
+            weight + transformed_weight_.offset(g), group_channels,
+            this->height_, this->width_,
+            bottom_diff + (*bottom)[i]->offset(n, g * group_channels));
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
@@ -266,6 +266,57 @@ void Net<Dtype>::FilterNet(const NetParameter& param,
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::PruneNet(const NetParameter& param,
+    const vector<string>& blob_names, NetParameter* param_pruned) {
+  // The layer that last wrote each blob so far; net inputs have no producer.
+  map<string, int> blob_producer;
+  for (int i = 0; i < param.input_size(); ++i) {
+    blob_producer[param.input(i)] = -1;
+  }
+  // The layers that wrote the bottoms of each layer, when it ran.
+  vector<vector<int> > bottom_producers(param.layers_size());
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      CHECK(blob_producer.count(blob_name)) << "Unknown blob input "
+          << blob_name << " to layer " << layer_param.name();
+      bottom_producers[i].push_back(blob_producer[blob_name]);
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      blob_producer[layer_param.top(j)] = i;
+    }
+  }
+  // Walk the dependencies back from the last writers of the requested blobs.
+  vector<bool> layer_needed(param.layers_size(), false);
+  vector<int> layers_to_visit;
+  for (int i = 0; i < blob_names.size(); ++i) {
+    CHECK(blob_producer.count(blob_names[i])) << "Unknown blob "
+        << blob_names[i] << " in the network " << param.name();
+    layers_to_visit.push_back(blob_producer[blob_names[i]]);
+  }
+  while (!layers_to_visit.empty()) {
+    const int layer_id = layers_to_visit.back();
+    layers_to_visit.pop_back();
+    if (layer_id < 0 || layer_needed[layer_id]) {
+      continue;
+    }
+    layer_needed[layer_id] = true;
+    layers_to_visit.insert(layers_to_visit.end(),
+        bottom_producers[layer_id].begin(), bottom_producers[layer_id].end());
+  }
+  param_pruned->CopyFrom(param);
+  param_pruned->clear_layers();
+  for (int i = 0; i < param.layers_size(); ++i) {
+    if (layer_needed[i]) {
+      param_pruned->add_layers()->CopyFrom(param.layers(i));
+    } else {
+      LOG(INFO) << "Pruning layer " << param.layers(i).name();
+    }
+  }
+}
+
 template <typename Dtype>
 bool Net<Dtype>::StateMeetsRule(const NetState& state,
     const NetStateRule& rule, const string& layer_name) {
@@ -54,4 +54,21 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestSwapData) {
+  Blob<TypeParam> other(2, 3, 4, 5);
+  caffe_set(other.count(), TypeParam(7), other.mutable_cpu_data());
+  caffe_set(this->blob_preshaped_->count(), TypeParam(3),
+            this->blob_preshaped_->mutable_cpu_data());
+  const TypeParam* preshaped_data = this->blob_preshaped_->cpu_data();
+  const TypeParam* other_data = other.cpu_data();
+  this->blob_preshaped_->SwapData(&other);
+  // The buffers are exchanged, not copied.
+  EXPECT_EQ(other_data, this->blob_preshaped_->cpu_data());
+  EXPECT_EQ(preshaped_data, other.cpu_data());
+  for (int i = 0; i < other.count(); ++i) {
+    EXPECT_EQ(TypeParam(7), this->blob_preshaped_->cpu_data()[i]);
+    EXPECT_EQ(TypeParam(3), other.cpu_data()[i]);
+  }
+}
+
 }  // namespace caffe
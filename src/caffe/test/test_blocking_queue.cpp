@@ -0,0 +1,70 @@
+#include <boost/thread.hpp>
+
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class BlockingQueueTest : public ::testing::Test {};
+
+TEST_F(BlockingQueueTest, TestPushPopOrder) {
+  BlockingQueue<int> queue;
+  int value;
+  EXPECT_FALSE(queue.try_pop(&value));
+  for (int i = 0; i < 5; ++i) {
+    queue.push(i);
+  }
+  EXPECT_EQ(5, static_cast<int>(queue.size()));
+  EXPECT_TRUE(queue.try_peek(&value));
+  EXPECT_EQ(0, value);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(i, queue.pop());
+  }
+  EXPECT_EQ(0, static_cast<int>(queue.size()));
+}
+
+// Produces an increasing sequence until the queue it feeds is full, the same
+// way the prefetch thread of a data layer cycles its batches.
+class QueueProducer : public InternalThread {
+ public:
+  QueueProducer() : next_(0) {
+    for (int i = 0; i < 3; ++i) {
+      free_.push(i);
+    }
+  }
+  BlockingQueue<int> free_;
+  BlockingQueue<int> full_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+    try {
+      while (!must_stop()) {
+        free_.pop();
+        full_.push(next_++);
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+  int next_;
+};
+
+TEST_F(BlockingQueueTest, TestProducerConsumer) {
+  QueueProducer producer;
+  EXPECT_TRUE(producer.StartInternalThread());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i, producer.full_.pop());
+    producer.free_.push(0);
+  }
+  // The producer is blocked on an empty free_ queue or about to be; stopping
+  // it must interrupt the wait.
+  EXPECT_TRUE(producer.StopInternalThread());
+  EXPECT_FALSE(producer.is_started());
+}
+
+}  // namespace caffe
@@ -247,6 +247,42 @@ TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionGroup) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, Test1x1Convolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_2_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestSobelConvolution) {
   // Test separable convolution by computing the Sobel operator
   // as a single filter then comparing the result
@@ -378,6 +414,455 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestGradient1x1) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestUnrolledConvolution) {
+  // 1 MB unrolls 4 of these images at a time in float and 2 in double, so
+  // that the last chunk is a partial one.
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> bottom(7, 4, 43, 28);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  this->blob_bottom_vec_[0] = &bottom;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(4);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  convolution_param->set_col_buffer_mb(1);
+  ConvolutionLayer<Dtype> unrolled_layer(layer_param);
+  Blob<Dtype> unrolled_top;
+  vector<Blob<Dtype>*> unrolled_top_vec(1, &unrolled_top);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  unrolled_layer.SetUp(this->blob_bottom_vec_, &unrolled_top_vec);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    unrolled_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  unrolled_layer.Forward(this->blob_bottom_vec_, &unrolled_top_vec);
+  caffe_conv(&bottom, convolution_param, layer.blobs(),
+      this->MakeReferenceTop(&unrolled_top));
+  const Dtype* top_data = unrolled_top.cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < unrolled_top.count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  // The gradients match those of the layer that unrolls one image at a time.
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  filler.Fill(&unrolled_top);
+  caffe_copy(unrolled_top.count(), unrolled_top.cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  caffe_copy(unrolled_top.count(), unrolled_top.cpu_data(),
+      unrolled_top.mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_, propagate_down,
+      &(this->blob_bottom_vec_));
+  Blob<Dtype> bottom_diff;
+  bottom_diff.CopyFrom(bottom, true, true);
+  unrolled_layer.Backward(unrolled_top_vec, propagate_down,
+      &(this->blob_bottom_vec_));
+  for (int i = 0; i < bottom.count(); ++i) {
+    EXPECT_NEAR(bottom_diff.cpu_diff()[i], bottom.cpu_diff()[i], 1e-4);
+  }
+  for (int j = 0; j < layer.blobs().size(); ++j) {
+    const Blob<Dtype>& param = *layer.blobs()[j];
+    const Blob<Dtype>& unrolled_param = *unrolled_layer.blobs()[j];
+    for (int i = 0; i < param.count(); ++i) {
+      EXPECT_NEAR(param.cpu_diff()[i], unrolled_param.cpu_diff()[i], 1e-3);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestTiledConvolution) {
+  // 1 KB holds the columns of 3 output rows at a time in float and 1 in
+  // double, so that the last strip is a partial one.
+  typedef typename TypeParam::Dtype Dtype;
+  Blob<Dtype> bottom(2, 2, 10, 4);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  this->blob_bottom_vec_[0] = &bottom;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  convolution_param->set_col_tile_kb(1);
+  ConvolutionLayer<Dtype> tiled_layer(layer_param);
+  Blob<Dtype> tiled_top;
+  vector<Blob<Dtype>*> tiled_top_vec(1, &tiled_top);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  tiled_layer.SetUp(this->blob_bottom_vec_, &tiled_top_vec);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    tiled_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  tiled_layer.Forward(this->blob_bottom_vec_, &tiled_top_vec);
+  caffe_conv(&bottom, convolution_param, layer.blobs(),
+      this->MakeReferenceTop(&tiled_top));
+  const Dtype* top_data = tiled_top.cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < tiled_top.count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  // The gradients match those of the layer that does not tile.
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  filler.Fill(&tiled_top);
+  caffe_copy(tiled_top.count(), tiled_top.cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  caffe_copy(tiled_top.count(), tiled_top.cpu_data(),
+      tiled_top.mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_, propagate_down,
+      &(this->blob_bottom_vec_));
+  Blob<Dtype> bottom_diff;
+  bottom_diff.CopyFrom(bottom, true, true);
+  tiled_layer.Backward(tiled_top_vec, propagate_down,
+      &(this->blob_bottom_vec_));
+  for (int i = 0; i < bottom.count(); ++i) {
+    EXPECT_NEAR(bottom_diff.cpu_diff()[i], bottom.cpu_diff()[i], 1e-4);
+  }
+  for (int j = 0; j < layer.blobs().size(); ++j) {
+    const Blob<Dtype>& param = *layer.blobs()[j];
+    const Blob<Dtype>& tiled_param = *tiled_layer.blobs()[j];
+    for (int i = 0; i < param.count(); ++i) {
+      EXPECT_NEAR(param.cpu_diff()[i], tiled_param.cpu_diff()[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientTiled) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_col_tile_kb(1);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientUnrolled) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_col_buffer_mb(1);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+// Tests the CPU engines other than CAFFE, as picked by the layer factory.
+template <typename Dtype>
+class ConvolutionEngineTest : public ::testing::Test {
+ protected:
+  ConvolutionEngineTest(ConvolutionParameter_Engine engine, int height,
+      int width)
+      : engine_(engine),
+        blob_bottom_(new Blob<Dtype>(2, 4, height, width)),
+        blob_bottom_2_(new Blob<Dtype>(2, 4, height, width)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_2_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+
+  virtual ~ConvolutionEngineTest() {
+    delete blob_bottom_;
+    delete blob_bottom_2_;
+    delete blob_top_;
+    delete blob_top_2_;
+  }
+
+  Layer<Dtype>* MakeLayer(LayerParameter* layer_param) {
+    layer_param->set_type(LayerParameter_LayerType_CONVOLUTION);
+    layer_param->mutable_convolution_param()->set_engine(engine_);
+    return GetLayer<Dtype>(*layer_param);
+  }
+
+  // Checks the layer against the reference convolution, on two bottoms.
+  void TestConvolution(ConvolutionParameter* convolution_param) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    filler.Fill(this->blob_bottom_2_);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("constant");
+    convolution_param->mutable_bias_filler()->set_value(0.1);
+    LayerParameter layer_param;
+    *layer_param.mutable_convolution_param() = *convolution_param;
+    this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+    this->blob_top_vec_.push_back(this->blob_top_2_);
+    shared_ptr<Layer<Dtype> > layer(MakeLayer(&layer_param));
+    layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    for (int i = 0; i < 2; ++i) {
+      Blob<Dtype> ref_top;
+      ref_top.ReshapeLike(*this->blob_top_vec_[i]);
+      caffe_conv(this->blob_bottom_vec_[i], convolution_param,
+          layer->blobs(), &ref_top);
+      const Dtype* top_data = this->blob_top_vec_[i]->cpu_data();
+      const Dtype* ref_top_data = ref_top.cpu_data();
+      for (int j = 0; j < ref_top.count(); ++j) {
+        EXPECT_NEAR(top_data[j], ref_top_data[j], 1e-4);
+      }
+    }
+  }
+
+  // Checks the gradients of the layer on the bottoms, reshaped to
+  // (1, channels, height, width).
+  void TestGradient(ConvolutionParameter* convolution_param, int channels,
+      int height, int width) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int i = 0; i < this->blob_bottom_vec_.size(); ++i) {
+      this->blob_bottom_vec_[i]->Reshape(1, channels, height, width);
+      filler.Fill(this->blob_bottom_vec_[i]);
+    }
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    LayerParameter layer_param;
+    *layer_param.mutable_convolution_param() = *convolution_param;
+    shared_ptr<Layer<Dtype> > layer(MakeLayer(&layer_param));
+    // The output is linear in the bottom and in the filters, so large steps
+    // estimate the gradient exactly, and keep the rounding errors of the
+    // transforms in float from dominating the estimate.
+    GradientChecker<Dtype> checker(1, 1e-3);
+    checker.CheckGradientExhaustive(layer.get(), &(this->blob_bottom_vec_),
+        &(this->blob_top_vec_));
+  }
+
+  const ConvolutionParameter_Engine engine_;
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_2_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_2_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+template <typename Dtype>
+class WinogradConvolutionLayerTest : public ConvolutionEngineTest<Dtype> {
+ protected:
+  WinogradConvolutionLayerTest()
+      : ConvolutionEngineTest<Dtype>(ConvolutionParameter_Engine_WINOGRAD,
+                                     9, 7) {}
+};
+
+TYPED_TEST_CASE(WinogradConvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestSimpleConvolutionWinograd) {
+  // 4x4 output tiles, cut at the borders.
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(3);
+  convolution_param.set_pad(1);
+  convolution_param.set_num_output(5);
+  this->TestConvolution(&convolution_param);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestSmallOutputWinograd) {
+  // 2x2 output tiles, as the output is only 2 rows high.
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_h(3);
+  convolution_param.set_kernel_w(3);
+  convolution_param.set_pad_h(0);
+  convolution_param.set_pad_w(2);
+  convolution_param.set_num_output(3);
+  this->blob_bottom_->Reshape(2, 4, 4, 7);
+  this->blob_bottom_2_->Reshape(2, 4, 4, 7);
+  this->TestConvolution(&convolution_param);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestConvolutionGroupWinograd) {
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(3);
+  convolution_param.set_num_output(6);
+  convolution_param.set_group(2);
+  this->TestConvolution(&convolution_param);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestFallbackWinograd) {
+  // Strided convolutions run as the CAFFE engine.
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(3);
+  convolution_param.set_stride(2);
+  convolution_param.set_num_output(4);
+  this->TestConvolution(&convolution_param);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestGradientWinograd) {
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(3);
+  convolution_param.set_pad(1);
+  convolution_param.set_num_output(2);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  this->TestGradient(&convolution_param, 3, 5, 4);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestGradientGroupWinograd) {
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(3);
+  convolution_param.set_num_output(3);
+  convolution_param.set_group(3);
+  this->TestGradient(&convolution_param, 3, 6, 5);
+}
+
+template <typename Dtype>
+class FFTConvolutionLayerTest : public ConvolutionEngineTest<Dtype> {
+ protected:
+  FFTConvolutionLayerTest()
+      : ConvolutionEngineTest<Dtype>(ConvolutionParameter_Engine_FFT,
+                                     13, 11) {}
+};
+
+TYPED_TEST_CASE(FFTConvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(FFTConvolutionLayerTest, TestSimpleConvolutionFFT) {
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(5);
+  convolution_param.set_pad(2);
+  convolution_param.set_num_output(5);
+  this->TestConvolution(&convolution_param);
+}
+
+TYPED_TEST(FFTConvolutionLayerTest, TestTiledConvolutionFFT) {
+  // 16 x 16 transforms give 12 x 12 output tiles, so the 36 x 31 output takes
+  // 3 x 3 tiles, cut at the borders.
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(5);
+  convolution_param.set_num_output(3);
+  this->blob_bottom_->Reshape(2, 2, 40, 35);
+  this->blob_bottom_2_->Reshape(2, 2, 40, 35);
+  this->TestConvolution(&convolution_param);
+}
+
+TYPED_TEST(FFTConvolutionLayerTest, TestStridedConvolutionFFT) {
+  // Like conv1 of CaffeNet: 11 x 11 filters with stride 4.
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(11);
+  convolution_param.set_stride(4);
+  convolution_param.set_pad(1);
+  convolution_param.set_num_output(4);
+  this->blob_bottom_->Reshape(2, 3, 31, 27);
+  this->blob_bottom_2_->Reshape(2, 3, 31, 27);
+  this->TestConvolution(&convolution_param);
+}
+
+TYPED_TEST(FFTConvolutionLayerTest, TestRectangularConvolutionFFT) {
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_h(5);
+  convolution_param.set_kernel_w(3);
+  convolution_param.set_stride_h(2);
+  convolution_param.set_stride_w(3);
+  convolution_param.set_pad_h(1);
+  convolution_param.set_pad_w(2);
+  convolution_param.set_num_output(3);
+  this->TestConvolution(&convolution_param);
+}
+
+TYPED_TEST(FFTConvolutionLayerTest, TestConvolutionGroupFFT) {
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(5);
+  convolution_param.set_num_output(6);
+  convolution_param.set_group(2);
+  this->TestConvolution(&convolution_param);
+}
+
+#ifndef USE_CUDNN
+TYPED_TEST(FFTConvolutionLayerTest, TestDefaultEngineFFT) {
+  // The default engine is FFT from 5x5 filters up, once divided by the
+  // stride.
+  LayerParameter layer_param;
+  layer_param.set_type(LayerParameter_LayerType_CONVOLUTION);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_num_output(2);
+  convolution_param->set_kernel_size(3);
+  shared_ptr<Layer<TypeParam> > layer(GetLayer<TypeParam>(layer_param));
+  EXPECT_TRUE(dynamic_cast<FFTConvolutionLayer<TypeParam>*>(layer.get()) ==
+              NULL);
+  convolution_param->set_kernel_size(5);
+  layer.reset(GetLayer<TypeParam>(layer_param));
+  EXPECT_TRUE(dynamic_cast<FFTConvolutionLayer<TypeParam>*>(layer.get()) !=
+              NULL);
+  convolution_param->set_kernel_size(11);
+  convolution_param->set_stride(4);
+  layer.reset(GetLayer<TypeParam>(layer_param));
+  EXPECT_TRUE(dynamic_cast<FFTConvolutionLayer<TypeParam>*>(layer.get()) ==
+              NULL);
+  convolution_param->clear_kernel_size();
+  convolution_param->clear_stride();
+  convolution_param->set_kernel_h(1);
+  convolution_param->set_kernel_w(7);
+  layer.reset(GetLayer<TypeParam>(layer_param));
+  EXPECT_TRUE(dynamic_cast<FFTConvolutionLayer<TypeParam>*>(layer.get()) ==
+              NULL);
+}
+#endif
+
+TYPED_TEST(FFTConvolutionLayerTest, TestGradientFFT) {
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(5);
+  convolution_param.set_pad(1);
+  convolution_param.set_num_output(2);
+  this->TestGradient(&convolution_param, 2, 7, 6);
+}
+
+TYPED_TEST(FFTConvolutionLayerTest, TestGradientStridedFFT) {
+  ConvolutionParameter convolution_param;
+  convolution_param.set_kernel_size(5);
+  convolution_param.set_stride(2);
+  convolution_param.set_pad(2);
+  convolution_param.set_num_output(2);
+  convolution_param.set_group(2);
+  this->TestGradient(&convolution_param, 2, 9, 8);
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
@@ -9,6 +9,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/mmap_dataset.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -35,8 +36,8 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
 
   // Fill the LevelDB with data: if unique_pixels, each pixel is unique but
   // all images are the same; else each image is unique but all pixels within
-  // an image are the same.
-  void FillLevelDB(const bool unique_pixels) {
+  // an image are the same. Image i is labeled first_label + i.
+  void FillLevelDB(const bool unique_pixels, const int first_label = 0) {
     backend_ = DataParameter_DB_LEVELDB;
     LOG(INFO) << "Using temporary leveldb " << *filename_;
     leveldb::DB* db;
@@ -48,7 +49,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     CHECK(status.ok());
     for (int i = 0; i < 5; ++i) {
       Datum datum;
-      datum.set_label(i);
+      datum.set_label(first_label + i);
       datum.set_channels(2);
       datum.set_height(3);
       datum.set_width(4);
@@ -64,8 +65,9 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     delete db;
   }
 
-  // Fill the LMDB with data: unique_pixels has same meaning as in FillLevelDB.
-  void FillLMDB(const bool unique_pixels) {
+  // Fill the LMDB with data: the arguments have the same meaning as in
+  // FillLevelDB.
+  void FillLMDB(const bool unique_pixels, const int first_label = 0) {
     backend_ = DataParameter_DB_LMDB;
     LOG(INFO) << "Using temporary lmdb " << *filename_;
     CHECK_EQ(mkdir(filename_->c_str(), 0744), 0) << "mkdir " << filename_
@@ -85,7 +87,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
 
     for (int i = 0; i < 5; ++i) {
       Datum datum;
-      datum.set_label(i);
+      datum.set_label(first_label + i);
       datum.set_channels(2);
       datum.set_height(3);
       datum.set_width(4);
@@ -112,6 +114,44 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     mdb_env_close(env);
   }
 
+  // Fill a memory-mapped dataset with data: the arguments have the same
+  // meaning as in FillLevelDB.
+  void FillMMap(const bool unique_pixels, const int first_label = 0) {
+    backend_ = DataParameter_DB_MMAP;
+    LOG(INFO) << "Using temporary memory-mapped dataset " << *filename_;
+    MMapDatasetWriter writer(*filename_);
+    for (int i = 0; i < 5; ++i) {
+      Datum datum;
+      datum.set_label(first_label + i);
+      datum.set_channels(2);
+      datum.set_height(3);
+      datum.set_width(4);
+      std::string* data = datum.mutable_data();
+      for (int j = 0; j < 24; ++j) {
+        int datum = unique_pixels ? j : i;
+        data->push_back(static_cast<uint8_t>(datum));
+      }
+      writer.Write(datum);
+    }
+  }
+
+  // Fill a dataset of the backend under test.
+  void Fill(const bool unique_pixels, const int first_label = 0) {
+    switch (backend_) {
+    case DataParameter_DB_LEVELDB:
+      FillLevelDB(unique_pixels, first_label);
+      break;
+    case DataParameter_DB_LMDB:
+      FillLMDB(unique_pixels, first_label);
+      break;
+    case DataParameter_DB_MMAP:
+      FillMMap(unique_pixels, first_label);
+      break;
+    default:
+      LOG(FATAL) << "Unknown database backend";
+    }
+  }
+
   void TestRead() {
     const Dtype scale = 3;
     LayerParameter param;
@@ -147,6 +187,12 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
         }
       }
     }
+    // Setting the layer up again reopens the database in place of the first.
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+    }
   }
 
   void TestReadCrop() {
@@ -312,6 +358,137 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // The random crops of a record only depend on the record and the epoch,
+  // not on its position in the batches: read two epochs of the 5 records,
+  // then of the second of two partitions, records 1 and 3.
+  void TestReadCropTrainPartitionInvariant() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_crop_size(1);
+    transform_param->set_mirror(true);
+
+    vector<Dtype> crops[2];
+    const int batch_sizes[2] = {5, 2};
+    for (int k = 0; k < 2; ++k) {
+      Caffe::set_random_seed(seed_);
+      data_param->set_batch_size(batch_sizes[k]);
+      data_param->set_num_partitions(k + 1);
+      data_param->set_partition_id(k);
+      // The top blobs must match the size of the batches of each layer.
+      Blob<Dtype> top_data, top_label;
+      vector<Blob<Dtype>*> top_vec;
+      top_vec.push_back(&top_data);
+      top_vec.push_back(&top_label);
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, &top_vec);
+      for (int iter = 0; iter < 2; ++iter) {
+        layer.Forward(blob_bottom_vec_, &top_vec);
+        crops[k].insert(crops[k].end(), top_data.cpu_data(),
+                        top_data.cpu_data() + top_data.count());
+      }
+    }
+    for (int epoch = 0; epoch < 2; ++epoch) {
+      for (int i = 0; i < 2; ++i) {
+        const int record = 2 * i + 1;
+        for (int j = 0; j < 2; ++j) {
+          EXPECT_EQ(crops[0][(epoch * 5 + record) * 2 + j],
+                    crops[1][(epoch * 2 + i) * 2 + j])
+              << "debug: epoch " << epoch << " record " << record;
+        }
+      }
+    }
+  }
+
+  // Reads two shards labeled 0-4 and 10-14 as the second of two partitions.
+  void TestReadShards() {
+    const bool unique_pixels = false;
+    const string first_shard = *filename_;
+    Fill(unique_pixels);
+    MakeTempDir(filename_.get());
+    *filename_ += "/db";
+    Fill(unique_pixels, 10);
+
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(first_shard);
+    data_param->add_shard_source(*filename_);
+    data_param->set_backend(backend_);
+    data_param->set_num_partitions(2);
+    data_param->set_partition_id(1);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 5);
+
+    // The partition holds records 1 and 3 of each shard; the records of the
+    // shards alternate, also across batch boundaries.
+    int record = 0;
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i, ++record) {
+        const int shard = record % 2;
+        const int index = ((record / 2) % 2) * 2 + 1;
+        EXPECT_EQ(shard * 10 + index, blob_top_label_->cpu_data()[i])
+            << "debug: iter " << iter << " i " << i;
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(index, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  void TestReadShuffle() {
+    Caffe::set_random_seed(seed_);
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle(true);
+    data_param->set_shuffle_block_size(2);
+    data_param->set_shuffle_window(2);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+
+    // Every batch is one epoch, so it holds each record exactly once.
+    int num_in_order = 0;
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      vector<int> count(5, 0);
+      bool in_order = true;
+      for (int i = 0; i < 5; ++i) {
+        const int label = static_cast<int>(blob_top_label_->cpu_data()[i]);
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, 5);
+        ++count[label];
+        in_order = in_order && (label == i);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+      for (int label = 0; label < 5; ++label) {
+        EXPECT_EQ(1, count[label]) << "debug: iter " << iter;
+      }
+      num_in_order += in_order;
+    }
+    // The order changes from epoch to epoch. The 5 records make 3 blocks of
+    // shuffle_block_size 2, left in order with probability 1/6, and the
+    // windows of 2 lie within the blocks, each left in order with probability
+    // 1/2: an epoch is in order with probability 1/6 * 1/4 = 1/24, and this
+    // fails with probability (1/24)^10 in a correct implementation, so we set
+    // the random seed.
+    EXPECT_LT(num_in_order, 10);
+  }
+
   virtual ~DataLayerTest() { delete blob_top_data_; delete blob_top_label_; }
 
   DataParameter_DB backend_;
@@ -347,6 +524,13 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCropTrainPartitionInvariantLevelDB) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadCropTrainPartitionInvariant();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
@@ -363,6 +547,17 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLevelDB) {
   this->TestReadCrop();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShardsLevelDB) {
+  this->backend_ = DataParameter_DB_LEVELDB;
+  this->TestReadShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadShuffle();
+}
+
 TYPED_TEST(DataLayerTest, TestReadLMDB) {
   const bool unique_pixels = false;  // all pixels the same; images different
   this->FillLMDB(unique_pixels);
@@ -385,6 +580,13 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCropTrainPartitionInvariantLMDB) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLMDB(unique_pixels);
+  this->TestReadCropTrainPartitionInvariant();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
@@ -401,4 +603,46 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
   this->TestReadCrop();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShardsLMDB) {
+  this->backend_ = DataParameter_DB_LMDB;
+  this->TestReadShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadShuffle();
+}
+
+TYPED_TEST(DataLayerTest, TestReadMMap) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillMMap(unique_pixels);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTrainMMap) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillMMap(unique_pixels);
+  this->TestReadCrop();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTrainPartitionInvariantMMap) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillMMap(unique_pixels);
+  this->TestReadCropTrainPartitionInvariant();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsMMap) {
+  this->backend_ = DataParameter_DB_MMAP;
+  this->TestReadShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleMMap) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillMMap(unique_pixels);
+  this->TestReadShuffle();
+}
+
 }  // namespace caffe
@@ -0,0 +1,157 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/float_codec.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class DataTransformerTest : public ::testing::Test {
+ protected:
+  DataTransformerTest() : channels_(3), height_(21), width_(37) {}
+
+  virtual void SetUp() {
+    Caffe::set_phase(Caffe::TRAIN);
+    datum_.set_channels(channels_);
+    datum_.set_height(height_);
+    datum_.set_width(width_);
+    string* data = datum_.mutable_data();
+    for (int j = 0; j < channels_ * height_ * width_; ++j) {
+      data->push_back(static_cast<uint8_t>(j * 7));
+    }
+  }
+
+  Dtype Pixel(const int c, const int h, const int w) const {
+    return static_cast<uint8_t>(datum_.data()[(c * height_ + h) * width_ + w]);
+  }
+
+  Datum datum_;
+  const int channels_;
+  const int height_;
+  const int width_;
+};
+
+TYPED_TEST_CASE(DataTransformerTest, TestDtypes);
+
+TYPED_TEST(DataTransformerTest, TestMeanFile) {
+  const int size = this->channels_ * this->height_ * this->width_;
+  TransformationParameter param;
+  param.set_scale(0.5);
+  param.set_mean_file("mean.binaryproto");
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  vector<TypeParam> mean(size);
+  for (int j = 0; j < size; ++j) {
+    mean[j] = j % 13;
+  }
+  vector<TypeParam> transformed(2 * size);
+  transformer.Transform(1, this->datum_, &mean[0], &transformed[0]);
+  for (int j = 0; j < size; ++j) {
+    const TypeParam pixel = static_cast<uint8_t>(this->datum_.data()[j]);
+    EXPECT_EQ((pixel - mean[j]) * TypeParam(0.5), transformed[size + j]);
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestMeanValue) {
+  TransformationParameter param;
+  param.add_mean_value(10);
+  param.add_mean_value(20);
+  param.add_mean_value(30);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  vector<TypeParam> transformed(
+      this->channels_ * this->height_ * this->width_);
+  // The mean image is ignored without a mean_file.
+  transformer.Transform(0, this->datum_, NULL, &transformed[0]);
+  for (int c = 0; c < this->channels_; ++c) {
+    for (int h = 0; h < this->height_; ++h) {
+      for (int w = 0; w < this->width_; ++w) {
+        EXPECT_EQ(this->Pixel(c, h, w) - 10 * (c + 1),
+            transformed[(c * this->height_ + h) * this->width_ + w]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestCropMirror) {
+  // Crop one pixel less than the image, so only the crop offsets in [0, 1]
+  // and the mirroring are random.
+  const int crop_size = this->height_ - 1;
+  TransformationParameter param;
+  param.set_crop_size(crop_size);
+  param.set_mirror(true);
+  param.add_mean_value(1);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  vector<TypeParam> transformed(this->channels_ * crop_size * crop_size);
+  int num_mirrored = 0;
+  for (int seed = 0; seed < 20; ++seed) {
+    Philox rng = transformer.ItemRand(0, seed);
+    transformer.Transform(0, this->datum_, NULL, &transformed[0], &rng);
+    // Find which of the possible crops was taken.
+    bool found = false;
+    for (int h_off = 0; h_off < 2 && !found; ++h_off) {
+      for (int w_off = 0; w_off < this->width_ - crop_size && !found;
+           ++w_off) {
+        for (int mirror = 0; mirror < 2 && !found; ++mirror) {
+          bool match = true;
+          for (int c = 0; c < this->channels_; ++c) {
+            for (int h = 0; h < crop_size; ++h) {
+              for (int w = 0; w < crop_size; ++w) {
+                const int top_w = mirror ? crop_size - 1 - w : w;
+                match = match && (this->Pixel(c, h + h_off, w + w_off) - 1 ==
+                    transformed[(c * crop_size + h) * crop_size + top_w]);
+              }
+            }
+          }
+          if (match) {
+            found = true;
+            num_mirrored += mirror;
+          }
+        }
+      }
+    }
+    EXPECT_TRUE(found) << "seed " << seed;
+  }
+  EXPECT_GT(num_mirrored, 0);
+  EXPECT_LT(num_mirrored, 20);
+}
+
+TYPED_TEST(DataTransformerTest, TestCompactFloatData) {
+  const int size = this->channels_ * this->height_ * this->width_;
+  vector<float> values(size);
+  for (int j = 0; j < size; ++j) {
+    values[j] = (j % 101) * 0.25f - 10;
+  }
+  TransformationParameter param;
+  param.set_scale(2);
+  param.add_mean_value(1);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  vector<TypeParam> transformed(2 * size);
+  Datum datum;
+  datum.set_channels(this->channels_);
+  datum.set_height(this->height_);
+  datum.set_width(this->width_);
+  // The values are multiples of 1/4 that half floats represent exactly.
+  SetHalfData(&values[0], size, &datum);
+  transformer.Transform(1, datum, NULL, &transformed[0]);
+  for (int j = 0; j < size; ++j) {
+    EXPECT_EQ((values[j] - 1) * 2, transformed[size + j]);
+  }
+  SetQuantizedData(&values[0], size, &datum);
+  transformer.Transform(0, datum, NULL, &transformed[0]);
+  for (int j = 0; j < size; ++j) {
+    EXPECT_NEAR((values[j] - 1) * 2, transformed[j],
+                datum.quantized_scale() + 1e-4);
+  }
+}
+
+}  // namespace caffe
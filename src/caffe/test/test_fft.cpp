@@ -0,0 +1,100 @@
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/fft.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class RealFFT2DTest : public ::testing::Test {
+ protected:
+  // Checks the transform of a random height x width image against the
+  // definition of the DFT, and that Inverse recovers the image.
+  void TestTransform(const int height, const int width) {
+    Blob<Dtype> image(1, 1, height, width);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&image);
+    const Dtype* in = image.cpu_data();
+    RealFFT2D<Dtype> fft(height, width);
+    const int columns = width / 2 + 1;
+    EXPECT_EQ(height * columns, fft.spectrum_size());
+    vector<std::complex<Dtype> > spectrum(fft.spectrum_size());
+    fft.Forward(in, &spectrum[0]);
+    for (int k = 0; k < height; ++k) {
+      for (int l = 0; l < columns; ++l) {
+        std::complex<double> expected(0, 0);
+        for (int y = 0; y < height; ++y) {
+          for (int x = 0; x < width; ++x) {
+            const double angle = -2 * M_PI *
+                (static_cast<double>(k * y) / height +
+                 static_cast<double>(l * x) / width);
+            expected += static_cast<double>(in[y * width + x]) *
+                std::complex<double>(cos(angle), sin(angle));
+          }
+        }
+        const std::complex<Dtype> actual = spectrum[k * columns + l];
+        EXPECT_NEAR(expected.real(), actual.real(), 1e-3)
+            << "debug: k " << k << " l " << l;
+        EXPECT_NEAR(expected.imag(), actual.imag(), 1e-3)
+            << "debug: k " << k << " l " << l;
+      }
+    }
+    vector<Dtype> recovered(height * width);
+    fft.Inverse(&spectrum[0], &recovered[0]);
+    for (int i = 0; i < height * width; ++i) {
+      EXPECT_NEAR(in[i], recovered[i], 1e-4);
+    }
+  }
+};
+
+TYPED_TEST_CASE(RealFFT2DTest, TestDtypes);
+
+TYPED_TEST(RealFFT2DTest, TestSquare) {
+  this->TestTransform(8, 8);
+}
+
+TYPED_TEST(RealFFT2DTest, TestRectangular) {
+  this->TestTransform(4, 16);
+  this->TestTransform(16, 4);
+}
+
+TYPED_TEST(RealFFT2DTest, TestLeadingRows) {
+  // Transforming the first rows only is transforming the image with its
+  // other rows cleared.
+  const int height = 8;
+  const int width = 4;
+  const int rows = 3;
+  Blob<TypeParam> image(1, 1, height, width);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&image);
+  RealFFT2D<TypeParam> fft(height, width);
+  vector<std::complex<TypeParam> > spectrum(fft.spectrum_size());
+  fft.Forward(image.cpu_data(), &spectrum[0], rows);
+  TypeParam* data = image.mutable_cpu_data();
+  for (int i = rows * width; i < height * width; ++i) {
+    data[i] = 0;
+  }
+  vector<std::complex<TypeParam> > expected(fft.spectrum_size());
+  fft.Forward(image.cpu_data(), &expected[0]);
+  for (int i = 0; i < fft.spectrum_size(); ++i) {
+    EXPECT_NEAR(expected[i].real(), spectrum[i].real(), 1e-5);
+    EXPECT_NEAR(expected[i].imag(), spectrum[i].imag(), 1e-5);
+  }
+}
+
+TYPED_TEST(RealFFT2DTest, TestSmallest) {
+  this->TestTransform(1, 2);
+  this->TestTransform(2, 2);
+}
+
+}  // namespace caffe
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/float_codec.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FloatCodecTest : public ::testing::Test {};
+
+TEST_F(FloatCodecTest, TestHalfExactValues) {
+  // Values representable in half precision, subnormals included.
+  const float values[] = {0, -0.f, 1, -2.5, 0.333251953125f, 65504,
+      std::ldexp(1.f, -14), std::ldexp(1.f, -24), -std::ldexp(3.f, -24)};
+  for (int i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    EXPECT_EQ(values[i], HalfToFloat(FloatToHalf(values[i])));
+  }
+  EXPECT_EQ(0x3c00, FloatToHalf(1));
+  EXPECT_EQ(0xc000, FloatToHalf(-2));
+  EXPECT_EQ(0x0001, FloatToHalf(std::ldexp(1.f, -24)));
+}
+
+TEST_F(FloatCodecTest, TestHalfRounding) {
+  // Halfway between 1 and the next half, 1 + 2^-10: rounds to even.
+  EXPECT_EQ(0x3c00, FloatToHalf(1 + std::ldexp(1.f, -11)));
+  EXPECT_EQ(0x3c02, FloatToHalf(1 + 3 * std::ldexp(1.f, -11)));
+  // Beyond the largest half.
+  const float infinity = std::numeric_limits<float>::infinity();
+  EXPECT_EQ(0x7c00, FloatToHalf(65520));
+  EXPECT_EQ(infinity, HalfToFloat(FloatToHalf(1e10)));
+  EXPECT_EQ(-infinity, HalfToFloat(FloatToHalf(-infinity)));
+  const float nan = HalfToFloat(FloatToHalf(
+      std::numeric_limits<float>::quiet_NaN()));
+  EXPECT_NE(nan, nan);
+  // Below half the smallest subnormal.
+  EXPECT_EQ(0, HalfToFloat(FloatToHalf(std::ldexp(1.f, -26))));
+}
+
+TEST_F(FloatCodecTest, TestDecodeHalf) {
+  // More values than a vector register holds, so that both the vectorized
+  // loop and the scalar tail are used.
+  const int count = 53;
+  vector<float> values(count);
+  for (int i = 0; i < count; ++i) {
+    values[i] = (i - 20) * 0.37f;
+  }
+  values[7] = std::numeric_limits<float>::infinity();
+  values[11] = std::ldexp(5.f, -24);
+  vector<uint8_t> encoded(2 * count);
+  EncodeHalf(&values[0], count, &encoded[0]);
+  vector<float> decoded(count);
+  DecodeHalf(&encoded[0], count, &decoded[0]);
+  vector<double> decoded_double(count);
+  DecodeHalf(&encoded[0], count, &decoded_double[0]);
+  for (int i = 0; i < count; ++i) {
+    const uint16_t half = encoded[2 * i] | encoded[2 * i + 1] << 8;
+    EXPECT_EQ(FloatToHalf(values[i]), half);
+    EXPECT_EQ(HalfToFloat(half), decoded[i]);
+    EXPECT_EQ(HalfToFloat(half), decoded_double[i]);
+    if (i != 7) {
+      EXPECT_NEAR(values[i], decoded[i], std::fabs(values[i]) / 1024);
+    }
+  }
+}
+
+TEST_F(FloatCodecTest, TestQuantized) {
+  const int count = 37;
+  vector<float> values(count);
+  for (int i = 0; i < count; ++i) {
+    values[i] = std::sin(i * 0.5f) * 3 + 1;
+  }
+  vector<uint8_t> codes(count);
+  float scale, offset;
+  EncodeQuantized(&values[0], count, &codes[0], &scale, &offset);
+  const float min_value = *std::min_element(values.begin(), values.end());
+  const float max_value = *std::max_element(values.begin(), values.end());
+  EXPECT_EQ(min_value, offset);
+  EXPECT_FLOAT_EQ((max_value - min_value) / 255, scale);
+  vector<float> decoded(count);
+  DecodeQuantized(&codes[0], count, scale, offset, &decoded[0]);
+  vector<double> decoded_double(count);
+  DecodeQuantized(&codes[0], count, scale, offset, &decoded_double[0]);
+  for (int i = 0; i < count; ++i) {
+    EXPECT_NEAR(values[i], decoded[i], scale / 2 + 1e-5);
+    EXPECT_FLOAT_EQ(decoded[i], decoded_double[i]);
+  }
+}
+
+TEST_F(FloatCodecTest, TestQuantizedConstant) {
+  const vector<float> values(5, 4.25);
+  vector<uint8_t> codes(5);
+  float scale, offset;
+  EncodeQuantized(&values[0], 5, &codes[0], &scale, &offset);
+  EXPECT_EQ(0, scale);
+  vector<float> decoded(5);
+  DecodeQuantized(&codes[0], 5, scale, offset, &decoded[0]);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(4.25, decoded[i]);
+  }
+}
+
+TEST_F(FloatCodecTest, TestSetDatumData) {
+  const float values[] = {1, 2, 3};
+  Datum datum;
+  datum.add_float_data(7);
+  SetHalfData(values, 3, &datum);
+  EXPECT_EQ(0, datum.float_data_size());
+  EXPECT_EQ(6, datum.half_data().size());
+  SetQuantizedData(values, 3, &datum);
+  EXPECT_TRUE(datum.half_data().empty());
+  EXPECT_EQ(3, datum.quantized_data().size());
+  EXPECT_FLOAT_EQ(1, datum.quantized_offset());
+  EXPECT_FLOAT_EQ(2.f / 255, datum.quantized_scale());
+}
+
+}  // namespace caffe
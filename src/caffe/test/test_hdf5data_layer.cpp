@@ -121,4 +121,52 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestReadShuffle) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The two files of 10 rows (see TestRead) are read in a random order, and
+  // so are the rows of each file; every epoch still covers every row once.
+  LayerParameter param;
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  const int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_shuffle(true);
+  const int num_rows = 10;
+  const int data_size = 8 * 6 * 5;
+  const int file_size = 2400;
+
+  Caffe::set_random_seed(1701);
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  bool in_order = true;
+  for (int epoch = 0; epoch < 2; ++epoch) {
+    vector<int> seen(2 * num_rows, 0);
+    int previous_row = -1;
+    for (int iter = 0; iter < 2 * num_rows / batch_size; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+      const Dtype* data = this->blob_top_data_->cpu_data();
+      const Dtype* label = this->blob_top_label_->cpu_data();
+      for (int i = 0; i < batch_size; ++i) {
+        // NB: label is 1-indexed
+        const int row = static_cast<int>(label[i]) - 1;
+        ASSERT_GE(row, 0);
+        ASSERT_LT(row, num_rows);
+        const int file = data[i * data_size] < file_size ? 0 : 1;
+        const int offset = file * file_size + row * data_size;
+        for (int j = 0; j < data_size; ++j) {
+          EXPECT_EQ(offset + j, data[i * data_size + j]);
+        }
+        ++seen[file * num_rows + row];
+        const int global_row = file * num_rows + row;
+        in_order &= global_row == previous_row + 1;
+        previous_row = global_row;
+      }
+    }
+    for (int i = 0; i < seen.size(); ++i) {
+      EXPECT_EQ(1, seen[i]) << "row " << i << " in epoch " << epoch;
+    }
+  }
+  EXPECT_FALSE(in_order);
+}
+
 }  // namespace caffe
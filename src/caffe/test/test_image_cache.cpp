@@ -0,0 +1,81 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {
+ protected:
+  // An image of size bytes, with a one character key.
+  static shared_ptr<const Datum> MakeImage(int size, int label) {
+    shared_ptr<Datum> datum(new Datum());
+    datum->set_channels(1);
+    datum->set_height(1);
+    datum->set_width(size);
+    datum->set_data(string(size, 0));
+    datum->set_label(label);
+    return datum;
+  }
+  // Looks the key up, which also marks it as used.
+  static bool Contains(ImageCache* cache, const string& key) {
+    return cache->Lookup(key).get() != NULL;
+  }
+};
+
+TEST_F(ImageCacheTest, TestLookup) {
+  ImageCache cache(100);
+  EXPECT_FALSE(Contains(&cache, "a"));
+  shared_ptr<const Datum> image = MakeImage(9, 1);
+  cache.Insert("a", image);
+  EXPECT_EQ(image, cache.Lookup("a"));
+  EXPECT_FALSE(Contains(&cache, "b"));
+  EXPECT_EQ(1, cache.num_images());
+  EXPECT_EQ(10, cache.size());
+}
+
+TEST_F(ImageCacheTest, TestEvictLeastRecentlyUsed) {
+  ImageCache cache(30);
+  cache.Insert("a", MakeImage(9, 0));
+  cache.Insert("b", MakeImage(9, 1));
+  cache.Insert("c", MakeImage(9, 2));
+  EXPECT_EQ(30, cache.size());
+  // Using a makes b the least recently used image.
+  EXPECT_TRUE(Contains(&cache, "a"));
+  shared_ptr<const Datum> b = cache.Lookup("b");
+  EXPECT_TRUE(Contains(&cache, "a"));
+  cache.Insert("d", MakeImage(9, 3));
+  EXPECT_FALSE(Contains(&cache, "c"));
+  EXPECT_TRUE(Contains(&cache, "a"));
+  EXPECT_TRUE(Contains(&cache, "b"));
+  EXPECT_TRUE(Contains(&cache, "d"));
+  // A large image evicts as many as needed.
+  cache.Insert("e", MakeImage(19, 4));
+  EXPECT_EQ(2, cache.num_images());
+  EXPECT_TRUE(Contains(&cache, "e"));
+  EXPECT_TRUE(Contains(&cache, "d"));
+  EXPECT_LE(cache.size(), cache.capacity());
+  // An evicted image stays valid for its holders.
+  EXPECT_EQ(1, b->label());
+}
+
+TEST_F(ImageCacheTest, TestTooLarge) {
+  ImageCache cache(10);
+  cache.Insert("a", MakeImage(9, 0));
+  cache.Insert("b", MakeImage(10, 1));
+  EXPECT_FALSE(Contains(&cache, "b"));
+  EXPECT_TRUE(Contains(&cache, "a"));
+  cache.Reserve(5);
+  EXPECT_EQ(10, cache.capacity());
+  cache.Reserve(11);
+  cache.Insert("b", MakeImage(10, 1));
+  EXPECT_TRUE(Contains(&cache, "b"));
+  EXPECT_FALSE(Contains(&cache, "a"));
+}
+
+}  // namespace caffe
@@ -8,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/vision_layers.hpp"
 
@@ -141,4 +142,35 @@ TYPED_TEST(ImageDataLayerTest, TestShuffle) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestCache) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_new_height(256);
+  image_data_param->set_new_width(256);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  Blob<Dtype> expected_data;
+  expected_data.CopyFrom(*this->blob_top_data_, false, true);
+
+  // The cached images must give the same batches, epoch after epoch.
+  image_data_param->set_cache_size(16);
+  ImageDataLayer<Dtype> cached_layer(param);
+  cached_layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  for (int iter = 0; iter < 2; ++iter) {
+    cached_layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+    }
+    for (int i = 0; i < expected_data.count(); ++i) {
+      EXPECT_EQ(expected_data.cpu_data()[i],
+                this->blob_top_data_->cpu_data()[i]);
+    }
+  }
+  EXPECT_EQ(1, ImageCache::Get().num_images());
+}
+
 }  // namespace caffe
@@ -0,0 +1,132 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class IOTest : public ::testing::Test {};
+
+TEST_F(IOTest, TestParseDatumView) {
+  Datum datum;
+  datum.set_channels(2);
+  datum.set_height(3);
+  datum.set_width(4);
+  datum.set_label(-7);
+  string data(24, 0);
+  for (int i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 10);
+  }
+  datum.set_data(data);
+  string record;
+  datum.SerializeToString(&record);
+
+  DatumView view;
+  EXPECT_TRUE(ParseDatumView(record.data(), record.size(), &view));
+  EXPECT_EQ(2, view.channels);
+  EXPECT_EQ(3, view.height);
+  EXPECT_EQ(4, view.width);
+  EXPECT_EQ(-7, view.label);
+  EXPECT_EQ(24, view.data_size);
+  // The pixels are read in place, not copied.
+  const uint8_t* begin = reinterpret_cast<const uint8_t*>(record.data());
+  EXPECT_GE(view.data, begin);
+  EXPECT_LE(view.data + view.data_size, begin + record.size());
+  for (int i = 0; i < view.data_size; ++i) {
+    EXPECT_EQ(static_cast<uint8_t>(i * 10), view.data[i]);
+  }
+}
+
+TEST_F(IOTest, TestParseDatumViewRejectsFloatData) {
+  Datum datum;
+  datum.set_channels(1);
+  datum.set_height(1);
+  datum.set_width(2);
+  datum.add_float_data(1.5);
+  datum.add_float_data(2.5);
+  string record;
+  datum.SerializeToString(&record);
+  DatumView view;
+  EXPECT_FALSE(ParseDatumView(record.data(), record.size(), &view));
+}
+
+TEST_F(IOTest, TestParseDatumViewQuantizedData) {
+  Datum datum;
+  datum.set_channels(1);
+  datum.set_height(1);
+  datum.set_width(3);
+  datum.set_quantized_data(string("\x00\x80\xff", 3));
+  datum.set_quantized_scale(0.5);
+  datum.set_quantized_offset(-3);
+  string record;
+  datum.SerializeToString(&record);
+  DatumView view;
+  EXPECT_TRUE(ParseDatumView(record.data(), record.size(), &view));
+  EXPECT_TRUE(view.data == NULL);
+  EXPECT_TRUE(view.half_data == NULL);
+  EXPECT_EQ(3, view.data_size);
+  EXPECT_EQ(0.5, view.quantized_scale);
+  EXPECT_EQ(-3, view.quantized_offset);
+  ASSERT_TRUE(view.quantized_data != NULL);
+  EXPECT_EQ(0x80, view.quantized_data[1]);
+}
+
+TEST_F(IOTest, TestParseDatumViewRejectsTruncatedRecord) {
+  Datum datum;
+  datum.set_channels(1);
+  datum.set_height(2);
+  datum.set_width(2);
+  datum.set_data(string(4, 1));
+  string record;
+  datum.SerializeToString(&record);
+  DatumView view;
+  EXPECT_FALSE(ParseDatumView(record.data(), record.size() - 1, &view));
+}
+
+TEST_F(IOTest, TestParseDatumViewRejectsEncoded) {
+  Datum datum;
+  ASSERT_TRUE(ReadImageToEncodedDatum(EXAMPLES_SOURCE_DIR "images/cat.jpg",
+                                      0, 0, 0, true, &datum));
+  string record;
+  datum.SerializeToString(&record);
+  DatumView view;
+  EXPECT_FALSE(ParseDatumView(record.data(), record.size(), &view));
+}
+
+TEST_F(IOTest, TestDecodeDatum) {
+  const string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  for (int is_color = 0; is_color < 2; ++is_color) {
+    Datum datum;
+    ASSERT_TRUE(ReadImageToDatum(filename, 5, 0, 0, is_color, &datum));
+    Datum encoded_datum;
+    ASSERT_TRUE(ReadImageToEncodedDatum(filename, 5, 0, 0, is_color,
+                                        &encoded_datum));
+    EXPECT_TRUE(encoded_datum.encoded());
+    EXPECT_EQ(datum.channels(), encoded_datum.channels());
+    EXPECT_EQ(datum.height(), encoded_datum.height());
+    EXPECT_EQ(datum.width(), encoded_datum.width());
+    EXPECT_LT(encoded_datum.data().size(), datum.data().size());
+    EXPECT_TRUE(DecodeDatum(&encoded_datum));
+    EXPECT_FALSE(encoded_datum.encoded());
+    EXPECT_EQ(5, encoded_datum.label());
+    EXPECT_TRUE(datum.data() == encoded_datum.data());
+  }
+}
+
+TEST_F(IOTest, TestDecodeResizedDatum) {
+  Datum datum;
+  ASSERT_TRUE(ReadImageToEncodedDatum(EXAMPLES_SOURCE_DIR "images/cat.jpg",
+                                      0, 100, 200, true, &datum));
+  EXPECT_TRUE(DecodeDatum(&datum));
+  EXPECT_EQ(3, datum.channels());
+  EXPECT_EQ(100, datum.height());
+  EXPECT_EQ(200, datum.width());
+  EXPECT_EQ(3 * 100 * 200, static_cast<int>(datum.data().size()));
+}
+
+}  // namespace caffe
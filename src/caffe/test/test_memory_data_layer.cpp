@@ -1,6 +1,8 @@
 #include <string>
 #include <vector>
 
+#include "boost/thread.hpp"
+
 #include "caffe/data_layers.hpp"
 #include "caffe/filler.hpp"
 
@@ -111,6 +113,106 @@ TYPED_TEST(MemoryDataLayerTest, TestForward) {
   }
 }
 
+// Pushes the batches of data and labels in order; run by a producer thread.
+template <typename Dtype>
+void PushBatches(MemoryDataLayer<Dtype>* layer, const Blob<Dtype>* data,
+    const Blob<Dtype>* labels, const int batches) {
+  const int batch_size = layer->batch_size();
+  for (int i = 0; i < batches; ++i) {
+    layer->PushBatch(data->cpu_data() + data->offset(batch_size * i),
+                     labels->cpu_data() + batch_size * i);
+  }
+}
+
+TYPED_TEST(MemoryDataLayerTest, TestPushBatch) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter layer_param;
+  MemoryDataParameter* md_param = layer_param.mutable_memory_data_param();
+  md_param->set_batch_size(this->batch_size_);
+  md_param->set_channels(this->channels_);
+  md_param->set_height(this->height_);
+  md_param->set_width(this->width_);
+  md_param->set_queue_depth(2);
+  MemoryDataLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  // The producer gets ahead of Forward by up to queue_depth batches.
+  boost::thread producer(&PushBatches<Dtype>, &layer, this->data_,
+                         this->labels_, this->batches_);
+  for (int i = 0; i < this->batches_; ++i) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int j = 0; j < this->data_blob_->count(); ++j) {
+      EXPECT_EQ(this->data_blob_->cpu_data()[j],
+          this->data_->cpu_data()[
+              this->data_->offset(1) * this->batch_size_ * i + j]);
+    }
+    for (int j = 0; j < this->label_blob_->count(); ++j) {
+      EXPECT_EQ(this->label_blob_->cpu_data()[j],
+          this->labels_->cpu_data()[this->batch_size_ * i + j]);
+    }
+  }
+  producer.join();
+  EXPECT_EQ(0, layer.queued_batches());
+}
+
+TYPED_TEST(MemoryDataLayerTest, TestPushBatchNonBlocking) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter layer_param;
+  MemoryDataParameter* md_param = layer_param.mutable_memory_data_param();
+  md_param->set_batch_size(this->batch_size_);
+  md_param->set_channels(this->channels_);
+  md_param->set_height(this->height_);
+  md_param->set_width(this->width_);
+  md_param->set_queue_depth(2);
+  MemoryDataLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  const Dtype* data = this->data_->cpu_data();
+  const Dtype* labels = this->labels_->cpu_data();
+  const int batch_count = this->data_->offset(this->batch_size_);
+  EXPECT_TRUE(layer.PushBatch(data, labels, false));
+  EXPECT_TRUE(layer.PushBatch(data + batch_count, labels + this->batch_size_,
+                              false));
+  // The backlog is full until Forward consumes a batch.
+  EXPECT_FALSE(layer.PushBatch(data, labels, false));
+  EXPECT_EQ(2, layer.queued_batches());
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(labels[0], this->label_blob_->cpu_data()[0]);
+  EXPECT_TRUE(layer.PushBatch(data, labels, false));
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(labels[this->batch_size_], this->label_blob_->cpu_data()[0]);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(labels[0], this->label_blob_->cpu_data()[0]);
+  EXPECT_EQ(0, layer.queued_batches());
+}
+
+TYPED_TEST(MemoryDataLayerTest, TestSetUpAgain) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter layer_param;
+  MemoryDataParameter* md_param = layer_param.mutable_memory_data_param();
+  md_param->set_batch_size(this->batch_size_);
+  md_param->set_channels(this->channels_);
+  md_param->set_height(this->height_);
+  md_param->set_width(this->width_);
+  md_param->set_queue_depth(2);
+  MemoryDataLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  const Dtype* data = this->data_->cpu_data();
+  const Dtype* labels = this->labels_->cpu_data();
+  const int batch_count = this->data_->offset(this->batch_size_);
+  EXPECT_TRUE(layer.PushBatch(data, labels, false));
+  // A new SetUp drops the queued batch, and frees its buffer for producers.
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(0, layer.queued_batches());
+  EXPECT_TRUE(layer.PushBatch(data + batch_count, labels + this->batch_size_,
+                              false));
+  EXPECT_TRUE(layer.PushBatch(data, labels, false));
+  EXPECT_FALSE(layer.PushBatch(data, labels, false));
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(labels[this->batch_size_], this->label_blob_->cpu_data()[0]);
+}
+
 TYPED_TEST(MemoryDataLayerTest, AddDatumVectorDefaultTransform) {
   typedef typename TypeParam::Dtype Dtype;
 
@@ -164,4 +266,50 @@ TYPED_TEST(MemoryDataLayerTest, AddDatumVectorDefaultTransform) {
   }
 }
 
+TYPED_TEST(MemoryDataLayerTest, TestPushDatumVector) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter param;
+  MemoryDataParameter* memory_data_param = param.mutable_memory_data_param();
+  memory_data_param->set_batch_size(this->batch_size_);
+  memory_data_param->set_channels(this->channels_);
+  memory_data_param->set_height(this->height_);
+  memory_data_param->set_width(this->width_);
+  param.mutable_transform_param()->set_scale(0.5);
+  MemoryDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+
+  const int count = this->channels_ * this->height_ * this->width_;
+  vector<vector<Datum> > datum_vectors(3);
+  for (int iter = 0; iter < datum_vectors.size(); ++iter) {
+    datum_vectors[iter].resize(this->batch_size_);
+    for (int i = 0; i < this->batch_size_; ++i) {
+      Datum* datum = &datum_vectors[iter][i];
+      datum->set_channels(this->channels_);
+      datum->set_height(this->height_);
+      datum->set_width(this->width_);
+      datum->set_label(iter * this->batch_size_ + i);
+      string pixels(count, 0);
+      for (int j = 0; j < count; ++j) {
+        pixels[j] = (iter + i + j) % 256;
+      }
+      datum->set_data(pixels);
+    }
+    EXPECT_TRUE(layer.PushDatumVector(datum_vectors[iter]));
+  }
+  for (int iter = 0; iter < datum_vectors.size(); ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    const Dtype* data = this->data_blob_->cpu_data();
+    for (int i = 0; i < this->batch_size_; ++i) {
+      EXPECT_EQ(iter * this->batch_size_ + i,
+                this->label_blob_->cpu_data()[i]);
+      const string& pixels = datum_vectors[iter][i].data();
+      for (int j = 0; j < count; ++j) {
+        EXPECT_EQ(Dtype(0.5) * static_cast<uint8_t>(pixels[j]),
+                  data[i * count + j]);
+      }
+    }
+  }
+}
+
 }  // namespace caffe
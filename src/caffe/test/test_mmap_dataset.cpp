@@ -0,0 +1,86 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mmap_dataset.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MMapDatasetTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+  }
+
+  string filename_;
+};
+
+TEST_F(MMapDatasetTest, TestUint8RoundTrip) {
+  {
+    MMapDatasetWriter writer(filename_);
+    for (int i = 0; i < 7; ++i) {
+      Datum datum;
+      datum.set_channels(2);
+      datum.set_height(3);
+      datum.set_width(5);
+      datum.set_label(100 - i);
+      string* data = datum.mutable_data();
+      for (int j = 0; j < 30; ++j) {
+        data->push_back(static_cast<char>(i * 30 + j));
+      }
+      writer.Write(datum);
+    }
+    EXPECT_EQ(7, writer.num());
+  }
+  MMapDataset dataset;
+  dataset.Open(filename_);
+  EXPECT_EQ(7, dataset.num());
+  EXPECT_EQ(2, dataset.channels());
+  EXPECT_EQ(3, dataset.height());
+  EXPECT_EQ(5, dataset.width());
+  EXPECT_EQ(30, dataset.record_size());
+  EXPECT_EQ(MMapDataset::UINT8, dataset.data_type());
+  dataset.AdviseAccess(false);
+  dataset.WillNeed(2, 100);
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(100 - i, dataset.label(i));
+    const uint8_t* data = dataset.uint8_data(i);
+    for (int j = 0; j < 30; ++j) {
+      EXPECT_EQ(static_cast<uint8_t>(i * 30 + j), data[j]);
+    }
+  }
+}
+
+TEST_F(MMapDatasetTest, TestFloatRoundTrip) {
+  {
+    MMapDatasetWriter writer(filename_);
+    for (int i = 0; i < 3; ++i) {
+      Datum datum;
+      datum.set_channels(1);
+      datum.set_height(1);
+      datum.set_width(3);
+      datum.set_label(i);
+      for (int j = 0; j < 3; ++j) {
+        datum.add_float_data(i + j * 0.25);
+      }
+      writer.Write(datum);
+    }
+  }
+  MMapDataset dataset;
+  dataset.Open(filename_);
+  EXPECT_EQ(3, dataset.num());
+  EXPECT_EQ(MMapDataset::FLOAT, dataset.data_type());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(i, dataset.label(i));
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_EQ(static_cast<float>(i + j * 0.25), dataset.float_data(i)[j]);
+    }
+  }
+}
+
+}  // namespace caffe
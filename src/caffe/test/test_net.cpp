@@ -1,3 +1,4 @@
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -2091,6 +2092,151 @@ TEST_F(FilterNetTest, TestFilterInOutByExcludeMultiRule) {
   this->RunFilterNetTest(input_proto_test, output_proto_test);
 }
 
+class PruneNetTest : public ::testing::Test {
+ protected:
+  void RunPruneNetTest(const string& input_param_string,
+      const string& blob_names, const string& pruned_param_string) {
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_pruned_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        pruned_param_string, &expected_pruned_param));
+    vector<string> blobs;
+    std::istringstream blob_stream(blob_names);
+    string blob_name;
+    while (blob_stream >> blob_name) {
+      blobs.push_back(blob_name);
+    }
+    NetParameter actual_pruned_param;
+    Net<float>::PruneNet(input_param, blobs, &actual_pruned_param);
+    EXPECT_EQ(expected_pruned_param.DebugString(),
+        actual_pruned_param.DebugString());
+  }
+};
+
+TEST_F(PruneNetTest, TestPruneNothing) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layers: { "
+      "  name: 'data' "
+      "  type: DATA "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layers: { "
+      "  name: 'innerprod' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'data' "
+      "  top: 'innerprod' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: SOFTMAX_LOSS "
+      "  bottom: 'innerprod' "
+      "  bottom: 'label' "
+      "  top: 'loss' "
+      "} ";
+  this->RunPruneNetTest(input_proto, "loss", input_proto);
+}
+
+TEST_F(PruneNetTest, TestPruneLayersAfter) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layers: { "
+      "  name: 'data' "
+      "  type: DATA "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layers: { "
+      "  name: 'innerprod' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'data' "
+      "  top: 'innerprod' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: SOFTMAX_LOSS "
+      "  bottom: 'innerprod' "
+      "  bottom: 'label' "
+      "  top: 'loss' "
+      "} ";
+  const string& output_proto =
+      "name: 'TestNetwork' "
+      "layers: { "
+      "  name: 'data' "
+      "  type: DATA "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layers: { "
+      "  name: 'innerprod' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'data' "
+      "  top: 'innerprod' "
+      "} ";
+  this->RunPruneNetTest(input_proto, "innerprod", output_proto);
+}
+
+TEST_F(PruneNetTest, TestPruneUnrelatedBranch) {
+  // The layers are listed in an order where pruning by index would keep
+  // 'conv2', which 'label' and 'conv1' do not depend on.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "input: 'label' "
+      "layers: { "
+      "  name: 'conv2' "
+      "  type: CONVOLUTION "
+      "  bottom: 'data' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu2' "
+      "  type: RELU "
+      "  bottom: 'conv2' "
+      "  top: 'conv2' "
+      "} "
+      "layers: { "
+      "  name: 'concat' "
+      "  type: CONCAT "
+      "  bottom: 'conv1' "
+      "  bottom: 'conv2' "
+      "  top: 'concat' "
+      "} ";
+  const string& output_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "input: 'label' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} ";
+  this->RunPruneNetTest(input_proto, "conv1 label", output_proto);
+}
+
+
 TYPED_TEST(NetTest, TestReshape) {
   typedef typename TypeParam::Dtype Dtype;
   // We set up bottom blobs of two different sizes, switch between
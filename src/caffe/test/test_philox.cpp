@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/philox.hpp"
+#include "caffe/util/rng.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class PhiloxTest : public ::testing::Test {};
+
+TEST_F(PhiloxTest, TestKnownAnswers) {
+  // The known-answer vectors of the Random123 library for Philox4x32-10.
+  const uint32_t counters[3][4] = {
+      {0, 0, 0, 0},
+      {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+      {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}};
+  const uint32_t keys[3][2] = {
+      {0, 0}, {0xffffffff, 0xffffffff}, {0xa4093822, 0x299f31d0}};
+  const uint32_t expected[3][4] = {
+      {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+      {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+      {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+  for (int i = 0; i < 3; ++i) {
+    uint32_t out[4];
+    Philox::Block(counters[i], keys[i], out);
+    for (int j = 0; j < 4; ++j) {
+      EXPECT_EQ(expected[i][j], out[j]) << "debug: i " << i << " j " << j;
+    }
+  }
+}
+
+TEST_F(PhiloxTest, TestStreams) {
+  // The stream of a generator only depends on its seed, epoch and index.
+  const int num_draws = 10;
+  vector<uint32_t> draws(num_draws);
+  Philox rng(1701, 2, 3);
+  for (int i = 0; i < num_draws; ++i) {
+    draws[i] = rng();
+  }
+  Philox same_rng(1701, 2, 3);
+  Philox other_seed(1702, 2, 3);
+  Philox other_epoch(1701, 3, 3);
+  Philox other_index(1701, 2, 4);
+  int num_equal[3] = {0, 0, 0};
+  for (int i = 0; i < num_draws; ++i) {
+    EXPECT_EQ(draws[i], same_rng());
+    num_equal[0] += (draws[i] == other_seed());
+    num_equal[1] += (draws[i] == other_epoch());
+    num_equal[2] += (draws[i] == other_index());
+  }
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_LT(num_equal[i], num_draws);
+  }
+}
+
+TEST_F(PhiloxTest, TestShuffle) {
+  const int size = 100;
+  vector<int> values(size);
+  for (int i = 0; i < size; ++i) {
+    values[i] = i;
+  }
+  vector<int> shuffled(values);
+  Philox rng(1701, 0, 0);
+  shuffle(shuffled.begin(), shuffled.end(), &rng);
+  EXPECT_FALSE(std::equal(values.begin(), values.end(), shuffled.begin()));
+  vector<int> sorted(shuffled);
+  std::sort(sorted.begin(), sorted.end());
+  EXPECT_TRUE(std::equal(values.begin(), values.end(), sorted.begin()));
+  // The same generator gives the same permutation.
+  vector<int> shuffled_again(values);
+  Philox same_rng(1701, 0, 0);
+  shuffle(shuffled_again.begin(), shuffled_again.end(), &same_rng);
+  EXPECT_TRUE(std::equal(shuffled.begin(), shuffled.end(),
+                         shuffled_again.begin()));
+}
+
+}  // namespace caffe
@@ -0,0 +1,128 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <stdexcept>
+#include <vector>
+
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {};
+
+static void Square(int i, vector<int>* out) {
+  (*out)[i] = i * i;
+}
+
+static void CheckSquares(const vector<int>& out) {
+  for (int i = 0; i < out.size(); ++i) {
+    EXPECT_EQ(i * i, out[i]) << "item " << i;
+  }
+}
+
+TEST_F(ThreadPoolTest, TestRunCoversAllItems) {
+  for (int num_threads = 0; num_threads < 4; ++num_threads) {
+    ThreadPool pool(num_threads);
+    EXPECT_EQ(num_threads, pool.num_threads());
+    vector<int> out(1000, -1);
+    pool.Run(out.size(), boost::bind(&Square, _1, &out));
+    CheckSquares(out);
+  }
+}
+
+// Submits jobs to a shared pool from its own thread, like the prefetch
+// thread of a data layer.
+class PoolClient : public InternalThread {
+ public:
+  explicit PoolClient(ThreadPool* pool) : pool_(pool), out_(257) {}
+  vector<int>& out() { return out_; }
+
+ protected:
+  virtual void InternalThreadEntry() {
+    for (int iter = 0; iter < 20; ++iter) {
+      pool_->Run(out_.size(), boost::bind(&Square, _1, &out_));
+    }
+  }
+  ThreadPool* pool_;
+  vector<int> out_;
+};
+
+TEST_F(ThreadPoolTest, TestConcurrentCallers) {
+  ThreadPool pool(3);
+  PoolClient client_a(&pool);
+  PoolClient client_b(&pool);
+  EXPECT_TRUE(client_a.StartInternalThread());
+  EXPECT_TRUE(client_b.StartInternalThread());
+  EXPECT_TRUE(client_a.WaitForInternalThreadToExit());
+  EXPECT_TRUE(client_b.WaitForInternalThreadToExit());
+  CheckSquares(client_a.out());
+  CheckSquares(client_b.out());
+}
+
+static void SlowSquare(int i, vector<int>* out) {
+  boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  (*out)[i] = i * i;
+}
+
+// Runs one slow job and records whether Run returned before the thread
+// was interrupted out of its next wait.
+class InterruptedClient : public InternalThread {
+ public:
+  explicit InterruptedClient(ThreadPool* pool)
+      : pool_(pool), out_(200, -1), run_returned_(false) {}
+  vector<int>& out() { return out_; }
+  bool run_returned() const { return run_returned_; }
+
+ protected:
+  virtual void InternalThreadEntry() {
+    pool_->Run(out_.size(), boost::bind(&SlowSquare, _1, &out_));
+    run_returned_ = true;
+    try {
+      while (true) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      }
+    } catch (boost::thread_interrupted&) {
+    }
+  }
+  ThreadPool* pool_;
+  vector<int> out_;
+  bool run_returned_;
+};
+
+TEST_F(ThreadPoolTest, TestInterruptedCaller) {
+  // Stopping a thread blocked in Run must not unwind its job while the
+  // workers still run its items.
+  ThreadPool pool(2);
+  InterruptedClient client(&pool);
+  EXPECT_TRUE(client.StartInternalThread());
+  boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  EXPECT_TRUE(client.StopInternalThread());
+  EXPECT_TRUE(client.run_returned());
+  CheckSquares(client.out());
+}
+
+static void SquareOrThrow(int i, int bad, vector<int>* out) {
+  if (i == bad) {
+    throw std::runtime_error("bad item");
+  }
+  (*out)[i] = i * i;
+}
+
+TEST_F(ThreadPoolTest, TestExceptionRethrownAfterAllItems) {
+  for (int num_threads = 0; num_threads < 3; ++num_threads) {
+    ThreadPool pool(num_threads);
+    vector<int> out(100, -1);
+    EXPECT_THROW(pool.Run(out.size(),
+        boost::bind(&SquareOrThrow, _1, 17, &out)), std::runtime_error);
+    // Every other item still ran before Run threw.
+    out[17] = 17 * 17;
+    CheckSquares(out);
+  }
+}
+
+}  // namespace caffe
@@ -94,4 +94,13 @@ void Timer::Init() {
   }
 }
 
+void CPUTimer::Start() {
+  start_ = boost::posix_time::microsec_clock::universal_time();
+}
+
+double CPUTimer::MilliSeconds() const {
+  return (boost::posix_time::microsec_clock::universal_time() - start_)
+      .total_microseconds() / 1000.;
+}
+
 }  // namespace caffe
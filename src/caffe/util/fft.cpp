@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "caffe/util/fft.hpp"
+
+namespace caffe {
+
+// The product of complex numbers, without the checks for infinities and NaNs
+// of operator*, which make it a library call.
+template <typename Dtype>
+static inline std::complex<Dtype> Multiply(const std::complex<Dtype>& a,
+    const std::complex<Dtype>& b) {
+  return std::complex<Dtype>(a.real() * b.real() - a.imag() * b.imag(),
+                             a.real() * b.imag() + a.imag() * b.real());
+}
+
+// The exp(sign 2 pi i k / size) for k < count.
+template <typename Dtype>
+static void InitTwiddles(const int size, const int count, const int sign,
+    vector<std::complex<Dtype> >* twiddles) {
+  twiddles->resize(count);
+  for (int k = 0; k < count; ++k) {
+    const double angle = sign * 2 * M_PI * k / size;
+    (*twiddles)[k] = std::complex<Dtype>(cos(angle), sin(angle));
+  }
+}
+
+// The index of each of size values once its bits are reversed.
+static void InitReversal(const int size, vector<int>* reversal) {
+  reversal->resize(size);
+  for (int i = 0, j = 0; i < size; ++i) {
+    (*reversal)[i] = j;
+    int bit = size >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+  }
+}
+
+static bool IsPowerOfTwo(const int n) {
+  return n > 0 && (n & (n - 1)) == 0;
+}
+
+template <typename Dtype>
+RealFFT2D<Dtype>::RealFFT2D(const int height, const int width)
+    : height_(height), width_(width) {
+  CHECK(IsPowerOfTwo(height)) << "The height must be a power of 2.";
+  CHECK(IsPowerOfTwo(width) && width > 1)
+      << "The width must be a power of 2 of at least 2.";
+  const int half_width = width / 2;
+  InitReversal(height, &column_reversal_);
+  InitReversal(half_width, &row_reversal_);
+  InitTwiddles(height, height / 2, -1, &column_twiddles_);
+  InitTwiddles(height, height / 2, 1, &inverse_column_twiddles_);
+  InitTwiddles(half_width, half_width / 2, -1, &row_twiddles_);
+  InitTwiddles(half_width, half_width / 2, 1, &inverse_row_twiddles_);
+  InitTwiddles(width, half_width + 1, -1, &split_twiddles_);
+  spectrum_.resize(spectrum_size());
+  buffer_.resize(half_width);
+}
+
+template <typename Dtype>
+void RealFFT2D<Dtype>::Transform(const int size, const vector<int>& reversal,
+    const vector<std::complex<Dtype> >& twiddles, std::complex<Dtype>* data) {
+  // Put the values in bit-reversed order, then combine the transforms of the
+  // halves of ever longer runs.
+  for (int i = 0; i < size; ++i) {
+    if (i < reversal[i]) {
+      std::swap(data[i], data[reversal[i]]);
+    }
+  }
+  for (int length = 2; length <= size; length <<= 1) {
+    const int half = length / 2;
+    const int step = size / length;
+    for (int start = 0; start < size; start += length) {
+      for (int k = 0; k < half; ++k) {
+        const std::complex<Dtype> even = data[start + k];
+        const std::complex<Dtype> odd =
+            Multiply(data[start + k + half], twiddles[k * step]);
+        data[start + k] = even + odd;
+        data[start + k + half] = even - odd;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void RealFFT2D<Dtype>::TransformColumns(
+    const vector<std::complex<Dtype> >& twiddles,
+    std::complex<Dtype>* data) {
+  // As Transform, with rows for values: the loops over the columns are
+  // contiguous and vectorize.
+  const int columns = width_ / 2 + 1;
+  for (int i = 0; i < height_; ++i) {
+    const int j = column_reversal_[i];
+    if (i < j) {
+      std::swap_ranges(data + i * columns, data + (i + 1) * columns,
+                       data + j * columns);
+    }
+  }
+  for (int length = 2; length <= height_; length <<= 1) {
+    const int half = length / 2;
+    const int step = height_ / length;
+    for (int start = 0; start < height_; start += length) {
+      for (int k = 0; k < half; ++k) {
+        const Dtype twiddle_real = twiddles[k * step].real();
+        const Dtype twiddle_imag = twiddles[k * step].imag();
+        Dtype* even = reinterpret_cast<Dtype*>(data + (start + k) * columns);
+        Dtype* odd =
+            reinterpret_cast<Dtype*>(data + (start + k + half) * columns);
+        for (int l = 0; l < 2 * columns; l += 2) {
+          const Dtype odd_real =
+              odd[l] * twiddle_real - odd[l + 1] * twiddle_imag;
+          const Dtype odd_imag =
+              odd[l] * twiddle_imag + odd[l + 1] * twiddle_real;
+          odd[l] = even[l] - odd_real;
+          odd[l + 1] = even[l + 1] - odd_imag;
+          even[l] += odd_real;
+          even[l + 1] += odd_imag;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void RealFFT2D<Dtype>::Forward(const Dtype* in, std::complex<Dtype>* out,
+    const int rows) {
+  const int half_width = width_ / 2;
+  const int columns = half_width + 1;
+  std::complex<Dtype>* z = &buffer_[0];
+  for (int y = 0; y < rows; ++y) {
+    // Transform the row as the complex sequence z[n] = in[2n] + i in[2n + 1],
+    // and split the transform Z into those of the even and odd values:
+    // E[k] = (Z[k] + Z*[M - k]) / 2 and O[k] = -i (Z[k] - Z*[M - k]) / 2,
+    // with M = width / 2, of which out[k] = E[k] + exp(-2 pi i k / width)
+    // O[k].
+    const Dtype* row = in + y * width_;
+    for (int n = 0; n < half_width; ++n) {
+      z[n] = std::complex<Dtype>(row[2 * n], row[2 * n + 1]);
+    }
+    Transform(half_width, row_reversal_, row_twiddles_, z);
+    std::complex<Dtype>* out_row = out + y * columns;
+    for (int k = 0; k <= half_width; ++k) {
+      const std::complex<Dtype> z_k = z[k % half_width];
+      const std::complex<Dtype> z_conj = std::conj(z[(half_width - k) %
+                                                     half_width]);
+      const std::complex<Dtype> even = (z_k + z_conj) * Dtype(0.5);
+      const std::complex<Dtype> difference = (z_k - z_conj) * Dtype(0.5);
+      const std::complex<Dtype> odd(difference.imag(), -difference.real());
+      out_row[k] = even + Multiply(split_twiddles_[k], odd);
+    }
+  }
+  std::fill(out + rows * columns, out + height_ * columns,
+            std::complex<Dtype>(0));
+  TransformColumns(column_twiddles_, out);
+}
+
+template <typename Dtype>
+void RealFFT2D<Dtype>::Inverse(const std::complex<Dtype>* in, Dtype* out) {
+  const int half_width = width_ / 2;
+  const int columns = half_width + 1;
+  std::complex<Dtype>* spectrum = &spectrum_[0];
+  std::copy(in, in + spectrum_size(), spectrum);
+  TransformColumns(inverse_column_twiddles_, spectrum);
+  // The inverse transforms are not divided by their sizes; nor are the even
+  // and odd halves recovered from the rows, which gives width / 2.
+  const Dtype scale = Dtype(1) / (height_ * half_width);
+  std::complex<Dtype>* z = &buffer_[0];
+  for (int y = 0; y < height_; ++y) {
+    // Undo the split: Z[k] = E[k] + i O[k].
+    const std::complex<Dtype>* row = spectrum + y * columns;
+    for (int k = 0; k < half_width; ++k) {
+      const std::complex<Dtype> x_conj = std::conj(row[half_width - k]);
+      const std::complex<Dtype> even = (row[k] + x_conj) * Dtype(0.5);
+      const std::complex<Dtype> odd = Multiply(
+          (row[k] - x_conj) * Dtype(0.5), std::conj(split_twiddles_[k]));
+      z[k] = std::complex<Dtype>(even.real() - odd.imag(),
+                                 even.imag() + odd.real());
+    }
+    Transform(half_width, row_reversal_, inverse_row_twiddles_, z);
+    Dtype* out_row = out + y * width_;
+    for (int n = 0; n < half_width; ++n) {
+      out_row[2 * n] = z[n].real() * scale;
+      out_row[2 * n + 1] = z[n].imag() * scale;
+    }
+  }
+}
+
+INSTANTIATE_CLASS(RealFFT2D);
+
+}  // namespace caffe
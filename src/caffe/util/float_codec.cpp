@@ -0,0 +1,215 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <string>
+
+#include "caffe/util/float_codec.hpp"
+
+namespace caffe {
+
+// The bits of a float, for the conversions to and from half precision.
+union FloatBits {
+  float f;
+  uint32_t u;
+};
+
+uint16_t FloatToHalf(const float value) {
+  // Floats from 2^16 up round to the half infinity.
+  const uint32_t kHalfOverflow = (127 + 16) << 23;
+  const uint32_t kInfinity = 255 << 23;
+  FloatBits denormal_magic;
+  denormal_magic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+  FloatBits bits;
+  bits.f = value;
+  const uint32_t sign = bits.u & 0x80000000u;
+  bits.u ^= sign;
+  uint16_t half;
+  if (bits.u >= kHalfOverflow) {
+    half = bits.u > kInfinity ? 0x7e00 : 0x7c00;  // NaN or infinity
+  } else if (bits.u < (113u << 23)) {
+    // The value is a half subnormal, or zero: adding the magic number makes
+    // the FPU round the mantissa to its 10 bits.
+    bits.f += denormal_magic.f;
+    half = bits.u - denormal_magic.u;
+  } else {
+    const uint32_t mantissa_odd = (bits.u >> 13) & 1;
+    // Rebias the exponent and round the mantissa to nearest even.
+    bits.u += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff;
+    bits.u += mantissa_odd;
+    half = bits.u >> 13;
+  }
+  return half | (sign >> 16);
+}
+
+float HalfToFloat(const uint16_t value) {
+  // Shifted into place, the exponent and mantissa read as a float 2^112
+  // times too small, subnormals included; multiplying rebiases them exactly.
+  // Infinities and NaNs get the all-ones exponent instead. DecodeHalfValues
+  // does the same on 8 values at a time, as two groups of 4 floats.
+  FloatBits magic;
+  magic.u = (254 - 15) << 23;
+  const uint32_t exponent_mantissa = value & 0x7fff;
+  FloatBits bits;
+  bits.u = exponent_mantissa << 13;
+  bits.f *= magic.f;
+  if (exponent_mantissa > 0x7bff) {
+    bits.u |= 255 << 23;
+  }
+  bits.u |= static_cast<uint32_t>(value & 0x8000) << 16;
+  return bits.f;
+}
+
+void EncodeHalf(const float* data, const int count, uint8_t* out) {
+  for (int i = 0; i < count; ++i) {
+    const uint16_t half = FloatToHalf(data[i]);
+    out[2 * i] = half & 0xff;
+    out[2 * i + 1] = half >> 8;
+  }
+}
+
+static void DecodeHalfValues(const uint8_t* data, const int count,
+    double* out) {
+  for (int i = 0; i < count; ++i) {
+    out[i] = HalfToFloat(data[2 * i] | data[2 * i + 1] << 8);
+  }
+}
+
+static void DecodeHalfValues(const uint8_t* data, const int count,
+    float* out) {
+  int i = 0;
+#ifdef __SSE2__
+  // Widen 8 halves at a time to 2 x 4 floats, as HalfToFloat does.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i exponent_mantissa_mask = _mm_set1_epi32(0x7fff);
+  const __m128i max_finite = _mm_set1_epi32(0x7bff);
+  const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+  const __m128 infinity = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+  for (; i + 8 <= count; i += 8) {
+    const __m128i halves =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 2 * i));
+    __m128i values[2];
+    values[0] = _mm_unpacklo_epi16(halves, zero);
+    values[1] = _mm_unpackhi_epi16(halves, zero);
+    for (int k = 0; k < 2; ++k) {
+      const __m128i exponent_mantissa =
+          _mm_and_si128(values[k], exponent_mantissa_mask);
+      const __m128i sign =
+          _mm_slli_epi32(_mm_xor_si128(values[k], exponent_mantissa), 16);
+      const __m128 scaled = _mm_mul_ps(
+          _mm_castsi128_ps(_mm_slli_epi32(exponent_mantissa, 13)), magic);
+      const __m128 infinity_nan = _mm_and_ps(_mm_castsi128_ps(
+          _mm_cmpgt_epi32(exponent_mantissa, max_finite)), infinity);
+      _mm_storeu_ps(out + i + 4 * k, _mm_or_ps(
+          _mm_or_ps(scaled, _mm_castsi128_ps(sign)), infinity_nan));
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = HalfToFloat(data[2 * i] | data[2 * i + 1] << 8);
+  }
+}
+
+template <typename Dtype>
+void DecodeHalf(const uint8_t* data, const int count, Dtype* out) {
+  DecodeHalfValues(data, count, out);
+}
+
+template void DecodeHalf<float>(const uint8_t* data, const int count,
+    float* out);
+template void DecodeHalf<double>(const uint8_t* data, const int count,
+    double* out);
+
+void EncodeQuantized(const float* data, const int count, uint8_t* out,
+    float* scale, float* offset) {
+  if (count == 0) {
+    *scale = 0;
+    *offset = 0;
+    return;
+  }
+  const float min_value = *std::min_element(data, data + count);
+  const float max_value = *std::max_element(data, data + count);
+  *offset = min_value;
+  *scale = (max_value - min_value) / 255;
+  const float inverse_scale = *scale > 0 ? 1 / *scale : 0;
+  for (int i = 0; i < count; ++i) {
+    const int code =
+        static_cast<int>((data[i] - min_value) * inverse_scale + 0.5f);
+    out[i] = std::min(std::max(code, 0), 255);
+  }
+}
+
+static void DecodeQuantizedValues(const uint8_t* data, const int count,
+    const float scale, const float offset, double* out) {
+  for (int i = 0; i < count; ++i) {
+    out[i] = offset + scale * data[i];
+  }
+}
+
+static void DecodeQuantizedValues(const uint8_t* data, const int count,
+    const float scale, const float offset, float* out) {
+  int i = 0;
+#ifdef __SSE2__
+  // Widen 16 codes at a time to 4 x 4 floats; the arithmetic is the same as
+  // in the scalar tail, so both paths give identical results.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128 offset4 = _mm_set1_ps(offset);
+  for (; i + 16 <= count; i += 16) {
+    const __m128i codes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    const __m128i lo = _mm_unpacklo_epi8(codes, zero);
+    const __m128i hi = _mm_unpackhi_epi8(codes, zero);
+    __m128 values[4];
+    values[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    values[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    values[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    values[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    for (int k = 0; k < 4; ++k) {
+      _mm_storeu_ps(out + i + 4 * k,
+                    _mm_add_ps(offset4, _mm_mul_ps(scale4, values[k])));
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = offset + scale * static_cast<float>(data[i]);
+  }
+}
+
+template <typename Dtype>
+void DecodeQuantized(const uint8_t* data, const int count, const float scale,
+    const float offset, Dtype* out) {
+  DecodeQuantizedValues(data, count, scale, offset, out);
+}
+
+template void DecodeQuantized<float>(const uint8_t* data, const int count,
+    const float scale, const float offset, float* out);
+template void DecodeQuantized<double>(const uint8_t* data, const int count,
+    const float scale, const float offset, double* out);
+
+void SetHalfData(const float* data, const int count, Datum* datum) {
+  datum->clear_float_data();
+  datum->clear_quantized_data();
+  string* half_data = datum->mutable_half_data();
+  half_data->resize(2 * count);
+  if (count > 0) {
+    EncodeHalf(data, count, reinterpret_cast<uint8_t*>(&(*half_data)[0]));
+  }
+}
+
+void SetQuantizedData(const float* data, const int count, Datum* datum) {
+  datum->clear_float_data();
+  datum->clear_half_data();
+  string* quantized_data = datum->mutable_quantized_data();
+  quantized_data->resize(count);
+  float scale = 0, offset = 0;
+  if (count > 0) {
+    EncodeQuantized(data, count,
+        reinterpret_cast<uint8_t*>(&(*quantized_data)[0]), &scale, &offset);
+  }
+  datum->set_quantized_scale(scale);
+  datum->set_quantized_offset(offset);
+}
+
+}  // namespace caffe
@@ -12,29 +12,58 @@ void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
-    Dtype* data_col) {
+    const int row_begin, const int row_end,
+    Dtype* data_col, const int col_width) {
   int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
   int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  CHECK_LE(0, row_begin);
+  CHECK_LE(row_begin, row_end);
+  CHECK_LE(row_end, height_col);
+  CHECK_GE(col_width, (row_end - row_begin) * width_col);
   int channels_col = channels * kernel_h * kernel_w;
   for (int c = 0; c < channels_col; ++c) {
     int w_offset = c % kernel_w;
     int h_offset = (c / kernel_w) % kernel_h;
     int c_im = c / kernel_h / kernel_w;
-    for (int h = 0; h < height_col; ++h) {
+    Dtype* col_row = data_col + c * col_width;
+    for (int h = row_begin; h < row_end; ++h) {
       for (int w = 0; w < width_col; ++w) {
         int h_pad = h * stride_h - pad_h + h_offset;
         int w_pad = w * stride_w - pad_w + w_offset;
         if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_col[(c * height_col + h) * width_col + w] =
+          col_row[(h - row_begin) * width_col + w] =
             data_im[(c_im * height + h_pad) * width + w_pad];
         else
-          data_col[(c * height_col + h) * width_col + w] = 0;
+          col_row[(h - row_begin) * width_col + w] = 0;
       }
     }
   }
 }
 
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_col) {
+  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  im2col_cpu(data_im, channels, height, width, kernel_h, kernel_w,
+      pad_h, pad_w, stride_h, stride_w, 0, height_col, data_col,
+      height_col * width_col);
+}
+
 // Explicit instantiation
+template void im2col_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int row_begin, const int row_end,
+    float* data_col, const int col_width);
+template void im2col_cpu<double>(const double* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int row_begin, const int row_end,
+    double* data_col, const int col_width);
 template void im2col_cpu<float>(const float* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int stride_h,
@@ -49,28 +78,57 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
-    Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
+    const int row_begin, const int row_end,
+    Dtype* data_im, const int col_width) {
   int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
   int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  CHECK_LE(0, row_begin);
+  CHECK_LE(row_begin, row_end);
+  CHECK_LE(row_end, height_col);
+  CHECK_GE(col_width, (row_end - row_begin) * width_col);
   int channels_col = channels * patch_h * patch_w;
   for (int c = 0; c < channels_col; ++c) {
     int w_offset = c % patch_w;
     int h_offset = (c / patch_w) % patch_h;
     int c_im = c / patch_h / patch_w;
-    for (int h = 0; h < height_col; ++h) {
+    const Dtype* col_row = data_col + c * col_width;
+    for (int h = row_begin; h < row_end; ++h) {
       for (int w = 0; w < width_col; ++w) {
         int h_pad = h * stride_h - pad_h + h_offset;
         int w_pad = w * stride_w - pad_w + w_offset;
         if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
           data_im[(c_im * height + h_pad) * width + w_pad] +=
-              data_col[(c * height_col + h) * width_col + w];
+              col_row[(h - row_begin) * width_col + w];
       }
     }
   }
 }
 
+template <typename Dtype>
+void col2im_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_im) {
+  caffe_set(height * width * channels, Dtype(0), data_im);
+  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  col2im_cpu(data_col, channels, height, width, patch_h, patch_w,
+      pad_h, pad_w, stride_h, stride_w, 0, height_col, data_im,
+      height_col * width_col);
+}
+
 // Explicit instantiation
+template void col2im_cpu<float>(const float* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int row_begin, const int row_end,
+    float* data_im, const int col_width);
+template void col2im_cpu<double>(const double* data_col, const int channels,
+    const int height, const int width, const int patch_h, const int patch_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int row_begin, const int row_end,
+    double* data_im, const int col_width);
 template void col2im_cpu<float>(const float* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
     const int pad_h, const int pad_w, const int stride_h,
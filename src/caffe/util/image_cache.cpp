@@ -0,0 +1,76 @@
+#include <boost/thread.hpp>
+
+#include <map>
+#include <string>
+
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+shared_ptr<ImageCache> ImageCache::singleton_;
+// Get() is called from the prefetch threads of several data layers.
+static boost::mutex singleton_mutex_;
+
+class ImageCache::sync {
+ public:
+  boost::mutex mutex_;
+};
+
+ImageCache& ImageCache::Get() {
+  boost::mutex::scoped_lock lock(singleton_mutex_);
+  if (!singleton_.get()) {
+    singleton_.reset(new ImageCache());
+  }
+  return *singleton_;
+}
+
+ImageCache::ImageCache(size_t capacity)
+    : capacity_(capacity), size_(0), sync_(new sync()) {}
+
+void ImageCache::Reserve(size_t capacity) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  if (capacity > capacity_) {
+    capacity_ = capacity;
+  }
+}
+
+size_t ImageCache::EntrySize(const string& key, const Datum& datum) {
+  return key.size() + datum.data().size()
+      + datum.float_data_size() * sizeof(float);
+}
+
+shared_ptr<const Datum> ImageCache::Lookup(const string& key) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  std::map<string, EntryList::iterator>::iterator it = index_.find(key);
+  if (it == index_.end()) {
+    return shared_ptr<const Datum>();
+  }
+  // Move the entry to the front.
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void ImageCache::Insert(const string& key,
+                        const shared_ptr<const Datum>& datum) {
+  const size_t entry_size = EntrySize(key, *datum);
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  if (entry_size > capacity_ || index_.count(key)) {
+    // Too large to cache, or cached by another thread in the meantime.
+    return;
+  }
+  EvictTo(capacity_ - entry_size);
+  entries_.push_front(std::make_pair(key, datum));
+  index_[key] = entries_.begin();
+  size_ += entry_size;
+}
+
+void ImageCache::EvictTo(size_t size) {
+  while (size_ > size) {
+    const EntryList::value_type& entry = entries_.back();
+    size_ -= EntrySize(entry.first, *entry.second);
+    index_.erase(entry.first);
+    entries_.pop_back();
+  }
+}
+
+}  // namespace caffe
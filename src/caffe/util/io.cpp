@@ -1,3 +1,4 @@
+#include <boost/thread/recursive_mutex.hpp>
 #include <fcntl.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
@@ -11,6 +12,7 @@
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -66,8 +68,9 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
-bool ReadImageToDatum(const string& filename, const int label,
-    const int height, const int width, const bool is_color, Datum* datum) {
+// Reads an image with OpenCV and resizes it if height and width are set.
+static cv::Mat ReadImageToCVMat(const string& filename, const int height,
+    const int width, const bool is_color) {
   cv::Mat cv_img;
   int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
     CV_LOAD_IMAGE_GRAYSCALE);
@@ -75,22 +78,28 @@ bool ReadImageToDatum(const string& filename, const int label,
   cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
   if (!cv_img_origin.data) {
     LOG(ERROR) << "Could not open or find file " << filename;
-    return false;
+    return cv_img_origin;
   }
   if (height > 0 && width > 0) {
     cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
   } else {
     cv_img = cv_img_origin;
   }
+  return cv_img;
+}
 
+// Stores the pixels of an 8-bit image in the datum, channel by channel.
+static void CVMatToDatum(const cv::Mat& cv_img, Datum* datum) {
+  const bool is_color = (cv_img.channels() == 3);
   int num_channels = (is_color ? 3 : 1);
   datum->set_channels(num_channels);
   datum->set_height(cv_img.rows);
   datum->set_width(cv_img.cols);
-  datum->set_label(label);
+  datum->set_encoded(false);
   datum->clear_data();
   datum->clear_float_data();
   string* datum_string = datum->mutable_data();
+  datum_string->reserve(num_channels * cv_img.rows * cv_img.cols);
   if (is_color) {
     for (int c = 0; c < num_channels; ++c) {
       for (int h = 0; h < cv_img.rows; ++h) {
@@ -108,9 +117,194 @@ bool ReadImageToDatum(const string& filename, const int label,
         }
       }
   }
+}
+
+bool ReadImageToDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color, Datum* datum) {
+  cv::Mat cv_img = ReadImageToCVMat(filename, height, width, is_color);
+  if (!cv_img.data) {
+    return false;
+  }
+  CVMatToDatum(cv_img, datum);
+  datum->set_label(label);
+  return true;
+}
+
+bool ReadImageToEncodedDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color, Datum* datum) {
+  // Decode once to validate the image and record its shape.
+  cv::Mat cv_img = ReadImageToCVMat(filename, height, width, is_color);
+  if (!cv_img.data) {
+    return false;
+  }
+  if (height <= 0 || width <= 0) {
+    // Store the file as is; DecodeDatum converts it to the stored channels.
+    std::ifstream file(filename.c_str(), ios::in | ios::binary);
+    if (!file) {
+      LOG(ERROR) << "Could not read file " << filename;
+      return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    datum->set_data(buffer.str());
+  } else {
+    // Re-encode the resized image in the format of the file.
+    const size_t dot = filename.rfind('.');
+    const string extension =
+        (dot == string::npos) ? ".png" : filename.substr(dot);
+    std::vector<uchar> buffer;
+    if (!cv::imencode(extension, cv_img, buffer)) {
+      LOG(ERROR) << "Could not encode " << filename << " as " << extension;
+      return false;
+    }
+    datum->set_data(string(buffer.begin(), buffer.end()));
+  }
+  datum->set_channels(cv_img.channels());
+  datum->set_height(cv_img.rows);
+  datum->set_width(cv_img.cols);
+  datum->set_label(label);
+  datum->set_encoded(true);
+  datum->clear_float_data();
+  return true;
+}
+
+bool DecodeDatum(Datum* datum) {
+  if (!datum->encoded()) {
+    return true;
+  }
+  const string& data = datum->data();
+  cv::Mat encoded(1, data.size(), CV_8UC1,
+                  const_cast<char*>(data.data()));
+  const int cv_read_flag = (datum->channels() == 1 ?
+      CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR);
+  cv::Mat cv_img = cv::imdecode(encoded, cv_read_flag);
+  if (!cv_img.data) {
+    LOG(ERROR) << "Could not decode datum";
+    return false;
+  }
+  if (cv_img.rows != datum->height() || cv_img.cols != datum->width()) {
+    LOG(ERROR) << "Decoded image is " << cv_img.rows << "x" << cv_img.cols
+               << " but the datum says " << datum->height() << "x"
+               << datum->width();
+    return false;
+  }
+  CVMatToDatum(cv_img, datum);
   return true;
 }
 
+// Reads the size of a length-delimited field and points data at its bytes,
+// which must all be in the current buffer, in place.
+static bool ReadBytesView(CodedInputStream* input, const uint8_t** data,
+    int* size) {
+  uint32_t length;
+  if (!input->ReadVarint32(&length)) {
+    return false;
+  }
+  const void* buffer = NULL;
+  int available = 0;
+  if (length > 0 && (!input->GetDirectBufferPointer(&buffer, &available) ||
+                     static_cast<uint32_t>(available) < length)) {
+    return false;
+  }
+  *data = static_cast<const uint8_t*>(buffer);
+  *size = length;
+  return input->Skip(length);
+}
+
+bool ParseDatumView(const void* buffer, size_t size, DatumView* view) {
+  view->channels = 0;
+  view->height = 0;
+  view->width = 0;
+  view->label = 0;
+  view->data = NULL;
+  view->data_size = 0;
+  view->float_data = NULL;
+  view->half_data = NULL;
+  view->quantized_data = NULL;
+  view->quantized_scale = 0;
+  view->quantized_offset = 0;
+  CodedInputStream input(static_cast<const uint8_t*>(buffer), size);
+  // Walk the wire format: every field is a tag (field number << 3 | wire
+  // type) followed by a varint, a 32-bit value or a length-prefixed payload.
+  const uint32_t kVarint = 0;
+  const uint32_t kLengthDelimited = 2;
+  const uint32_t kFixed32 = 5;
+  uint32_t tag;
+  while ((tag = input.ReadTag()) != 0) {
+    const int field = tag >> 3;
+    const uint32_t wire_type = tag & 7;
+    uint32_t value;
+    switch (field) {
+    case Datum::kChannelsFieldNumber:
+    case Datum::kHeightFieldNumber:
+    case Datum::kWidthFieldNumber:
+    case Datum::kLabelFieldNumber:
+      if (wire_type != kVarint || !input.ReadVarint32(&value)) {
+        return false;
+      }
+      if (field == Datum::kChannelsFieldNumber) {
+        view->channels = static_cast<int32_t>(value);
+      } else if (field == Datum::kHeightFieldNumber) {
+        view->height = static_cast<int32_t>(value);
+      } else if (field == Datum::kWidthFieldNumber) {
+        view->width = static_cast<int32_t>(value);
+      } else {
+        view->label = static_cast<int32_t>(value);
+      }
+      break;
+    case Datum::kDataFieldNumber:
+      if (wire_type != kLengthDelimited ||
+          !ReadBytesView(&input, &view->data, &view->data_size)) {
+        return false;
+      }
+      break;
+    case Datum::kHalfDataFieldNumber:
+      if (wire_type != kLengthDelimited ||
+          !ReadBytesView(&input, &view->half_data, &view->data_size)) {
+        return false;
+      }
+      break;
+    case Datum::kQuantizedDataFieldNumber:
+      if (wire_type != kLengthDelimited ||
+          !ReadBytesView(&input, &view->quantized_data, &view->data_size)) {
+        return false;
+      }
+      break;
+    case Datum::kQuantizedScaleFieldNumber:
+    case Datum::kQuantizedOffsetFieldNumber:
+      {
+      union {
+        uint32_t u;
+        float f;
+      } bits;
+      if (wire_type != kFixed32 || !input.ReadLittleEndian32(&bits.u)) {
+        return false;
+      }
+      if (field == Datum::kQuantizedScaleFieldNumber) {
+        view->quantized_scale = bits.f;
+      } else {
+        view->quantized_offset = bits.f;
+      }
+      }
+      break;
+    case Datum::kEncodedFieldNumber:
+      // Encoded records have to be decoded into a Datum first.
+      if (wire_type != kVarint || !input.ReadVarint32(&value) || value) {
+        return false;
+      }
+      break;
+    default:
+      // float_data or a field this version does not know about.
+      return false;
+    }
+  }
+  // Exactly one non-empty payload.
+  const int num_payloads = (view->data != NULL) + (view->half_data != NULL)
+      + (view->quantized_data != NULL);
+  return input.ConsumedEntireMessage() && view->data_size > 0
+      && num_payloads == 1;
+}
+
 leveldb::Options GetLevelDBOptions() {
   // In default, we will return the leveldb option and set the max open files
   // in order to avoid using up the operating system's limit.
@@ -119,12 +313,22 @@ leveldb::Options GetLevelDBOptions() {
   return options;
 }
 
+static boost::recursive_mutex hdf5_mutex_;
+
+HDF5Lock::HDF5Lock() {
+  hdf5_mutex_.lock();
+}
+
+HDF5Lock::~HDF5Lock() {
+  hdf5_mutex_.unlock();
+}
+
 // Verifies format of data stored in HDF5 file and reshapes blob accordingly.
-template <typename Dtype>
-void hdf5_load_nd_dataset_helper(
+void hdf5_get_nd_dataset_dims(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
-    Blob<Dtype>* blob) {
+    vector<hsize_t>* dims) {
   // Verify that the number of dimensions is in the accepted range.
+  HDF5Lock lock;
   herr_t status;
   int ndims;
   status = H5LTget_dataset_ndims(file_id, dataset_name_, &ndims);
@@ -133,13 +337,20 @@ void hdf5_load_nd_dataset_helper(
   CHECK_LE(ndims, max_dim);
 
   // Verify that the data format is what we expect: float or double.
-  std::vector<hsize_t> dims(ndims);
+  dims->resize(ndims);
   H5T_class_t class_;
   status = H5LTget_dataset_info(
-      file_id, dataset_name_, dims.data(), &class_, NULL);
+      file_id, dataset_name_, dims->data(), &class_, NULL);
   CHECK_GE(status, 0) << "Failed to get dataset info for " << dataset_name_;
   CHECK_EQ(class_, H5T_FLOAT) << "Expected float or double data";
+}
 
+template <typename Dtype>
+void hdf5_load_nd_dataset_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob<Dtype>* blob) {
+  std::vector<hsize_t> dims;
+  hdf5_get_nd_dataset_dims(file_id, dataset_name_, min_dim, max_dim, &dims);
   blob->Reshape(
     dims[0],
     (dims.size() > 1) ? dims[1] : 1,
@@ -147,9 +358,61 @@ void hdf5_load_nd_dataset_helper(
     (dims.size() > 3) ? dims[3] : 1);
 }
 
+static void hdf5_load_nd_dataset_rows_helper(
+    hid_t dataset_id, hid_t mem_type_id, const vector<hsize_t>& rows,
+    void* data) {
+  if (rows.empty()) {
+    return;
+  }
+  HDF5Lock lock;
+  hid_t file_space = H5Dget_space(dataset_id);
+  CHECK_GE(file_space, 0) << "Failed to get the dataset space";
+  const int ndims = H5Sget_simple_extent_ndims(file_space);
+  std::vector<hsize_t> dims(ndims);
+  H5Sget_simple_extent_dims(file_space, dims.data(), NULL);
+  // Select the runs of consecutive rows, each with all of its columns.
+  std::vector<hsize_t> start(ndims, 0);
+  std::vector<hsize_t> count(dims);
+  H5S_seloper_t op = H5S_SELECT_SET;
+  for (int i = 0; i < rows.size(); ) {
+    int j = i + 1;
+    while (j < rows.size() && rows[j] == rows[j - 1] + 1) {
+      ++j;
+    }
+    CHECK_LT(rows[j - 1], dims[0]) << "Row out of range";
+    start[0] = rows[i];
+    count[0] = j - i;
+    herr_t status = H5Sselect_hyperslab(file_space, op, start.data(), NULL,
+                                        count.data(), NULL);
+    CHECK_GE(status, 0) << "Failed to select rows";
+    op = H5S_SELECT_OR;
+    i = j;
+  }
+  dims[0] = rows.size();
+  hid_t mem_space = H5Screate_simple(ndims, dims.data(), NULL);
+  herr_t status = H5Dread(dataset_id, mem_type_id, mem_space, file_space,
+                          H5P_DEFAULT, data);
+  CHECK_GE(status, 0) << "Failed to read rows";
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<float>(
+    hid_t dataset_id, const vector<hsize_t>& rows, float* data) {
+  hdf5_load_nd_dataset_rows_helper(dataset_id, H5T_NATIVE_FLOAT, rows, data);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<double>(
+    hid_t dataset_id, const vector<hsize_t>& rows, double* data) {
+  hdf5_load_nd_dataset_rows_helper(dataset_id, H5T_NATIVE_DOUBLE, rows, data);
+}
+
 template <>
 void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<float>* blob) {
+  HDF5Lock lock;
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
   herr_t status = H5LTread_dataset_float(
     file_id, dataset_name_, blob->mutable_cpu_data());
@@ -159,6 +422,7 @@ void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
 template <>
 void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<double>* blob) {
+  HDF5Lock lock;
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
   herr_t status = H5LTread_dataset_double(
     file_id, dataset_name_, blob->mutable_cpu_data());
@@ -168,6 +432,7 @@ void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
 template <>
 void hdf5_save_nd_dataset<float>(
     const hid_t file_id, const string dataset_name, const Blob<float>& blob) {
+  HDF5Lock lock;
   hsize_t dims[HDF5_NUM_DIMS];
   dims[0] = blob.num();
   dims[1] = blob.channels();
@@ -181,6 +446,7 @@ void hdf5_save_nd_dataset<float>(
 template <>
 void hdf5_save_nd_dataset<double>(
     const hid_t file_id, const string dataset_name, const Blob<double>& blob) {
+  HDF5Lock lock;
   hsize_t dims[HDF5_NUM_DIMS];
   dims[0] = blob.num();
   dims[1] = blob.channels();
@@ -0,0 +1,176 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "caffe/util/mmap_dataset.hpp"
+
+namespace caffe {
+
+static const char kMMapDatasetMagic[8] = "CAFFEMM";
+static const uint32_t kMMapDatasetVersion = 1;
+// Records start at this offset so that float payloads are aligned.
+static const uint64_t kMMapDatasetDataOffset = 64;
+
+static size_t ElementSize(const uint32_t data_type) {
+  return data_type == MMapDataset::FLOAT ? sizeof(float) : sizeof(uint8_t);
+}
+
+MMapDataset::MMapDataset()
+    : header_(), fd_(-1), map_(NULL), map_size_(0) {}
+
+MMapDataset::~MMapDataset() {
+  Close();
+}
+
+void MMapDataset::Open(const string& filename) {
+  Close();
+  fd_ = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd_, -1) << "Failed to open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd_, &file_stat), 0) << "Failed to stat " << filename;
+  map_size_ = file_stat.st_size;
+  CHECK_GE(map_size_, sizeof(header_)) << filename << " is too short";
+  void* map = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd_, 0);
+  CHECK(map != MAP_FAILED) << "Failed to mmap " << filename;
+  map_ = static_cast<char*>(map);
+
+  header_ = *reinterpret_cast<const MMapDatasetHeader*>(map_);
+  CHECK_EQ(memcmp(header_.magic, kMMapDatasetMagic, sizeof(header_.magic)), 0)
+      << filename << " is not a memory-mapped dataset";
+  CHECK_EQ(header_.version, kMMapDatasetVersion)
+      << "Unsupported memory-mapped dataset version";
+  CHECK(header_.data_type == UINT8 || header_.data_type == FLOAT)
+      << "Unknown data type " << header_.data_type;
+  const uint64_t data_size = static_cast<uint64_t>(header_.num)
+      * record_size() * ElementSize(header_.data_type);
+  CHECK_LE(header_.data_offset + data_size, header_.label_offset);
+  CHECK_LE(header_.label_offset + header_.num * sizeof(int32_t), map_size_)
+      << filename << " is truncated";
+  CHECK_EQ(header_.label_offset % sizeof(int32_t), 0);
+}
+
+void MMapDataset::Close() {
+  if (map_) {
+    munmap(map_, map_size_);
+    map_ = NULL;
+  }
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+const uint8_t* MMapDataset::uint8_data(const int index) const {
+  DCHECK_EQ(data_type(), UINT8);
+  return reinterpret_cast<const uint8_t*>(map_ + header_.data_offset)
+      + static_cast<size_t>(index) * record_size();
+}
+
+const float* MMapDataset::float_data(const int index) const {
+  DCHECK_EQ(data_type(), FLOAT);
+  return reinterpret_cast<const float*>(map_ + header_.data_offset)
+      + static_cast<size_t>(index) * record_size();
+}
+
+int MMapDataset::label(const int index) const {
+  return reinterpret_cast<const int32_t*>(map_ + header_.label_offset)[index];
+}
+
+void MMapDataset::AdviseAccess(const bool random) const {
+  madvise(map_, map_size_, random ? MADV_RANDOM : MADV_SEQUENTIAL);
+}
+
+void MMapDataset::WillNeed(const int first, const int count) const {
+  const int end = std::min(first + count, num());
+  if (first >= end) {
+    return;
+  }
+  const size_t record_bytes = record_size() * ElementSize(header_.data_type);
+  // madvise needs a page-aligned start address.
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t begin = header_.data_offset + first * record_bytes;
+  const size_t length = header_.data_offset + end * record_bytes - begin;
+  const size_t page_begin = begin / page_size * page_size;
+  madvise(map_ + page_begin, length + begin - page_begin, MADV_WILLNEED);
+}
+
+MMapDatasetWriter::MMapDatasetWriter(const string& filename)
+    : header_(), file_(filename.c_str(), std::ios::out | std::ios::trunc |
+                       std::ios::binary) {
+  CHECK(file_.good()) << "Failed to open " << filename;
+  std::copy(kMMapDatasetMagic, kMMapDatasetMagic + sizeof(header_.magic),
+            header_.magic);
+  header_.version = kMMapDatasetVersion;
+  header_.data_offset = kMMapDatasetDataOffset;
+  // Reserve the space of the header, which is written on Close().
+  WriteHeader();
+}
+
+MMapDatasetWriter::~MMapDatasetWriter() {
+  Close();
+}
+
+void MMapDatasetWriter::WriteHeader() {
+  file_.seekp(0);
+  file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  const string padding(kMMapDatasetDataOffset - sizeof(header_), 0);
+  file_.write(padding.data(), padding.size());
+}
+
+void MMapDatasetWriter::Write(const Datum& datum) {
+  CHECK(file_.is_open()) << "Writer is closed";
+  CHECK(!datum.encoded()) << "Encoded datums cannot be memory-mapped";
+  CHECK(datum.half_data().empty() && datum.quantized_data().empty())
+      << "Datums of half or quantized data cannot be memory-mapped";
+  const bool is_float = datum.data().empty();
+  const uint32_t data_type = is_float ? MMapDataset::FLOAT : MMapDataset::UINT8;
+  if (header_.num == 0) {
+    header_.data_type = data_type;
+    header_.channels = datum.channels();
+    header_.height = datum.height();
+    header_.width = datum.width();
+  }
+  CHECK_EQ(header_.data_type, data_type)
+      << "All records must have the same data type";
+  CHECK_EQ(static_cast<int>(header_.channels), datum.channels());
+  CHECK_EQ(static_cast<int>(header_.height), datum.height());
+  CHECK_EQ(static_cast<int>(header_.width), datum.width());
+  const int size = datum.channels() * datum.height() * datum.width();
+  if (is_float) {
+    CHECK_EQ(datum.float_data_size(), size) << "Incorrect data field size";
+    file_.write(reinterpret_cast<const char*>(datum.float_data().data()),
+                size * sizeof(float));
+  } else {
+    CHECK_EQ(static_cast<int>(datum.data().size()), size)
+        << "Incorrect data field size";
+    file_.write(datum.data().data(), size);
+  }
+  labels_.push_back(datum.label());
+  ++header_.num;
+}
+
+void MMapDatasetWriter::Close() {
+  if (!file_.is_open()) {
+    return;
+  }
+  header_.label_offset = file_.tellp();
+  // Keep the labels aligned.
+  const int padding = (sizeof(int32_t) - header_.label_offset % sizeof(int32_t))
+      % sizeof(int32_t);
+  header_.label_offset += padding;
+  file_.write(string(padding, 0).data(), padding);
+  if (!labels_.empty()) {
+    file_.write(reinterpret_cast<const char*>(&labels_[0]),
+                labels_.size() * sizeof(int32_t));
+  }
+  WriteHeader();
+  CHECK(file_.good()) << "Failed to write the memory-mapped dataset";
+  file_.close();
+}
+
+}  // namespace caffe
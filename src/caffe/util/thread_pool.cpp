@@ -0,0 +1,172 @@
+#include <boost/exception_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <deque>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+shared_ptr<ThreadPool> ThreadPool::singleton_;
+int ThreadPool::default_num_threads_ = -1;
+// Get() is called from the prefetch threads of several data layers.
+static boost::mutex singleton_mutex_;
+
+// The items of one Run call. It lives on the caller's stack; workers only
+// touch it while they own an unfinished item, and Run does not return, nor
+// unwind, before all items are finished.
+class ThreadPool::Job {
+ public:
+  Job(int n, const boost::function<void(int)>* body)
+      : n_(n), next_(0), done_(0), body_(body) {}
+  int n_;
+  int next_;
+  int done_;
+  const boost::function<void(int)>* body_;
+  boost::condition_variable finished_;
+  // The first exception thrown by an item, rethrown by Run.
+  boost::exception_ptr error_;
+};
+
+// Calls body(item), recording what it throws in error instead of letting it
+// escape.
+static void RunItem(const boost::function<void(int)>& body, int item,
+    boost::exception_ptr* error) {
+  try {
+    body(item);
+  } catch (...) {
+    *error = boost::current_exception();
+  }
+}
+
+class ThreadPool::sync {
+ public:
+  sync() : stop_(false) {}
+  boost::mutex mutex_;
+  boost::condition_variable work_available_;
+  // Jobs that still have unclaimed items, oldest first.
+  std::deque<Job*> jobs_;
+  bool stop_;
+  boost::thread_group threads_;
+};
+
+ThreadPool& ThreadPool::Get() {
+  boost::mutex::scoped_lock lock(singleton_mutex_);
+  if (!singleton_.get()) {
+    int num_threads = default_num_threads_;
+    if (num_threads < 0) {
+      num_threads = boost::thread::hardware_concurrency();
+    }
+    singleton_.reset(new ThreadPool(num_threads));
+  }
+  return *singleton_;
+}
+
+void ThreadPool::set_default_num_threads(int num_threads) {
+  boost::mutex::scoped_lock lock(singleton_mutex_);
+  if (singleton_.get()) {
+    LOG(WARNING) << "The data thread pool is already running with "
+                 << singleton_->num_threads() << " threads; ignoring request "
+                 << "for " << num_threads;
+  }
+  default_num_threads_ = num_threads;
+}
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(std::max(num_threads, 0)), sync_(new sync()) {
+  for (int i = 0; i < num_threads_; ++i) {
+    sync_->threads_.create_thread(
+        boost::bind(&ThreadPool::WorkerEntry, this));
+  }
+  DLOG(INFO) << "Started thread pool with " << num_threads_ << " workers";
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    sync_->stop_ = true;
+  }
+  sync_->work_available_.notify_all();
+  sync_->threads_.join_all();
+}
+
+void ThreadPool::WorkerEntry() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (true) {
+    while (!sync_->stop_ && sync_->jobs_.empty()) {
+      sync_->work_available_.wait(lock);
+    }
+    if (sync_->stop_) {
+      return;
+    }
+    Job* job = sync_->jobs_.front();
+    const int item = job->next_++;
+    if (job->next_ == job->n_) {
+      sync_->jobs_.pop_front();
+    }
+    lock.unlock();
+    boost::exception_ptr error;
+    RunItem(*job->body_, item, &error);
+    lock.lock();
+    if (error && !job->error_) {
+      job->error_ = error;
+    }
+    if (++job->done_ == job->n_) {
+      job->finished_.notify_all();
+    }
+  }
+}
+
+void ThreadPool::Run(int n, const boost::function<void(int)>& body) {
+  if (n <= 0) {
+    return;
+  }
+  if (num_threads_ == 0 || n == 1) {
+    boost::exception_ptr first_error;
+    for (int i = 0; i < n; ++i) {
+      boost::exception_ptr error;
+      RunItem(body, i, &error);
+      if (error && !first_error) {
+        first_error = error;
+      }
+    }
+    if (first_error) {
+      boost::rethrow_exception(first_error);
+    }
+    return;
+  }
+  // Once published, the job must outlive the workers' items, so neither an
+  // interruption of the calling thread (e.g. a prefetch thread being stopped)
+  // nor an exception from body may unwind it early.
+  boost::this_thread::disable_interruption no_interruption;
+  Job job(n, &body);
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  sync_->jobs_.push_back(&job);
+  sync_->work_available_.notify_all();
+  // Work on our own job until all of its items are claimed...
+  while (job.next_ < job.n_) {
+    const int item = job.next_++;
+    if (job.next_ == job.n_) {
+      sync_->jobs_.erase(
+          std::find(sync_->jobs_.begin(), sync_->jobs_.end(), &job));
+    }
+    lock.unlock();
+    boost::exception_ptr error;
+    RunItem(body, item, &error);
+    lock.lock();
+    if (error && !job.error_) {
+      job.error_ = error;
+    }
+    ++job.done_;
+  }
+  // ...then wait for the items still being processed by workers.
+  while (job.done_ < job.n_) {
+    job.finished_.wait(lock);
+  }
+  if (job.error_) {
+    boost::rethrow_exception(job.error_);
+  }
+}
+
+}  // namespace caffe
@@ -2,15 +2,22 @@
 
 #include <cstring>
 #include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
+using caffe::BasePrefetchingDataLayer;
 using caffe::Blob;
 using caffe::Caffe;
+using caffe::CPUTimer;
 using caffe::Net;
+using caffe::NetParameter;
 using caffe::Layer;
+using caffe::PrefetchStats;
 using caffe::shared_ptr;
 using caffe::Timer;
 using caffe::vector;
@@ -29,6 +36,13 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(data_threads, -1,
+    "Optional; the number of threads shared by the data layers to decode and "
+    "transform batches. 0 loads on the prefetch threads only; the default "
+    "uses one thread per core.");
+DEFINE_string(phase, "train",
+    "Optional; the phase of the net whose data layers datatime runs: train "
+    "or test.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -266,6 +280,98 @@ int time() {
 }
 RegisterBrewFunction(time);
 
+
+// Data time: benchmark the data layers of a model on their own, pulling
+// batches as fast as they come, to tell whether they can keep up with the
+// rest of the net (compare the records/s with `caffe time`).
+int datatime() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
+  CHECK_GT(FLAGS_iterations, 0);
+  CHECK(FLAGS_phase == "train" || FLAGS_phase == "test")
+      << "Unknown phase: " << FLAGS_phase;
+
+  // Set device id and mode
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_phase(FLAGS_phase == "train" ? Caffe::TRAIN : Caffe::TEST);
+  // Instantiate the data layers only: those without bottoms. Layers working
+  // in place on their tops come after them and are left out.
+  NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  NetParameter filtered_param;
+  Net<float>::FilterNet(param, &filtered_param);
+  param.CopyFrom(filtered_param);
+  param.clear_layers();
+  for (int i = 0; i < filtered_param.layers_size(); ++i) {
+    const caffe::LayerParameter& layer_param = filtered_param.layers(i);
+    if (layer_param.bottom_size() == 0) {
+      param.add_layers()->CopyFrom(layer_param);
+    } else {
+      LOG(INFO) << "Pruning layer " << layer_param.name();
+    }
+  }
+  CHECK_GT(param.layers_size(), 0) << "The model has no data layers.";
+  Net<float> caffe_net(param);
+
+  // Pull a first batch, so that the setup is not timed.
+  caffe_net.ForwardPrefilled();
+  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
+  vector<shared_ptr<BasePrefetchingDataLayer<float> > > prefetching_layers;
+  for (int i = 0; i < layers.size(); ++i) {
+    prefetching_layers.push_back(boost::dynamic_pointer_cast<
+        BasePrefetchingDataLayer<float> >(layers[i]));
+    if (prefetching_layers[i]) {
+      prefetching_layers[i]->ResetPrefetchStats();
+    }
+  }
+  LOG(INFO) << "*** Benchmark begins ***";
+  LOG(INFO) << "Testing for " << FLAGS_iterations << " iterations.";
+  CPUTimer timer;
+  for (int j = 0; j < FLAGS_iterations; ++j) {
+    caffe_net.ForwardPrefilled();
+  }
+  const double total_ms = timer.MilliSeconds();
+  LOG(INFO) << "Total Time: " << total_ms << " milliseconds.";
+  for (int i = 0; i < layers.size(); ++i) {
+    const caffe::string& layername = layers[i]->layer_param().name();
+    const int batch_size = caffe_net.top_vecs()[i][0]->num();
+    LOG(INFO) << layername << "\t" << batch_size * FLAGS_iterations * 1000.
+        / total_ms << " records/s.";
+    if (!prefetching_layers[i]) {
+      continue;
+    }
+    // The work of the prefetch thread for the batches pulled. With LMDB and
+    // memory-mapped datasets, the pages are mostly read while transforming.
+    const PrefetchStats& stats = prefetching_layers[i]->prefetch_stats();
+    if (stats.bytes_read > 0) {
+      LOG(INFO) << layername << "\tread: " << stats.bytes_read / 1048576.
+          * 1000. / total_ms << " MB/s.";
+    }
+    std::ostringstream split;
+    if (stats.read_time > 0 || stats.transform_time > 0) {
+      split << " (read " << stats.read_time / stats.batches
+            << " ms, decode and transform " << stats.transform_time /
+            stats.batches << " ms)";
+    }
+    LOG(INFO) << layername << "\tload: " << stats.load_time / stats.batches
+        << " milliseconds per batch" << split.str() << ".";
+    // What a net taking no time would wait for each batch; one taking t ms
+    // per batch waits about t ms less.
+    LOG(INFO) << layername << "\twait: " << stats.wait_time / stats.batches
+        << " milliseconds per batch (" << 100. * stats.wait_time / total_ms
+        << "% of the time).";
+  }
+  LOG(INFO) << "*** Benchmark ends ***";
+  return 0;
+}
+RegisterBrewFunction(datatime);
+
 int main(int argc, char** argv) {
   // Print output to stderr (while still logging).
   FLAGS_alsologtostderr = 1;
@@ -276,9 +382,11 @@ int main(int argc, char** argv) {
       "  train           train or finetune a model\n"
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
-      "  time            benchmark model execution time");
+      "  time            benchmark model execution time\n"
+      "  datatime        benchmark the data layers of a model");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::ThreadPool::set_default_num_threads(FLAGS_data_threads);
   if (argc == 2) {
     return GetBrewFunction(caffe::string(argv[1]))();
   } else {
@@ -1,24 +1,286 @@
+// This program computes the mean image of a database of Datums, and
+// optionally the mean and standard deviation of each channel.
+// Usage:
+//   compute_image_mean [FLAGS] INPUT_DB OUTPUT_FILE [DB_BACKEND]
+//
+// The database is split into as many ranges of consecutive records as there
+// are threads; each thread reads its range with a cursor of its own into
+// private sums, which are added up at the end. LevelDBs are split by their
+// size on disk, so that the records are only read once.
+
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <leveldb/db.h>
 #include <lmdb.h>
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include <algorithm>
+#include <cmath>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/float_codec.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/mmap_dataset.hpp"
 
 using caffe::Datum;
+using caffe::DatumView;
 using caffe::BlobProto;
+using caffe::MMapDataset;
 using std::string;
-using std::max;
+using std::vector;
+
+DEFINE_int32(threads, 0,
+    "The number of threads reading the database; 0 uses one per hardware "
+    "thread");
+DEFINE_bool(channel_stats, false,
+    "Also compute the mean and standard deviation of each channel, e.g. for "
+    "the mean_value of TransformationParameter");
+
+// The sums over the records of one range. uint8 pixels are summed exactly
+// into integers, float pixels into doubles.
+class MeanAccumulator {
+ public:
+  MeanAccumulator(int channels, int size)
+      : channels_(channels), size_(size), count_(0), uint8_sum_(size, 0),
+        float_sum_(size, 0.), uint8_channel_sum_sq_(channels, 0),
+        float_channel_sum_sq_(channels, 0.) {}
+
+  // Adds one serialized Datum. Raw uint8 and compact float records are read
+  // in place from the database buffer; others are parsed into datum.
+  void AddRecord(const void* record, size_t record_size, Datum* datum) {
+    DatumView view;
+    if (caffe::ParseDatumView(record, record_size, &view)) {
+      if (view.half_data) {
+        CHECK_EQ(view.data_size, 2 * size_)
+            << "Incorrect half_data size " << view.data_size;
+        float_values_.resize(size_);
+        caffe::DecodeHalf(view.half_data, size_, &float_values_[0]);
+        AddPixels(&float_values_[0]);
+      } else if (view.quantized_data) {
+        CHECK_EQ(view.data_size, size_)
+            << "Incorrect quantized_data size " << view.data_size;
+        float_values_.resize(size_);
+        caffe::DecodeQuantized(view.quantized_data, size_,
+            view.quantized_scale, view.quantized_offset, &float_values_[0]);
+        AddPixels(&float_values_[0]);
+      } else {
+        CHECK_EQ(view.data_size, size_)
+            << "Incorrect data field size " << view.data_size;
+        AddPixels(view.data);
+      }
+      return;
+    }
+    datum->ParseFromArray(record, record_size);
+    CHECK(caffe::DecodeDatum(datum)) << "Failed to decode Datum";
+    const string& data = datum->data();
+    int size_in_datum = std::max<int>(datum->data().size(),
+        datum->float_data_size());
+    CHECK_EQ(size_in_datum, size_)
+        << "Incorrect data field size " << size_in_datum;
+    if (data.size() != 0) {
+      AddPixels(reinterpret_cast<const uint8_t*>(data.data()));
+    } else {
+      AddPixels(datum->float_data().data());
+    }
+  }
+
+  void AddPixels(const uint8_t* data) {
+    const int dim = size_ / channels_;
+    for (int c = 0; c < channels_; ++c) {
+      const uint8_t* channel_data = data + c * dim;
+      uint64_t* channel_sum = &uint8_sum_[c * dim];
+      uint64_t sum_sq = 0;
+      for (int i = 0; i < dim; ++i) {
+        const uint32_t pixel = channel_data[i];
+        channel_sum[i] += pixel;
+        sum_sq += pixel * pixel;
+      }
+      uint8_channel_sum_sq_[c] += sum_sq;
+    }
+    ++count_;
+  }
+
+  void AddPixels(const float* data) {
+    const int dim = size_ / channels_;
+    for (int c = 0; c < channels_; ++c) {
+      const float* channel_data = data + c * dim;
+      double* channel_sum = &float_sum_[c * dim];
+      double sum_sq = 0;
+      for (int i = 0; i < dim; ++i) {
+        const double pixel = channel_data[i];
+        channel_sum[i] += pixel;
+        sum_sq += pixel * pixel;
+      }
+      float_channel_sum_sq_[c] += sum_sq;
+    }
+    ++count_;
+  }
+
+  void Merge(const MeanAccumulator& other) {
+    for (int i = 0; i < size_; ++i) {
+      uint8_sum_[i] += other.uint8_sum_[i];
+      float_sum_[i] += other.float_sum_[i];
+    }
+    for (int c = 0; c < channels_; ++c) {
+      uint8_channel_sum_sq_[c] += other.uint8_channel_sum_sq_[c];
+      float_channel_sum_sq_[c] += other.float_channel_sum_sq_[c];
+    }
+    count_ += other.count_;
+  }
+
+  int64_t count() const { return count_; }
+  double sum(int i) const { return uint8_sum_[i] + float_sum_[i]; }
+  double channel_sum_sq(int c) const {
+    return uint8_channel_sum_sq_[c] + float_channel_sum_sq_[c];
+  }
+
+ protected:
+  int channels_;
+  int size_;
+  int64_t count_;
+  vector<uint64_t> uint8_sum_;
+  vector<double> float_sum_;
+  vector<uint64_t> uint8_channel_sum_sq_;
+  vector<double> float_channel_sum_sq_;
+  // The expanded values of a half or quantized record.
+  vector<float> float_values_;
+};
+
+uint64_t ApproximateLevelDBSize(leveldb::DB* db, const string& start_key,
+    const string& limit_key) {
+  const leveldb::Range range(start_key, limit_key);
+  uint64_t size;
+  db->GetApproximateSizes(&range, 1, &size);
+  return size;
+}
+
+// Picks the first keys of num_ranges ranges of a LevelDB of about the same
+// size on disk, without reading the records: the keys between first_key and
+// last_key are seen as numbers from the first byte they differ at, and each
+// split key is bisected on GetApproximateSizes. A database still in its log
+// files is not sized, and makes a single range.
+vector<string> SplitLevelDB(leveldb::DB* db, const string& first_key,
+    const string& last_key, int num_ranges) {
+  vector<string> start_keys(1, first_key);
+  const uint64_t total_size = ApproximateLevelDBSize(db, first_key, last_key);
+  if (total_size == 0) {
+    return start_keys;
+  }
+  size_t prefix_size = 0;
+  while (prefix_size < first_key.size() && prefix_size < last_key.size() &&
+         first_key[prefix_size] == last_key[prefix_size]) {
+    ++prefix_size;
+  }
+  const string prefix = first_key.substr(0, prefix_size);
+  // The 8 bytes from prefix_size on, big-endian, and back.
+  const int kDigits = 8;
+  uint64_t low = 0, high = 0;
+  for (int i = 0; i < kDigits; ++i) {
+    const size_t pos = prefix_size + i;
+    low = (low << 8) | (pos < first_key.size() ?
+        static_cast<uint8_t>(first_key[pos]) : 0);
+    high = (high << 8) | (pos < last_key.size() ?
+        static_cast<uint8_t>(last_key[pos]) : 0);
+  }
+  string key(prefix.size() + kDigits, '\0');
+  for (int t = 1; t < num_ranges; ++t) {
+    const uint64_t target_size = total_size * t / num_ranges;
+    // The smallest key from low on with target_size before it.
+    uint64_t end = high;
+    while (low < end) {
+      const uint64_t mid = low + (end - low) / 2;
+      key = prefix;
+      for (int i = kDigits - 1; i >= 0; --i) {
+        key.push_back(static_cast<char>((mid >> (8 * i)) & 0xff));
+      }
+      if (ApproximateLevelDBSize(db, first_key, key) < target_size) {
+        low = mid + 1;
+      } else {
+        end = mid;
+      }
+    }
+    key = prefix;
+    for (int i = kDigits - 1; i >= 0; --i) {
+      key.push_back(static_cast<char>((low >> (8 * i)) & 0xff));
+    }
+    if (key > start_keys.back()) {
+      start_keys.push_back(key);
+    }
+  }
+  return start_keys;
+}
+
+// ScanLevelDBRange reads the records from start_key to limit_key, excluded,
+// or to the end if limit_key is empty. The other ScanRanges read count
+// records from start_key, or first, on.
+void ScanLevelDBRange(leveldb::DB* db, const string& start_key,
+    const string& limit_key, MeanAccumulator* accumulator) {
+  leveldb::ReadOptions read_options;
+  read_options.fill_cache = false;
+  leveldb::Iterator* it = db->NewIterator(read_options);
+  Datum datum;
+  for (it->Seek(start_key); it->Valid() && (limit_key.empty() ||
+       it->key().compare(limit_key) < 0); it->Next()) {
+    accumulator->AddRecord(it->value().data(), it->value().size(), &datum);
+  }
+  delete it;
+}
+
+void ScanLMDBRange(MDB_env* mdb_env, MDB_dbi mdb_dbi, const string& start_key,
+    int64_t count, MeanAccumulator* accumulator) {
+  // Read transactions belong to the thread that begins them.
+  MDB_txn* mdb_txn;
+  MDB_cursor* mdb_cursor;
+  CHECK_EQ(mdb_txn_begin(mdb_env, NULL, MDB_RDONLY, &mdb_txn), MDB_SUCCESS)
+      << "mdb_txn_begin failed";
+  CHECK_EQ(mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor), MDB_SUCCESS)
+      << "mdb_cursor_open failed";
+  MDB_val mdb_key, mdb_value;
+  mdb_key.mv_size = start_key.size();
+  mdb_key.mv_data = const_cast<char*>(start_key.data());
+  MDB_cursor_op op = MDB_SET_KEY;
+  Datum datum;
+  for (int64_t i = 0; i < count; ++i, op = MDB_NEXT) {
+    CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, op), MDB_SUCCESS)
+        << "Database ended early";
+    accumulator->AddRecord(mdb_value.mv_data, mdb_value.mv_size, &datum);
+  }
+  mdb_cursor_close(mdb_cursor);
+  mdb_txn_abort(mdb_txn);
+}
+
+void ScanMMapRange(const MMapDataset* dataset, int first, int count,
+    MeanAccumulator* accumulator) {
+  for (int i = first; i < first + count; ++i) {
+    if (dataset->data_type() == MMapDataset::UINT8) {
+      accumulator->AddPixels(dataset->uint8_data(i));
+    } else {
+      accumulator->AddPixels(dataset->float_data(i));
+    }
+  }
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Compute the mean image of a database of Datums.\n"
+        "Usage:\n"
+        "    compute_image_mean [FLAGS] INPUT_DB OUTPUT_FILE "
+        "[DB_BACKEND: leveldb, lmdb (default) or mmap]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
   if (argc < 3 || argc > 4) {
-    LOG(ERROR) << "Usage: compute_image_mean input_db output_file"
-               << " db_backend[leveldb or lmdb]";
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/compute_image_mean");
     return 1;
   }
 
@@ -26,20 +288,30 @@ int main(int argc, char** argv) {
   if (argc == 4) {
     db_backend = string(argv[3]);
   }
+  int num_threads = FLAGS_threads;
+  if (num_threads <= 0) {
+    num_threads = std::max<int>(boost::thread::hardware_concurrency(), 1);
+  }
 
   // leveldb
   leveldb::DB* db;
   leveldb::Options options;
   options.create_if_missing = false;
-  leveldb::Iterator* it = NULL;
   // lmdb
   MDB_env* mdb_env;
   MDB_dbi mdb_dbi;
   MDB_val mdb_key, mdb_value;
   MDB_txn* mdb_txn;
   MDB_cursor* mdb_cursor;
+  // mmap
+  MMapDataset dataset;
 
-  // Open db
+  // Open db, and collect the keys to split it into ranges: all of them for
+  // LMDB, the first of each range for LevelDB.
+  vector<string> keys;
+  int64_t num_records = 0;
+  int num_ranges = num_threads;
+  Datum datum;
   if (db_backend == "leveldb") {  // leveldb
     LOG(INFO) << "Opening leveldb " << argv[1];
     leveldb::Status status = leveldb::DB::Open(
@@ -47,8 +319,15 @@ int main(int argc, char** argv) {
     CHECK(status.ok()) << "Failed to open leveldb " << argv[1];
     leveldb::ReadOptions read_options;
     read_options.fill_cache = false;
-    it = db->NewIterator(read_options);
+    leveldb::Iterator* it = db->NewIterator(read_options);
     it->SeekToFirst();
+    CHECK(it->Valid()) << "The database is empty";
+    datum.ParseFromArray(it->value().data(), it->value().size());
+    const string first_key = it->key().ToString();
+    it->SeekToLast();
+    keys = SplitLevelDB(db, first_key, it->key().ToString(), num_threads);
+    num_ranges = keys.size();
+    delete it;
   } else if (db_backend == "lmdb") {  // lmdb
     LOG(INFO) << "Opening lmdb " << argv[1];
     CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
@@ -62,107 +341,105 @@ int main(int argc, char** argv) {
     CHECK_EQ(mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor), MDB_SUCCESS)
         << "mdb_cursor_open failed";
     CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
-        MDB_SUCCESS);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
-  }
-
-  Datum datum;
-  BlobProto sum_blob;
-  int count = 0;
-  // load first datum
-  if (db_backend == "leveldb") {
-    datum.ParseFromString(it->value().ToString());
-  } else if (db_backend == "lmdb") {
+        MDB_SUCCESS) << "The database is empty";
     datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
+    // Walking the keys does not touch the (overflow) pages of the values.
+    do {
+      keys.push_back(string(static_cast<const char*>(mdb_key.mv_data),
+          mdb_key.mv_size));
+    } while (mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_NEXT)
+        == MDB_SUCCESS);
+    num_records = keys.size();
+    mdb_cursor_close(mdb_cursor);
+    mdb_txn_abort(mdb_txn);
+  } else if (db_backend == "mmap") {  // mmap
+    LOG(INFO) << "Opening memory-mapped dataset " << argv[1];
+    dataset.Open(argv[1]);
+    CHECK_GT(dataset.num(), 0) << "The database is empty";
+    num_records = dataset.num();
+    dataset.AdviseAccess(false);
+    datum.set_channels(dataset.channels());
+    datum.set_height(dataset.height());
+    datum.set_width(dataset.width());
   } else {
     LOG(FATAL) << "Unknown db backend " << db_backend;
   }
+  CHECK(caffe::DecodeDatum(&datum)) << "Failed to decode Datum";
 
+  BlobProto sum_blob;
   sum_blob.set_num(1);
   sum_blob.set_channels(datum.channels());
   sum_blob.set_height(datum.height());
   sum_blob.set_width(datum.width());
   const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
+  if (db_backend == "leveldb") {
+    LOG(INFO) << "Starting Iteration with " << num_ranges << " threads";
+  } else {
+    num_ranges = std::max<int64_t>(std::min<int64_t>(num_threads,
+                                                     num_records), 1);
+    LOG(INFO) << "Starting Iteration over " << num_records << " records with "
+              << num_ranges << " threads";
   }
-  LOG(INFO) << "Starting Iteration";
-  if (db_backend == "leveldb") {  // leveldb
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-      // just a dummy operation
-      datum.ParseFromString(it->value().ToString());
-      const string& data = datum.data();
-      size_in_datum = std::max<int>(datum.data().size(),
-          datum.float_data_size());
-      CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-          size_in_datum;
-      if (data.size() != 0) {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-        }
-      } else {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) +
-              static_cast<float>(datum.float_data(i)));
-        }
-      }
-      ++count;
-      if (count % 10000 == 0) {
-        LOG(ERROR) << "Processed " << count << " files.";
-      }
+  vector<MeanAccumulator> accumulators(num_ranges,
+      MeanAccumulator(datum.channels(), data_size));
+  boost::thread_group threads;
+  for (int t = 0; t < num_ranges; ++t) {
+    const int64_t first = num_records * t / num_ranges;
+    const int64_t count = num_records * (t + 1) / num_ranges - first;
+    if (db_backend == "leveldb") {
+      threads.create_thread(boost::bind(&ScanLevelDBRange, db, keys[t],
+          t + 1 < num_ranges ? keys[t + 1] : string(), &accumulators[t]));
+    } else if (db_backend == "lmdb") {
+      threads.create_thread(boost::bind(&ScanLMDBRange, mdb_env, mdb_dbi,
+          keys[first], count, &accumulators[t]));
+    } else {
+      threads.create_thread(boost::bind(&ScanMMapRange, &dataset, first,
+          count, &accumulators[t]));
     }
-  } else if (db_backend == "lmdb") {  // lmdb
-    CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
-        MDB_SUCCESS);
-    do {
-      // just a dummy operation
-      datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
-      const string& data = datum.data();
-      size_in_datum = std::max<int>(datum.data().size(),
-          datum.float_data_size());
-      CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-          size_in_datum;
-      if (data.size() != 0) {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-        }
-      } else {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) +
-              static_cast<float>(datum.float_data(i)));
-        }
-      }
-      ++count;
-      if (count % 10000 == 0) {
-        LOG(ERROR) << "Processed " << count << " files.";
-      }
-    } while (mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_NEXT)
-        == MDB_SUCCESS);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
   }
-
-  if (count % 10000 != 0) {
-    LOG(ERROR) << "Processed " << count << " files.";
+  threads.join_all();
+  for (int t = 1; t < num_ranges; ++t) {
+    accumulators[0].Merge(accumulators[t]);
   }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  const MeanAccumulator& total = accumulators[0];
+  const int64_t count = total.count();
+  LOG(ERROR) << "Processed " << count << " files.";
+
+  for (int i = 0; i < data_size; ++i) {
+    sum_blob.add_data(total.sum(i) / count);
   }
   // Write to disk
   LOG(INFO) << "Write to " << argv[2];
   WriteProtoToBinaryFile(sum_blob, argv[2]);
 
+  if (FLAGS_channel_stats) {
+    const int channels = datum.channels();
+    const int dim = data_size / channels;
+    std::ostringstream mean_values;
+    for (int c = 0; c < channels; ++c) {
+      double channel_sum = 0;
+      for (int i = c * dim; i < (c + 1) * dim; ++i) {
+        channel_sum += total.sum(i);
+      }
+      const double num_pixels = static_cast<double>(count) * dim;
+      const double mean = channel_sum / num_pixels;
+      const double variance = total.channel_sum_sq(c) / num_pixels
+          - mean * mean;
+      LOG(INFO) << "Channel " << c << ": mean " << mean << ", std "
+                << std::sqrt(std::max(variance, 0.));
+      mean_values << " mean_value: " << mean;
+    }
+    LOG(INFO) << "Per-channel mean for transform_param:" << mean_values.str();
+  }
+
   // Clean up
   if (db_backend == "leveldb") {
     delete db;
   } else if (db_backend == "lmdb") {
-    mdb_cursor_close(mdb_cursor);
     mdb_close(mdb_env, mdb_dbi);
-    mdb_txn_abort(mdb_txn);
     mdb_env_close(mdb_env);
+  } else if (db_backend == "mmap") {
+    dataset.Close();
   } else {
     LOG(FATAL) << "Unknown db backend " << db_backend;
   }
@@ -7,6 +7,9 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.JPEG 7
 //   ....
+//
+// The images are converted in chunks: while a pool of threads reads and
+// decodes a chunk, a writer thread stores the previous one, in list order.
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -15,6 +18,9 @@
 #include <lmdb.h>
 #include <sys/stat.h>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
@@ -22,8 +28,11 @@
 #include <vector>
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/mmap_dataset.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::pair;
@@ -33,9 +42,179 @@ DEFINE_bool(gray, false,
     "When this option is on, treat images as grayscale ones");
 DEFINE_bool(shuffle, false,
     "Randomly shuffle the order of images and their labels");
-DEFINE_string(backend, "lmdb", "The backend for storing the result");
+DEFINE_string(backend, "lmdb", "The backend for storing the result: lmdb, "
+    "leveldb or mmap (a memory-mapped file of fixed-size records)");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
+DEFINE_bool(encoded, false,
+    "Store the compressed images (e.g. JPEG) rather than their pixels; they "
+    "are decoded by the data layer");
+DEFINE_int32(threads, -1, "The number of threads decoding the images; "
+    "negative uses one per hardware thread");
+DEFINE_int32(chunk_size, 1000,
+    "The number of images decoded together, and written in one leveldb batch");
+DEFINE_int32(txn_size, 10000, "The number of images per lmdb transaction");
+
+// A chunk of consecutive lines of the list, decoded by the thread pool.
+struct Chunk {
+  int first_line;
+  // Whether each image could be read (not a vector<bool>, whose elements
+  // cannot be written concurrently), and its Datum; serialized to value
+  // unless written to a memory-mapped dataset.
+  std::vector<int> valid;
+  std::vector<Datum> datums;
+  std::vector<string> values;
+};
+
+// Stores the chunks in one of the backends. The records are written in list
+// order, with increasing keys, which lets lmdb append them.
+class ChunkWriter {
+ public:
+  ChunkWriter(const string& backend, const char* db_path,
+      const std::vector<std::pair<string, int> >& lines)
+      : backend_(backend), lines_(lines), count_(0), txn_count_(0),
+        data_size_(-1), db_(NULL), mmap_writer_(NULL) {
+    if (backend_ == "leveldb") {  // leveldb
+      LOG(INFO) << "Opening leveldb " << db_path;
+      leveldb::Options options;
+      options.error_if_exists = true;
+      options.create_if_missing = true;
+      options.write_buffer_size = 268435456;
+      leveldb::Status status = leveldb::DB::Open(options, db_path, &db_);
+      CHECK(status.ok()) << "Failed to open leveldb " << db_path
+          << ". Is it already existing?";
+    } else if (backend_ == "lmdb") {  // lmdb
+      LOG(INFO) << "Opening lmdb " << db_path;
+      CHECK_EQ(mkdir(db_path, 0744), 0)
+          << "mkdir " << db_path << "failed";
+      CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS)
+          << "mdb_env_create failed";
+      CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776),  // 1TB
+          MDB_SUCCESS) << "mdb_env_set_mapsize failed";
+      CHECK_EQ(mdb_env_open(mdb_env_, db_path, 0, 0664), MDB_SUCCESS)
+          << "mdb_env_open failed";
+      CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, 0, &mdb_txn_), MDB_SUCCESS)
+          << "mdb_txn_begin failed";
+      CHECK_EQ(mdb_open(mdb_txn_, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
+          << "mdb_open failed. Does the lmdb already exist?";
+    } else if (backend_ == "mmap") {  // mmap
+      LOG(INFO) << "Opening memory-mapped dataset " << db_path;
+      CHECK(!FLAGS_encoded) << "Encoded images cannot be memory-mapped";
+      mmap_writer_ = new MMapDatasetWriter(db_path);
+    } else {
+      LOG(FATAL) << "Unknown db backend " << backend_;
+    }
+  }
+
+  void Write(const Chunk* chunk) {
+    const int kMaxKeyLength = 256;
+    char key_cstr[kMaxKeyLength];
+    leveldb::WriteBatch batch;
+    for (int i = 0; i < chunk->valid.size(); ++i) {
+      if (!chunk->valid[i]) {
+        continue;
+      }
+      const Datum& datum = chunk->datums[i];
+      // The data size of encoded images varies; check the decoded size.
+      const int datum_size = FLAGS_encoded ?
+          datum.channels() * datum.height() * datum.width() :
+          datum.data().size();
+      if (data_size_ < 0) {
+        data_size_ = datum.channels() * datum.height() * datum.width();
+      } else {
+        CHECK_EQ(datum_size, data_size_) << "Incorrect data field size "
+            << datum_size;
+      }
+      // sequential
+      const int line_id = chunk->first_line + i;
+      snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
+          lines_[line_id].first.c_str());
+      string keystr(key_cstr);
+      const string& value = chunk->values[i];
+
+      // Put in db
+      if (backend_ == "leveldb") {  // leveldb
+        batch.Put(keystr, value);
+      } else if (backend_ == "lmdb") {  // lmdb
+        MDB_val mdb_key, mdb_data;
+        mdb_data.mv_size = value.size();
+        mdb_data.mv_data = const_cast<char*>(value.data());
+        mdb_key.mv_size = keystr.size();
+        mdb_key.mv_data = reinterpret_cast<void*>(&keystr[0]);
+        CHECK_EQ(mdb_put(mdb_txn_, mdb_dbi_, &mdb_key, &mdb_data, MDB_APPEND),
+            MDB_SUCCESS) << "mdb_put failed";
+        if (++txn_count_ == FLAGS_txn_size) {
+          CommitTransaction();
+          txn_count_ = 0;
+        }
+      } else if (backend_ == "mmap") {  // mmap
+        mmap_writer_->Write(datum);
+      }
+      ++count_;
+    }
+    if (backend_ == "leveldb") {
+      db_->Write(leveldb::WriteOptions(), &batch);
+    }
+  }
+
+  // Commits the last records and closes the database.
+  void Close() {
+    if (backend_ == "leveldb") {  // leveldb
+      delete db_;
+    } else if (backend_ == "lmdb") {  // lmdb
+      CHECK_EQ(mdb_txn_commit(mdb_txn_), MDB_SUCCESS)
+          << "mdb_txn_commit failed";
+      mdb_close(mdb_env_, mdb_dbi_);
+      mdb_env_close(mdb_env_);
+    } else if (backend_ == "mmap") {  // mmap
+      // Writes the labels and the header.
+      delete mmap_writer_;
+    }
+  }
+
+  int count() const { return count_; }
+
+ protected:
+  void CommitTransaction() {
+    CHECK_EQ(mdb_txn_commit(mdb_txn_), MDB_SUCCESS) << "mdb_txn_commit failed";
+    CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, 0, &mdb_txn_), MDB_SUCCESS)
+        << "mdb_txn_begin failed";
+  }
+
+  const string backend_;
+  const std::vector<std::pair<string, int> >& lines_;
+  int count_;
+  int txn_count_;
+  int data_size_;
+  // leveldb
+  leveldb::DB* db_;
+  // lmdb
+  MDB_env* mdb_env_;
+  MDB_dbi mdb_dbi_;
+  MDB_txn* mdb_txn_;
+  // mmap
+  MMapDatasetWriter* mmap_writer_;
+};
+
+// Reads one image of the chunk; runs on the thread pool.
+void ReadChunkImage(const std::vector<std::pair<string, int> >* lines,
+    const string* root_folder, Chunk* chunk, int i) {
+  const bool is_color = !FLAGS_gray;
+  const int resize_height = std::max<int>(0, FLAGS_resize_height);
+  const int resize_width = std::max<int>(0, FLAGS_resize_width);
+  const std::pair<string, int>& line = (*lines)[chunk->first_line + i];
+  Datum* datum = &chunk->datums[i];
+  if (FLAGS_encoded) {
+    chunk->valid[i] = ReadImageToEncodedDatum(*root_folder + line.first,
+        line.second, resize_height, resize_width, is_color, datum);
+  } else {
+    chunk->valid[i] = ReadImageToDatum(*root_folder + line.first,
+        line.second, resize_height, resize_width, is_color, datum);
+  }
+  if (chunk->valid[i] && FLAGS_backend != "mmap") {
+    datum->SerializeToString(&chunk->values[i]);
+  }
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -56,8 +235,9 @@ int main(int argc, char** argv) {
     gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_imageset");
     return 1;
   }
+  CHECK_GT(FLAGS_chunk_size, 0);
+  CHECK_GT(FLAGS_txn_size, 0);
 
-  bool is_color = !FLAGS_gray;
   std::ifstream infile(argv[2]);
   std::vector<std::pair<string, int> > lines;
   string filename;
@@ -72,125 +252,45 @@ int main(int argc, char** argv) {
   }
   LOG(INFO) << "A total of " << lines.size() << " images.";
 
-  const string& db_backend = FLAGS_backend;
-  const char* db_path = argv[3];
-
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
-
-  // Open new db
-  // lmdb
-  MDB_env *mdb_env;
-  MDB_dbi mdb_dbi;
-  MDB_val mdb_key, mdb_data;
-  MDB_txn *mdb_txn;
-  // leveldb
-  leveldb::DB* db;
-  leveldb::Options options;
-  options.error_if_exists = true;
-  options.create_if_missing = true;
-  options.write_buffer_size = 268435456;
-  leveldb::WriteBatch* batch = NULL;
-
-  // Open db
-  if (db_backend == "leveldb") {  // leveldb
-    LOG(INFO) << "Opening leveldb " << db_path;
-    leveldb::Status status = leveldb::DB::Open(
-        options, db_path, &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << db_path
-        << ". Is it already existing?";
-    batch = new leveldb::WriteBatch();
-  } else if (db_backend == "lmdb") {  // lmdb
-    LOG(INFO) << "Opening lmdb " << db_path;
-    CHECK_EQ(mkdir(db_path, 0744), 0)
-        << "mkdir " << db_path << "failed";
-    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS)  // 1TB
-        << "mdb_env_set_mapsize failed";
-    CHECK_EQ(mdb_env_open(mdb_env, db_path, 0, 0664), MDB_SUCCESS)
-        << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
-        << "mdb_open failed. Does the lmdb already exist?";
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
-  }
-
-  // Storing to db
-  string root_folder(argv[1]);
-  Datum datum;
-  int count = 0;
-  const int kMaxKeyLength = 256;
-  char key_cstr[kMaxKeyLength];
-  int data_size;
-  bool data_size_initialized = false;
-
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    if (!ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color, &datum)) {
-      continue;
-    }
-    if (!data_size_initialized) {
-      data_size = datum.channels() * datum.height() * datum.width();
-      data_size_initialized = true;
-    } else {
-      const string& data = datum.data();
-      CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-          << data.size();
-    }
-    // sequential
-    snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
-        lines[line_id].first.c_str());
-    string value;
-    datum.SerializeToString(&value);
-    string keystr(key_cstr);
-
-    // Put in db
-    if (db_backend == "leveldb") {  // leveldb
-      batch->Put(keystr, value);
-    } else if (db_backend == "lmdb") {  // lmdb
-      mdb_data.mv_size = value.size();
-      mdb_data.mv_data = reinterpret_cast<void*>(&value[0]);
-      mdb_key.mv_size = keystr.size();
-      mdb_key.mv_data = reinterpret_cast<void*>(&keystr[0]);
-      CHECK_EQ(mdb_put(mdb_txn, mdb_dbi, &mdb_key, &mdb_data, 0), MDB_SUCCESS)
-          << "mdb_put failed";
-    } else {
-      LOG(FATAL) << "Unknown db backend " << db_backend;
-    }
+  ThreadPool::set_default_num_threads(FLAGS_threads);
+  ChunkWriter writer(FLAGS_backend, argv[3], lines);
 
-    if (++count % 1000 == 0) {
-      // Commit txn
-      if (db_backend == "leveldb") {  // leveldb
-        db->Write(leveldb::WriteOptions(), batch);
-        delete batch;
-        batch = new leveldb::WriteBatch();
-      } else if (db_backend == "lmdb") {  // lmdb
-        CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_commit failed";
-        CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_begin failed";
-      } else {
-        LOG(FATAL) << "Unknown db backend " << db_backend;
-      }
-      LOG(ERROR) << "Processed " << count << " files.";
+  // Storing to db: decode a chunk while the previous one is written.
+  const string root_folder(argv[1]);
+  Chunk chunks[2];
+  boost::thread writer_thread;
+  // Reading a Timer stops it; restart it after each reading.
+  Timer timer;
+  float seconds = 0;
+  timer.Start();
+  for (int first_line = 0, chunk_id = 0; first_line < lines.size();
+       first_line += FLAGS_chunk_size, chunk_id = 1 - chunk_id) {
+    Chunk* chunk = &chunks[chunk_id];
+    const int size = std::min<int>(FLAGS_chunk_size,
+                                   lines.size() - first_line);
+    chunk->first_line = first_line;
+    chunk->valid.assign(size, 0);
+    chunk->datums.resize(size);
+    chunk->values.resize(size);
+    ThreadPool::Get().Run(size, boost::bind(&ReadChunkImage, &lines,
+        &root_folder, chunk, _1));
+    // Wait for the previous chunk, whose buffers are reused next.
+    if (writer_thread.joinable()) {
+      writer_thread.join();
     }
+    writer_thread = boost::thread(&ChunkWriter::Write, &writer, chunk);
+    seconds += timer.Seconds();
+    timer.Start();
+    LOG(ERROR) << "Processed " << first_line + size << " files ("
+        << (first_line + size) / seconds << " files/s).";
   }
-  // write the last batch
-  if (count % 1000 != 0) {
-    if (db_backend == "leveldb") {  // leveldb
-      db->Write(leveldb::WriteOptions(), batch);
-      delete batch;
-      delete db;
-    } else if (db_backend == "lmdb") {  // lmdb
-      CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
-      mdb_close(mdb_env, mdb_dbi);
-      mdb_env_close(mdb_env);
-    } else {
-      LOG(FATAL) << "Unknown db backend " << db_backend;
-    }
-    LOG(ERROR) << "Processed " << count << " files.";
+  if (writer_thread.joinable()) {
+    writer_thread.join();
   }
+  writer.Close();
+  seconds += timer.Seconds();
+  LOG(ERROR) << "Stored " << writer.count() << " of " << lines.size()
+      << " files in " << seconds << " s (" << writer.count() / seconds
+      << " files/s).";
   return 0;
 }
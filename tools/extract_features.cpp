@@ -1,20 +1,277 @@
+#include <stdint.h>
 #include <stdio.h>  // for snprintf
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/thread.hpp"
+#include "gflags/gflags.h"
+#include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/text_format.h"
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
+#include "lmdb.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/float_codec.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 #include "caffe/vision_layers.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
+using google::protobuf::io::CodedOutputStream;
+
+DEFINE_string(backend, "leveldb", "The format the features are saved in: "
+    "leveldb or lmdb, as Datums of float_data, or npy, a NumPy array file of "
+    "float32 rows that can be memory-mapped, e.g. with numpy.load(file, "
+    "mmap_mode='r')");
+DEFINE_string(float_encoding, "float", "How the features are stored: float, "
+    "half (IEEE 754 half precision) or quantized (8 bits per value, with a "
+    "scale and offset per row; not for npy)");
+DEFINE_bool(prune, true, "Only build and run the layers that the feature "
+    "blobs depend on; the weights of the other layers are not copied");
+
+// Serializes one row of features as a Datum of 1 x dim x 1 float_data. The
+// floats are written as one packed field, which Datum parsers accept like
+// the unpacked encoding, rather than through a protobuf call per float.
+void SerializeFeatureDatum(const float* data, int dim, string* value) {
+  if (FLAGS_float_encoding != "float") {
+    // The compact encodings are single bytes fields, serialized in one go.
+    Datum datum;
+    datum.set_channels(1);
+    datum.set_height(dim);
+    datum.set_width(1);
+    if (FLAGS_float_encoding == "half") {
+      SetHalfData(data, dim, &datum);
+    } else {
+      SetQuantizedData(data, dim, &datum);
+    }
+    datum.SerializeToString(value);
+    return;
+  }
+  // The wire types of varint and length-delimited fields.
+  const uint32_t kVarint = 0, kLengthDelimited = 2;
+  const uint32_t data_bytes = dim * sizeof(float);
+  value->resize(3 * (1 + CodedOutputStream::VarintSize32(dim))
+      + 1 + CodedOutputStream::VarintSize32(data_bytes) + data_bytes);
+  uint8_t* begin = reinterpret_cast<uint8_t*>(&(*value)[0]);
+  uint8_t* target = begin;
+  target = CodedOutputStream::WriteTagToArray(
+      Datum::kChannelsFieldNumber << 3 | kVarint, target);
+  target = CodedOutputStream::WriteVarint32ToArray(1, target);
+  target = CodedOutputStream::WriteTagToArray(
+      Datum::kHeightFieldNumber << 3 | kVarint, target);
+  target = CodedOutputStream::WriteVarint32ToArray(dim, target);
+  target = CodedOutputStream::WriteTagToArray(
+      Datum::kWidthFieldNumber << 3 | kVarint, target);
+  target = CodedOutputStream::WriteVarint32ToArray(1, target);
+  target = CodedOutputStream::WriteTagToArray(
+      Datum::kFloatDataFieldNumber << 3 | kLengthDelimited, target);
+  target = CodedOutputStream::WriteVarint32ToArray(data_bytes, target);
+  for (int d = 0; d < dim; ++d) {
+    uint32_t bits;
+    memcpy(&bits, data + d, sizeof(bits));  // NOLINT(caffe/alt_fn)
+    target = CodedOutputStream::WriteLittleEndian32ToArray(bits, target);
+  }
+  value->resize(target - begin);
+}
+
+// Saves the rows of features of one blob.
+class FeatureWriter {
+ public:
+  virtual ~FeatureWriter() {}
+  // Appends num rows of dim features.
+  virtual void Write(const float* data, int num, int dim) = 0;
+  virtual void Close() = 0;
+};
+
+class LevelDBFeatureWriter : public FeatureWriter {
+ public:
+  explicit LevelDBFeatureWriter(const string& name) : num_rows_(0) {
+    LOG(INFO) << "Opening leveldb " << name;
+    leveldb::Options options;
+    options.error_if_exists = true;
+    options.create_if_missing = true;
+    options.write_buffer_size = 268435456;
+    leveldb::DB* db;
+    leveldb::Status status = leveldb::DB::Open(options, name.c_str(), &db);
+    CHECK(status.ok()) << "Failed to open leveldb " << name;
+    db_.reset(db);
+  }
+  virtual void Write(const float* data, int num, int dim) {
+    const int kMaxKeyStrLength = 100;
+    char key_str[kMaxKeyStrLength];
+    string value;
+    leveldb::WriteBatch batch;
+    for (int n = 0; n < num; ++n, ++num_rows_) {
+      SerializeFeatureDatum(data + n * dim, dim, &value);
+      snprintf(key_str, kMaxKeyStrLength, "%d", num_rows_);
+      batch.Put(string(key_str), value);
+    }
+    db_->Write(leveldb::WriteOptions(), &batch);
+  }
+  virtual void Close() { db_.reset(); }
+
+ protected:
+  shared_ptr<leveldb::DB> db_;
+  int num_rows_;
+};
+
+class LMDBFeatureWriter : public FeatureWriter {
+ public:
+  explicit LMDBFeatureWriter(const string& name) : num_rows_(0) {
+    LOG(INFO) << "Opening lmdb " << name;
+    CHECK_EQ(mkdir(name.c_str(), 0744), 0) << "mkdir " << name << " failed";
+    CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS) << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776),  // 1TB
+        MDB_SUCCESS) << "mdb_env_set_mapsize failed";
+    CHECK_EQ(mdb_env_open(mdb_env_, name.c_str(), 0, 0664), MDB_SUCCESS)
+        << "mdb_env_open failed";
+    MDB_txn* mdb_txn;
+    CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, 0, &mdb_txn), MDB_SUCCESS)
+        << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
+        << "mdb_open failed. Does the lmdb already exist?";
+    CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
+  }
+  virtual void Write(const float* data, int num, int dim) {
+    const int kMaxKeyStrLength = 100;
+    char key_str[kMaxKeyStrLength];
+    string value;
+    MDB_txn* mdb_txn;
+    CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, 0, &mdb_txn), MDB_SUCCESS)
+        << "mdb_txn_begin failed";
+    for (int n = 0; n < num; ++n, ++num_rows_) {
+      SerializeFeatureDatum(data + n * dim, dim, &value);
+      // Zero padded, so that the keys are in order and can be appended.
+      const int key_size = snprintf(key_str, kMaxKeyStrLength, "%010d",
+                                    num_rows_);
+      MDB_val mdb_key, mdb_data;
+      mdb_key.mv_size = key_size;
+      mdb_key.mv_data = key_str;
+      mdb_data.mv_size = value.size();
+      mdb_data.mv_data = &value[0];
+      CHECK_EQ(mdb_put(mdb_txn, mdb_dbi_, &mdb_key, &mdb_data, MDB_APPEND),
+          MDB_SUCCESS) << "mdb_put failed";
+    }
+    CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
+  }
+  virtual void Close() {
+    mdb_close(mdb_env_, mdb_dbi_);
+    mdb_env_close(mdb_env_);
+  }
+
+ protected:
+  MDB_env* mdb_env_;
+  MDB_dbi mdb_dbi_;
+  int num_rows_;
+};
+
+// Writes a version 1.0 .npy file: a magic string, the length of the header,
+// and a header describing the array as a Python dict literal, padded so that
+// the float32 (or float16) rows that follow are aligned. The header has a
+// fixed size, so that it can be rewritten with the number of rows once they
+// are all written.
+class NpyFeatureWriter : public FeatureWriter {
+ public:
+  explicit NpyFeatureWriter(const string& name)
+      : file_(name.c_str(), std::ios::out | std::ios::trunc |
+              std::ios::binary),
+        num_rows_(0), dim_(0) {
+    LOG(INFO) << "Opening npy file " << name;
+    CHECK(file_.good()) << "Failed to open " << name;
+    WriteHeader();
+  }
+  virtual void Write(const float* data, int num, int dim) {
+    CHECK(dim_ == 0 || dim_ == dim) << "The feature dimension changed";
+    dim_ = dim;
+    const size_t count = static_cast<size_t>(num) * dim;
+    if (FLAGS_float_encoding == "half") {
+      half_data_.resize(2 * count);
+      EncodeHalf(data, count, &half_data_[0]);
+      file_.write(reinterpret_cast<const char*>(&half_data_[0]),
+                  half_data_.size());
+    } else {
+      file_.write(reinterpret_cast<const char*>(data), count * sizeof(float));
+    }
+    num_rows_ += num;
+  }
+  virtual void Close() {
+    WriteHeader();
+    CHECK(file_.good()) << "Failed to write the npy file";
+    file_.close();
+  }
+
+ protected:
+  static const int kHeaderSize = 128;
+
+  void WriteHeader() {
+    std::ostringstream header;
+    header << "{'descr': '" << (FLAGS_float_encoding == "half" ? "<f2" : "<f4")
+           << "', 'fortran_order': False, 'shape': ("
+           << num_rows_ << ", " << dim_ << "), }";
+    string header_str = header.str();
+    // magic (6) + version (2) + header length (2) + header, ending in \n
+    const int header_length = kHeaderSize - 10;
+    CHECK_LT(header_str.size(), header_length);
+    header_str.resize(header_length - 1, ' ');
+    header_str += '\n';
+    file_.seekp(0);
+    file_.write("\x93NUMPY\x01\x00", 8);
+    const char length_bytes[2] = {
+        static_cast<char>(header_length & 0xff),
+        static_cast<char>(header_length >> 8) };
+    file_.write(length_bytes, 2);
+    file_.write(header_str.data(), header_str.size());
+    file_.seekp(0, std::ios::end);
+  }
+
+  std::ofstream file_;
+  int64_t num_rows_;
+  int dim_;
+  vector<uint8_t> half_data_;
+};
+
+FeatureWriter* CreateFeatureWriter(const string& backend, const string& name) {
+  if (backend == "leveldb") {
+    return new LevelDBFeatureWriter(name);
+  } else if (backend == "lmdb") {
+    return new LMDBFeatureWriter(name);
+  } else if (backend == "npy") {
+    CHECK_NE(FLAGS_float_encoding, "quantized")
+        << "Quantized features cannot be stored in npy files";
+    return new NpyFeatureWriter(name);
+  }
+  LOG(FATAL) << "Unknown feature backend " << backend;
+  return NULL;
+}
+
+// Writes the features of one mini-batch; runs on the writer thread, while
+// the next mini-batch is forwarded.
+void WriteFeatures(const vector<shared_ptr<FeatureWriter> >* writers,
+    const vector<vector<float> >* features, const vector<int>* batch_sizes,
+    vector<int>* image_indices, const vector<string>* blob_names) {
+  for (int i = 0; i < writers->size(); ++i) {
+    const int batch_size = (*batch_sizes)[i];
+    const int dim_features = (*features)[i].size() / batch_size;
+    (*writers)[i]->Write(&(*features)[i][0], batch_size, dim_features);
+    const int previous = (*image_indices)[i];
+    (*image_indices)[i] += batch_size;
+    if (previous / 1000 != (*image_indices)[i] / 1000) {
+      LOG(ERROR)<< "Extracted features of " << (*image_indices)[i] <<
+          " query images for feature blob " << (*blob_names)[i];
+    }
+  }
+}
 
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
@@ -27,21 +284,30 @@ int main(int argc, char** argv) {
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
   const int num_required_args = 6;
   if (argc < num_required_args) {
     LOG(ERROR)<<
     "This program takes in a trained network and an input data layer, and then"
     " extract features of the input data produced by the net.\n"
-    "Usage: extract_features  pretrained_net_param"
+    "Usage: extract_features [--backend=leveldb|lmdb|npy]"
+    "  [--float_encoding=float|half|quantized]"
+    "  pretrained_net_param"
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
-    "  save_feature_leveldb_name1[,name2,...]  num_mini_batches  [CPU/GPU]"
+    "  save_feature_dataset_name1[,name2,...]  num_mini_batches  [CPU/GPU]"
     "  [DEVICE_ID=0]\n"
     "Note: you can extract multiple features in one pass by specifying"
-    " multiple feature blob names and leveldb names seperated by ','."
+    " multiple feature blob names and dataset names seperated by ','."
     " The names cannot contain white space characters and the number of blobs"
-    " and leveldbs must be equal.";
+    " and datasets must be equal.";
     return 1;
   }
+  CHECK(FLAGS_float_encoding == "float" || FLAGS_float_encoding == "half" ||
+        FLAGS_float_encoding == "quantized")
+      << "Unknown float encoding " << FLAGS_float_encoding;
   int arg_pos = num_required_args;
 
   arg_pos = num_required_args;
@@ -92,20 +358,28 @@ int feature_extraction_pipeline(int argc, char** argv) {
    }
    */
   string feature_extraction_proto(argv[++arg_pos]);
-  shared_ptr<Net<Dtype> > feature_extraction_net(
-      new Net<Dtype>(feature_extraction_proto));
-  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
-
   string extract_feature_blob_names(argv[++arg_pos]);
   vector<string> blob_names;
   boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
 
-  string save_feature_leveldb_names(argv[++arg_pos]);
-  vector<string> leveldb_names;
-  boost::split(leveldb_names, save_feature_leveldb_names,
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(feature_extraction_proto, &net_param);
+  if (FLAGS_prune) {
+    // Drop the layers, such as the classifier and the losses, that the
+    // feature blobs do not depend on.
+    NetParameter filtered_param;
+    Net<Dtype>::FilterNet(net_param, &filtered_param);
+    Net<Dtype>::PruneNet(filtered_param, blob_names, &net_param);
+  }
+  shared_ptr<Net<Dtype> > feature_extraction_net(new Net<Dtype>(net_param));
+  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
+
+  string save_feature_dataset_names(argv[++arg_pos]);
+  vector<string> dataset_names;
+  boost::split(dataset_names, save_feature_dataset_names,
                boost::is_any_of(","));
-  CHECK_EQ(blob_names.size(), leveldb_names.size()) <<
-      " the number of blob names and leveldb names must be equal";
+  CHECK_EQ(blob_names.size(), dataset_names.size()) <<
+      " the number of blob names and dataset names must be equal";
   size_t num_features = blob_names.size();
 
   for (size_t i = 0; i < num_features; i++) {
@@ -114,72 +388,48 @@ int feature_extraction_pipeline(int argc, char** argv) {
         << " in the network " << feature_extraction_proto;
   }
 
-  leveldb::Options options;
-  options.error_if_exists = true;
-  options.create_if_missing = true;
-  options.write_buffer_size = 268435456;
-  vector<shared_ptr<leveldb::DB> > feature_dbs;
+  vector<shared_ptr<FeatureWriter> > feature_writers;
   for (size_t i = 0; i < num_features; ++i) {
-    LOG(INFO)<< "Opening leveldb " << leveldb_names[i];
-    leveldb::DB* db;
-    leveldb::Status status = leveldb::DB::Open(options,
-                                               leveldb_names[i].c_str(),
-                                               &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << leveldb_names[i];
-    feature_dbs.push_back(shared_ptr<leveldb::DB>(db));
+    feature_writers.push_back(shared_ptr<FeatureWriter>(
+        CreateFeatureWriter(FLAGS_backend, dataset_names[i])));
   }
 
   int num_mini_batches = atoi(argv[++arg_pos]);
 
   LOG(ERROR)<< "Extracting Features";
 
-  Datum datum;
-  vector<shared_ptr<leveldb::WriteBatch> > feature_batches(
-      num_features,
-      shared_ptr<leveldb::WriteBatch>(new leveldb::WriteBatch()));
-  const int kMaxKeyStrLength = 100;
-  char key_str[kMaxKeyStrLength];
+  // The features of a mini-batch are copied out of the net and written by a
+  // writer thread while the next mini-batch is forwarded.
+  vector<vector<float> > features[2];
+  vector<int> batch_sizes[2];
+  boost::thread writer_thread;
   vector<Blob<float>*> input_vec;
   vector<int> image_indices(num_features, 0);
   for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
     feature_extraction_net->Forward(input_vec);
+    const int buffer = batch_index % 2;
+    features[buffer].resize(num_features);
+    batch_sizes[buffer].resize(num_features);
     for (int i = 0; i < num_features; ++i) {
       const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
           ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(dim_features);
-        datum.set_width(1);
-        datum.set_channels(1);
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->mutable_cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        string value;
-        datum.SerializeToString(&value);
-        snprintf(key_str, kMaxKeyStrLength, "%d", image_indices[i]);
-        feature_batches[i]->Put(string(key_str), value);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          feature_dbs[i]->Write(leveldb::WriteOptions(),
-                                feature_batches[i].get());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-          feature_batches[i].reset(new leveldb::WriteBatch());
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
+      const Dtype* feature_blob_data = feature_blob->cpu_data();
+      features[buffer][i].assign(feature_blob_data,
+                                 feature_blob_data + feature_blob->count());
+      batch_sizes[buffer][i] = feature_blob->num();
     }  // for (int i = 0; i < num_features; ++i)
+    if (writer_thread.joinable()) {
+      writer_thread.join();
+    }
+    writer_thread = boost::thread(&WriteFeatures, &feature_writers,
+        &features[buffer], &batch_sizes[buffer], &image_indices, &blob_names);
   }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
   // write the last batch
+  if (writer_thread.joinable()) {
+    writer_thread.join();
+  }
   for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
-      feature_dbs[i]->Write(leveldb::WriteOptions(), feature_batches[i].get());
-    }
+    feature_writers[i]->Close();
     LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
         " query images for feature blob " << blob_names[i];
   }
@@ -187,4 +437,3 @@ int feature_extraction_pipeline(int argc, char** argv) {
   LOG(ERROR)<< "Successfully extracted the features!";
   return 0;
 }
-